@@ -1,13 +1,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#ifndef WASM_BUILD
-#include <unistd.h>
-#include <sys/socket.h>
-#include <netdb.h>
-#include <openssl/ssl.h>
-#include <openssl/err.h>
-#endif
+#include <strings.h>
+#include <stdarg.h>
+#include <ctype.h>
 #include "glk.h"
 #include "cheapglk.h"
 #include "glk_llm.h"
@@ -42,6 +38,12 @@ EM_JS(int, js_llm_process_input, (const char* input, const char* context_json, c
 glk_llm_config_t gli_llm_config;
 glk_llm_context_t gli_llm_context;
 
+static void check_parser_error(const char *text);
+static void log_tier_stats(void);
+static void help_stop(void);
+
+static FILE *log_stream = NULL;
+
 void gli_llm_init(void)
 {
     memset(&gli_llm_config, 0, sizeof(gli_llm_config));
@@ -49,8 +51,19 @@ void gli_llm_init(void)
     
     gli_llm_config.enabled = 0;
     gli_llm_config.context_lines = 10;
+    gli_llm_config.context_turns = 2;
     gli_llm_config.timeout_ms = 5000;
+    gli_llm_config.fast_timeout_ms = 2000;
+    gli_llm_config.conversation_budget = 4000;
+    gli_llm_config.speculate_ms = 400;
+    gli_llm_config.recall_tokens = 300;
+    gli_llm_config.shared_cache_entries = 65536;
     gli_llm_config.echo_interpretation = 1;
+    gli_llm_config.memory_size = 32;
+    gli_llm_config.memory_examples = 3;
+    gli_llm_config.raw_detect = 1;
+    gli_llm_config.raw_linebuf_max = 32;
+    gli_llm_config.usage_summary = 1;
 
 #ifndef WASM_BUILD
     char *config_file = getenv("GLK_LLM_CONFIG");
@@ -62,6 +75,72 @@ void gli_llm_init(void)
         gli_llm_load_config(default_config);
     }
 #endif
+
+    gli_llm_template_load(gli_llm_config.prompt_template);
+
+    if (gli_llm_config.enabled && gli_llm_config.tokenizer[0]) {
+        if (!gli_llm_tokenizer_load(gli_llm_config.tokenizer))
+            fprintf(stderr, "Glk LLM: unable to load tokenizer %s\n", gli_llm_config.tokenizer);
+    }
+
+#ifndef WASM_BUILD
+    if (gli_llm_config.enabled && gli_llm_config.log_file[0]) {
+        log_stream = fopen(gli_llm_config.log_file, "a");
+        if (!log_stream)
+            fprintf(stderr, "Glk LLM: unable to open log file %s\n", gli_llm_config.log_file);
+    }
+#endif
+
+    if (gli_llm_config.enabled && gli_llm_config.phrasebook[0]) {
+        if (!gli_llm_phrasebook_load(gli_llm_config.phrasebook))
+            fprintf(stderr, "Glk LLM: unable to load phrasebook %s\n", gli_llm_config.phrasebook);
+    }
+
+    if (gli_llm_config.enabled && gli_llm_config.cassette_mode != llmcassette_Off) {
+        if (!gli_llm_cassette_open(gli_llm_config.cassette, gli_llm_config.cassette_mode))
+            fprintf(stderr, "Glk LLM: unable to open cassette %s\n", gli_llm_config.cassette);
+    }
+
+    gli_llm_warmup_start();
+}
+
+/* Called from glk_exit(). */
+void gli_llm_exit(void)
+{
+    log_tier_stats();
+    // Let go of requests still in flight before what they use is freed
+    gli_llm_warmup_stop();
+    gli_llm_prefetch_stop();
+    gli_llm_speculate_cancel();
+    help_stop();
+    gli_llm_disambig_stats();
+    gli_llm_phrasebook_free();
+    gli_llm_recall_free();
+    gli_llm_shared_close();
+    gli_llm_spell_free();
+    gli_llm_conversation_reset();
+    gli_llm_tokenizer_free();
+    gli_llm_cassette_close();
+    gli_llm_usage_summary();
+    if (log_stream) {
+        fclose(log_stream);
+        log_stream = NULL;
+    }
+}
+
+/* Write a line to the log file (log_file= in the config), if there is
+   one. */
+void gli_llm_log(const char *fmt, ...)
+{
+    if (!log_stream)
+        return;
+
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(log_stream, fmt, ap);
+    va_end(ap);
+    fputc('\n', log_stream);
+    fflush(log_stream);
 }
 
 void gli_llm_load_config(const char *config_file)
@@ -115,10 +194,126 @@ void gli_llm_load_config(const char *config_file)
             gli_llm_config.context_lines = atoi(value);
             if (gli_llm_config.context_lines > GLK_LLM_CONTEXT_LINES)
                 gli_llm_config.context_lines = GLK_LLM_CONTEXT_LINES;
+        } else if (strcmp(key, "context_mode") == 0) {
+            if (strcmp(value, "turns") == 0)
+                gli_llm_config.context_mode = llmcontext_Turns;
+            else if (strcmp(value, "room") == 0)
+                gli_llm_config.context_mode = llmcontext_Room;
+            else
+                gli_llm_config.context_mode = llmcontext_Lines;
+        } else if (strcmp(key, "context_turns") == 0) {
+            gli_llm_config.context_turns = atoi(value);
+        } else if (strcmp(key, "context_tokens") == 0) {
+            gli_llm_config.context_tokens = atoi(value);
+        } else if (strcmp(key, "tokenizer") == 0) {
+            strncpy(gli_llm_config.tokenizer, value, sizeof(gli_llm_config.tokenizer) - 1);
         } else if (strcmp(key, "timeout_ms") == 0) {
             gli_llm_config.timeout_ms = atoi(value);
+        } else if (strcmp(key, "fast_endpoint") == 0) {
+            strncpy(gli_llm_config.fast_endpoint, value, sizeof(gli_llm_config.fast_endpoint) - 1);
+        } else if (strcmp(key, "fast_api_key") == 0) {
+            strncpy(gli_llm_config.fast_api_key, value, sizeof(gli_llm_config.fast_api_key) - 1);
+        } else if (strcmp(key, "fast_model") == 0) {
+            strncpy(gli_llm_config.fast_model, value, sizeof(gli_llm_config.fast_model) - 1);
+        } else if (strcmp(key, "fast_timeout_ms") == 0) {
+            gli_llm_config.fast_timeout_ms = atoi(value);
+        } else if (strcmp(key, "keep_alive") == 0) {
+            strncpy(gli_llm_config.keep_alive, value, sizeof(gli_llm_config.keep_alive) - 1);
+        } else if (strcmp(key, "warmup") == 0) {
+            gli_llm_config.warmup = atoi(value);
+        } else if (strcmp(key, "heartbeat_s") == 0) {
+            gli_llm_config.heartbeat_s = atoi(value);
+        } else if (strcmp(key, "line_editor") == 0) {
+            gli_llm_config.line_editor = atoi(value);
+        } else if (strcmp(key, "speculate_ms") == 0) {
+            gli_llm_config.speculate_ms = atoi(value);
+        } else if (strcmp(key, "prefetch") == 0) {
+            gli_llm_config.prefetch = atoi(value);
+        } else if (strcmp(key, "vocabulary") == 0) {
+            gli_llm_config.vocabulary = atoi(value);
+        } else if (strcmp(key, "spelling") == 0) {
+            gli_llm_config.spelling = atoi(value);
+        } else if (strcmp(key, "pronouns") == 0) {
+            gli_llm_config.pronouns = atoi(value);
+        } else if (strcmp(key, "disambiguation") == 0) {
+            gli_llm_config.disambiguation = atoi(value);
+        } else if (strcmp(key, "phrasebook") == 0) {
+            strncpy(gli_llm_config.phrasebook, value, sizeof(gli_llm_config.phrasebook) - 1);
+        } else if (strcmp(key, "recall") == 0) {
+            gli_llm_config.recall = atoi(value);
+        } else if (strcmp(key, "recall_tokens") == 0) {
+            gli_llm_config.recall_tokens = atoi(value);
+        } else if (strcmp(key, "shared_cache") == 0) {
+            strncpy(gli_llm_config.shared_cache, value, sizeof(gli_llm_config.shared_cache) - 1);
+        } else if (strcmp(key, "shared_cache_entries") == 0) {
+            gli_llm_config.shared_cache_entries = atoi(value);
+        } else if (strcmp(key, "broker_socket") == 0) {
+            strncpy(gli_llm_config.broker_socket, value, sizeof(gli_llm_config.broker_socket) - 1);
+        } else if (strcmp(key, "conversation") == 0) {
+            gli_llm_config.conversation = atoi(value);
+        } else if (strcmp(key, "conversation_budget") == 0) {
+            gli_llm_config.conversation_budget = atoi(value);
+        } else if (strcmp(key, "log_file") == 0) {
+            strncpy(gli_llm_config.log_file, value, sizeof(gli_llm_config.log_file) - 1);
         } else if (strcmp(key, "echo_interpretation") == 0) {
             gli_llm_config.echo_interpretation = atoi(value);
+        } else if (strcmp(key, "prompt_template") == 0) {
+            strncpy(gli_llm_config.prompt_template, value, sizeof(gli_llm_config.prompt_template) - 1);
+        } else if (strcmp(key, "candidates") == 0) {
+            gli_llm_config.candidates = atoi(value);
+            if (gli_llm_config.candidates > GLK_LLM_MAX_CANDIDATES)
+                gli_llm_config.candidates = GLK_LLM_MAX_CANDIDATES;
+        } else if (strcmp(key, "memory_size") == 0) {
+            gli_llm_config.memory_size = atoi(value);
+            if (gli_llm_config.memory_size > GLK_LLM_MEMORY_MAX)
+                gli_llm_config.memory_size = GLK_LLM_MEMORY_MAX;
+        } else if (strcmp(key, "memory_examples") == 0) {
+            gli_llm_config.memory_examples = atoi(value);
+        } else if (strcmp(key, "raw_detect") == 0) {
+            gli_llm_config.raw_detect = atoi(value);
+        } else if (strcmp(key, "raw_linebuf_max") == 0) {
+            gli_llm_config.raw_linebuf_max = atoi(value);
+        } else if (strcmp(key, "raw_pattern") == 0) {
+            if (value[0] && gli_llm_config.num_raw_patterns < GLK_LLM_MAX_PATTERNS) {
+                char *dest = gli_llm_config.raw_patterns[gli_llm_config.num_raw_patterns++];
+                strncpy(dest, value, sizeof(gli_llm_config.raw_patterns[0]) - 1);
+            }
+        } else if (strcmp(key, "interpret_pattern") == 0) {
+            if (value[0] && gli_llm_config.num_interpret_patterns < GLK_LLM_MAX_PATTERNS) {
+                char *dest = gli_llm_config.interpret_patterns[gli_llm_config.num_interpret_patterns++];
+                strncpy(dest, value, sizeof(gli_llm_config.interpret_patterns[0]) - 1);
+            }
+        } else if (strcmp(key, "cassette") == 0) {
+            strncpy(gli_llm_config.cassette, value, sizeof(gli_llm_config.cassette) - 1);
+        } else if (strcmp(key, "cassette_mode") == 0) {
+            if (strcmp(value, "record") == 0)
+                gli_llm_config.cassette_mode = llmcassette_Record;
+            else if (strcmp(value, "replay") == 0)
+                gli_llm_config.cassette_mode = llmcassette_Replay;
+            else
+                gli_llm_config.cassette_mode = llmcassette_Off;
+        } else if (strcmp(key, "cassette_timing") == 0) {
+            gli_llm_config.cassette_timing = atoi(value);
+        } else if (strcmp(key, "help") == 0) {
+            gli_llm_config.help = atoi(value);
+        } else if (strcmp(key, "help_wait_ms") == 0) {
+            gli_llm_config.help_wait_ms = atoi(value);
+        } else if (strcmp(key, "parser_error") == 0) {
+            if (value[0] && gli_llm_config.num_parser_errors < GLK_LLM_MAX_PATTERNS) {
+                char *dest = gli_llm_config.parser_errors[gli_llm_config.num_parser_errors++];
+                strncpy(dest, value, sizeof(gli_llm_config.parser_errors[0]) - 1);
+            }
+        } else if (strcmp(key, "price") == 0) {
+            if (value[0] && gli_llm_config.num_prices < GLK_LLM_MAX_PATTERNS) {
+                char *dest = gli_llm_config.prices[gli_llm_config.num_prices++];
+                strncpy(dest, value, sizeof(gli_llm_config.prices[0]) - 1);
+            }
+        } else if (strcmp(key, "budget_tokens") == 0) {
+            gli_llm_config.budget_tokens = atoi(value);
+        } else if (strcmp(key, "budget_usd") == 0) {
+            gli_llm_config.budget_usd = atof(value);
+        } else if (strcmp(key, "usage_summary") == 0) {
+            gli_llm_config.usage_summary = atoi(value);
         }
     }
     
@@ -130,126 +325,858 @@ void gli_llm_add_context(const char *text)
     if (!text || !*text) return;
     
     int pos = gli_llm_context.position;
-    strncpy(gli_llm_context.lines[pos], text, sizeof(gli_llm_context.lines[pos]) - 1);
-    gli_llm_context.lines[pos][sizeof(gli_llm_context.lines[pos]) - 1] = '\0';
+    char *line = gli_llm_context.lines[pos];
+    size_t len = strlen(text);
+    if (len >= sizeof(gli_llm_context.lines[pos])) {
+        // Don't cut a UTF-8 sequence in half
+        len = sizeof(gli_llm_context.lines[pos]) - 1;
+        while (len > 0 && ((unsigned char)text[len] & 0xC0) == 0x80)
+            len--;
+    }
+    memcpy(line, text, len);
+    line[len] = '\0';
+    gli_llm_context.line_turns[pos] = gli_llm_context.turn;
     
     gli_llm_context.position = (pos + 1) % GLK_LLM_CONTEXT_LINES;
     if (gli_llm_context.count < GLK_LLM_CONTEXT_LINES) {
         gli_llm_context.count++;
     }
+
+    gli_llm_vocab_add_output(text);
+    gli_llm_recall_add_output(text);
+    check_parser_error(text);
+}
+
+/* Called when the game asks for a line. Output from here on belongs to
+   the next turn. */
+void gli_llm_new_turn(void)
+{
+    gli_llm_flush_output();
+    gli_llm_recall_end_turn();
+    gli_llm_context.turn++;
+}
+
+/* The ring index of the nth most recent context line (from 1). */
+static int recent_line(int n)
+{
+    return (gli_llm_context.position - n + 2 * GLK_LLM_CONTEXT_LINES) % GLK_LLM_CONTEXT_LINES;
+}
+
+/* How many of the most recent context lines go into the prompt. */
+static int context_span(void)
+{
+    int count = gli_llm_context.count;
+    int span = 0;
+
+    switch (gli_llm_config.context_mode) {
+        case llmcontext_Turns:
+            // Output of the last context_turns turns, counting the
+            // one the player is answering now
+            while (span < count) {
+                glui32 age = gli_llm_context.turn - gli_llm_context.line_turns[recent_line(span + 1)];
+                if ((int)age > gli_llm_config.context_turns)
+                    break;
+                span++;
+            }
+            return span;
+        case llmcontext_Room:
+            for (span = 1; span <= count; span++) {
+                if (gli_llm_is_room_header(gli_llm_context.lines[recent_line(span)]))
+                    return span;
+            }
+            // No room header in sight; fall back to a line count
+            break;
+    }
+
+    span = gli_llm_config.context_lines;
+    return (span < count) ? span : count;
+}
+
+/* Cut a span of recent lines down to fit context_tokens, keeping the
+   newest. */
+static int fit_context_tokens(int span)
+{
+    if (gli_llm_config.context_tokens <= 0)
+        return span;
+
+    size_t total = 0;
+    for (int n = 1; n <= span; n++) {
+        total += gli_llm_count_tokens_str(gli_llm_context.lines[recent_line(n)]) + 1;
+        if (total > (size_t)gli_llm_config.context_tokens)
+            return n - 1;
+    }
+    return span;
+}
+
+/* Append the recent output that would go into the prompt, one line per
+   line, oldest first. */
+void gli_llm_recent_output(glk_llm_strbuf_t *sb)
+{
+    int span = fit_context_tokens(context_span());
+    for (int n = span; n > 0; n--) {
+        gli_llm_strbuf_append_str(sb, gli_llm_context.lines[recent_line(n)]);
+        gli_llm_strbuf_append_str(sb, "\n");
+    }
+}
+
+/* The turn of the oldest line gli_llm_recent_output() would give. */
+glui32 gli_llm_recent_turn(void)
+{
+    int span = fit_context_tokens(context_span());
+    if (span <= 0)
+        return gli_llm_context.turn;
+    return gli_llm_context.line_turns[recent_line(span)];
+}
+
+/* Output which means the game's parser rejected the last command. More
+   can be added with parser_error= lines in the config. */
+static const char *builtin_parser_errors[] = {
+    "I didn't understand",
+    "That's not a verb I recognise",
+    "That's not a verb I recognize",
+    "I don't know the word",
+    "You can't see any such thing",
+    "I only understood you as far as",
+    "You seem to have said too little",
+    "That's not something you need to refer to",
+    "I beg your pardon?",
+    NULL
+};
+
+/* Case-insensitive strstr. */
+const char *gli_llm_find_nocase(const char *haystack, const char *needle)
+{
+    size_t len = strlen(needle);
+    if (!len) return haystack;
+
+    for (; *haystack; haystack++) {
+        if (strncasecmp(haystack, needle, len) == 0)
+            return haystack;
+    }
+    return NULL;
 }
 
-static void escape_json_string(const char *input, char *output, size_t max_len)
-{
-    size_t i = 0, j = 0;
-    while (input[i] && j < max_len - 2) {
-        switch (input[i]) {
-            case '"':
-            case '\\':
-                if (j < max_len - 3) {
-                    output[j++] = '\\';
-                    output[j++] = input[i];
-                }
-                break;
-            case '\n':
-                if (j < max_len - 3) {
-                    output[j++] = '\\';
-                    output[j++] = 'n';
-                }
-                break;
-            case '\r':
-                if (j < max_len - 3) {
-                    output[j++] = '\\';
-                    output[j++] = 'r';
-                }
-                break;
-            case '\t':
-                if (j < max_len - 3) {
-                    output[j++] = '\\';
-                    output[j++] = 't';
-                }
-                break;
-            default:
-                output[j++] = input[i];
-                break;
+int gli_llm_is_parser_error(const char *text)
+{
+    for (int ix = 0; builtin_parser_errors[ix]; ix++) {
+        if (gli_llm_find_nocase(text, builtin_parser_errors[ix]))
+            return 1;
+    }
+    for (int ix = 0; ix < gli_llm_config.num_parser_errors; ix++) {
+        if (gli_llm_find_nocase(text, gli_llm_config.parser_errors[ix]))
+            return 1;
+    }
+    return 0;
+}
+
+/* The command that went to the game for the player's last input. */
+const char *gli_llm_sent_command(void)
+{
+    if (gli_llm_context.tier != llmtier_None && gli_llm_context.last_command[0])
+        return gli_llm_context.last_command;
+    return gli_llm_context.last_user_input;
+}
+
+/* Does this output line look like a room header? Those are short,
+   capitalized, and don't end in sentence punctuation. */
+int gli_llm_is_room_header(const char *text)
+{
+    size_t len = strlen(text);
+    while (len && (text[len-1] == ' ' || text[len-1] == '\t'))
+        len--;
+
+    if (len == 0 || len >= 50)
+        return 0;
+    if (!(text[0] >= 'A' && text[0] <= 'Z'))
+        return 0;
+    if (strchr(".!?:,;\"')]", text[len-1]))
+        return 0;
+    if (strstr(text, "You") || strstr(text, "you"))
+        return 0;
+    return 1;
+}
+
+/* Copy the most recent room header in the context to buf (empty if
+   none is found). */
+void gli_llm_current_room(char *buf, size_t len)
+{
+    buf[0] = '\0';
+    for (int i = 1; i <= gli_llm_context.count; i++) {
+        int idx = (gli_llm_context.position - i + GLK_LLM_CONTEXT_LINES) % GLK_LLM_CONTEXT_LINES;
+        if (gli_llm_is_room_header(gli_llm_context.lines[idx])) {
+            strncpy(buf, gli_llm_context.lines[idx], len - 1);
+            buf[len - 1] = '\0';
+            return;
         }
-        i++;
     }
-    output[j] = '\0';
+}
+
+/* Words in a prompt which ask for free text rather than a command.
+   Matched as whole words, so "renamed" or "unnamed" don't count. */
+static const char *raw_prompt_words[] = {
+    "name",
+    "password",
+    NULL
+};
+
+/* Does text contain word, case-insensitively, with no letter or digit
+   on either side? */
+static int has_word_nocase(const char *text, const char *word)
+{
+    size_t len = strlen(word);
+    const char *pos = text;
+    while ((pos = gli_llm_find_nocase(pos, word))) {
+        if ((pos == text || !isalnum((unsigned char)pos[-1]))
+            && !isalnum((unsigned char)pos[len]))
+            return 1;
+        pos++;
+    }
+    return 0;
+}
+
+static int matches_any(const char *text, char patterns[][128], int count)
+{
+    for (int ix = 0; ix < count; ix++) {
+        if (gli_llm_find_nocase(text, patterns[ix]))
+            return 1;
+    }
+    return 0;
+}
+
+/* Is the game asking for free text (a name, a password, an answer to a
+   question) rather than a command? Such input goes to the game as
+   typed. prompt is the partial output line in front of the cursor;
+   linebuflen is the size of the game's line buffer.
+
+   Config patterns come first: interpret_pattern= forces interpretation
+   and raw_pattern= forces raw input when they match the prompt or the
+   line before it. Then a short line buffer means raw input. Otherwise
+   a normal ">" prompt means a command, even after a question like
+   "Which do you mean...?"; without one, a question mark, a trailing
+   colon, or a word like "name" means raw input. */
+int gli_llm_is_raw_prompt(const char *prompt, glui32 linebuflen)
+{
+    char question[256];
+    size_t len;
+
+    if (!gli_llm_config.raw_detect)
+        return 0;
+
+    while (*prompt == ' ' || *prompt == '\t')
+        prompt++;
+    len = strlen(prompt);
+    while (len && (prompt[len-1] == ' ' || prompt[len-1] == '\t'))
+        len--;
+    if (len >= sizeof(question))
+        len = sizeof(question) - 1;
+    memcpy(question, prompt, len);
+    question[len] = '\0';
+
+    // The question itself may be on the line above the prompt
+    const char *previous = "";
+    if (gli_llm_context.count > 0) {
+        int idx = (gli_llm_context.position - 1 + GLK_LLM_CONTEXT_LINES) % GLK_LLM_CONTEXT_LINES;
+        previous = gli_llm_context.lines[idx];
+    }
+
+    if (matches_any(question, gli_llm_config.interpret_patterns, gli_llm_config.num_interpret_patterns)
+        || matches_any(previous, gli_llm_config.interpret_patterns, gli_llm_config.num_interpret_patterns))
+        return 0;
+    if (matches_any(question, gli_llm_config.raw_patterns, gli_llm_config.num_raw_patterns)
+        || matches_any(previous, gli_llm_config.raw_patterns, gli_llm_config.num_raw_patterns))
+        return 1;
+
+    if (linebuflen && gli_llm_config.raw_linebuf_max > 0
+        && linebuflen < (glui32)gli_llm_config.raw_linebuf_max)
+        return 1;
+
+    if (len && question[len-1] == '>')
+        return 0;
+
+    // No command prompt; look at what was asked
+    const char *asked = len ? question : previous;
+    size_t asklen = strlen(asked);
+    while (asklen && (asked[asklen-1] == ' ' || asked[asklen-1] == '\t'))
+        asklen--;
+    if (asklen && (asked[asklen-1] == '?' || asked[asklen-1] == ':'))
+        return 1;
+    for (int ix = 0; raw_prompt_words[ix]; ix++) {
+        if (has_word_nocase(asked, raw_prompt_words[ix]))
+            return 1;
+    }
+    return 0;
+}
+
+void gli_llm_add_history(const char *input, const char *command)
+{
+    if (!input || !*input) return;
+
+    int pos = gli_llm_context.history_position;
+    snprintf(gli_llm_context.history[pos], sizeof(gli_llm_context.history[pos]),
+        "%s -> %s", input, (command && *command) ? command : "(unchanged)");
+
+    gli_llm_context.history_position = (pos + 1) % GLK_LLM_HISTORY_LINES;
+    if (gli_llm_context.history_count < GLK_LLM_HISTORY_LINES) {
+        gli_llm_context.history_count++;
+    }
 }
 
 static char* parse_json_response(const char *response)
 {
-    const char *content_start = strstr(response, "\"content\"");
-    if (!content_start) return NULL;
-    
-    const char *value_start = strchr(content_start, ':');
-    if (!value_start) return NULL;
-    value_start++;
-    
-    while (*value_start == ' ' || *value_start == '\t' || *value_start == '\n') 
-        value_start++;
-    
-    if (*value_start != '"') return NULL;
-    value_start++;
+    return gli_llm_json_string(response, "content");
+}
+
+#ifndef WASM_BUILD
+
+/* Raw values for the prompt template slots. */
+typedef struct {
+    glk_llm_strbuf_t context;
+    glk_llm_strbuf_t scene;
+    glk_llm_strbuf_t history;
+    glk_llm_strbuf_t examples;
+    glk_llm_strbuf_t recalled;
+    char location[256];
+    const char *slots[llmslot_NumSlots];
+} prompt_slots_t;
+
+static void gather_slots(prompt_slots_t *ps, const char *input)
+{
+    gli_llm_strbuf_init(&ps->context);
+    gli_llm_strbuf_init(&ps->scene);
+    gli_llm_strbuf_init(&ps->history);
+    gli_llm_strbuf_init(&ps->examples);
+    gli_llm_strbuf_init(&ps->recalled);
+    ps->location[0] = '\0';
+
+    gli_llm_recent_output(&ps->context);
     
-    const char *value_end = value_start;
-    while (*value_end) {
-        if (*value_end == '"' && *(value_end - 1) != '\\') {
-            break;
+    if (gli_llm_context.count > 0 && gli_llm_config.context_mode != llmcontext_Lines) {
+        // Output lines are tagged by turn, so the scene is exactly what
+        // the last command produced, and the location is the last room
+        // header
+        gli_llm_current_room(ps->location, sizeof(ps->location));
+        glui32 last = gli_llm_context.line_turns[recent_line(1)];
+        int n = 0;
+        while (n < gli_llm_context.count && gli_llm_context.line_turns[recent_line(n + 1)] == last)
+            n++;
+        for (int i = n; i > 0; i--) {
+            gli_llm_strbuf_append_str(&ps->scene, gli_llm_context.lines[recent_line(i)]);
+            gli_llm_strbuf_append_str(&ps->scene, "\n");
         }
-        value_end++;
     }
-    
-    if (!*value_end) return NULL;
-    
-    size_t len = value_end - value_start;
-    char *result = malloc(len + 1);
-    if (!result) return NULL;
-    
-    memcpy(result, value_start, len);
-    result[len] = '\0';
-    
-    return result;
+    else if (gli_llm_context.count > 0) {
+        // Build comprehensive scene context with location awareness
+        // Try to extract current location name (usually first line or has distinctive formatting)
+        const char *recent = gli_llm_context.lines[recent_line(1)];
+        
+        // Look for location name patterns (usually short lines at start of descriptions)
+        if (recent[0] && strlen(recent) < 50 && !strstr(recent, "You") && !strstr(recent, "you")) {
+            strncpy(ps->location, recent, sizeof(ps->location) - 1);
+            ps->location[sizeof(ps->location) - 1] = '\0';
+        }
+        
+        // Include last 5 lines of context for full scene understanding
+        int lines_to_include = (gli_llm_context.count < 5) ? gli_llm_context.count : 5;
+        
+        for (int i = lines_to_include; i > 0; i--) {
+            int idx = recent_line(i);
+            if (gli_llm_context.lines[idx][0]) {
+                gli_llm_strbuf_append_str(&ps->scene, gli_llm_context.lines[idx]);
+                gli_llm_strbuf_append_str(&ps->scene, "\n");
+            }
+        }
+    }
+
+    if (gli_llm_context.history_count > 0) {
+        int start = gli_llm_context.history_position - gli_llm_context.history_count;
+        if (start < 0) start += GLK_LLM_HISTORY_LINES;
+
+        for (int i = 0; i < gli_llm_context.history_count; i++) {
+            int idx = (start + i) % GLK_LLM_HISTORY_LINES;
+            gli_llm_strbuf_append_str(&ps->history, gli_llm_context.history[idx]);
+            gli_llm_strbuf_append_str(&ps->history, "\n");
+        }
+    }
+
+    ps->slots[llmslot_Context] = ps->context.buf;
+    ps->slots[llmslot_Scene] = ps->scene.buf;
+    ps->slots[llmslot_Location] = ps->location[0] ? ps->location : "(unknown)";
+    ps->slots[llmslot_Input] = input;
+    gli_llm_memory_examples(input, &ps->examples);
+
+    ps->slots[llmslot_History] = ps->history.buf;
+    ps->slots[llmslot_Examples] = ps->examples.buf;
+
+    glk_llm_strbuf_t passages;
+    gli_llm_strbuf_init(&passages);
+    gli_llm_recall(input, gli_llm_recent_turn(), &passages);
+    if (passages.len) {
+        gli_llm_strbuf_append_str(&ps->recalled, "EARLIER IN THE GAME (may be relevant):\n");
+        gli_llm_strbuf_append_str(&ps->recalled, passages.buf);
+        gli_llm_strbuf_append_str(&ps->recalled, "\n");
+    }
+    gli_llm_strbuf_free(&passages);
+    ps->slots[llmslot_Recalled] = ps->recalled.buf;
 }
 
-static int parse_url(const char *url, char *protocol, char *host, int *port, char *path)
+static void free_slots(prompt_slots_t *ps)
 {
-    const char *p = url;
-    
-    if (strncmp(p, "https://", 8) == 0) {
-        strcpy(protocol, "https");
-        p += 8;
-        *port = 443;
-    } else if (strncmp(p, "http://", 7) == 0) {
-        strcpy(protocol, "http");
-        p += 7;
-        *port = 80;
+    gli_llm_strbuf_free(&ps->context);
+    gli_llm_strbuf_free(&ps->scene);
+    gli_llm_strbuf_free(&ps->history);
+    gli_llm_strbuf_free(&ps->examples);
+    gli_llm_strbuf_free(&ps->recalled);
+}
+
+/* Cut a command from the model down to its first line. */
+static void clean_command(char *cmd)
+{
+    char *nl = strchr(cmd, '\n');
+    if (nl) *nl = '\0';
+    nl = strchr(cmd, '\r');
+    if (nl) *nl = '\0';
+}
+
+#endif /* WASM_BUILD */
+
+/* Is there anywhere to send requests? A replayed cassette counts. */
+int gli_llm_backend_ready(void)
+{
+    if (gli_llm_config.cassette_mode == llmcassette_Replay)
+        return 1;
+    return (gli_llm_config.api_endpoint[0] != '\0');
+}
+
+#ifndef WASM_BUILD
+
+/* The transport under gli_llm_send(): straight to the endpoint, or to
+   a broker on this host that holds the connections for everyone. */
+int gli_llm_post(const char *url, const char *api_key, int timeout_ms,
+    glk_llm_body_t *body, glk_llm_strbuf_t *response, int *status)
+{
+    if (gli_llm_config.broker_socket[0])
+        return gli_llm_broker_post(gli_llm_config.broker_socket, url, api_key, timeout_ms,
+            body, response, status);
+    return gli_llm_http_post(url, api_key, timeout_ms, body, response, status);
+}
+
+/* Every LLM request made for the player goes through here. (Warm-ups
+   and heartbeats, in cgllmwarm.c, skip the cassette and use
+   gli_llm_post(), but count their usage the same way.) In cassette
+   replay mode the answer comes from the recording; otherwise the
+   request goes out over HTTP, and is recorded if we are recording.
+   Either way its token usage is counted, and nothing is sent once the
+   session's budget is spent. */
+int gli_llm_send(const char *url, const char *api_key, int timeout_ms,
+    glk_llm_body_t *body, glk_llm_strbuf_t *response, int *status)
+{
+    if (!gli_llm_budget_allows())
+        return 0;
+
+    int code = 0;
+    int ok;
+    if (gli_llm_config.cassette_mode == llmcassette_Replay) {
+        ok = gli_llm_cassette_replay(body, response, &code);
     } else {
+        double start = gli_llm_now_ms();
+        ok = gli_llm_post(url, api_key, timeout_ms, body, response, &code);
+        if (ok && gli_llm_config.cassette_mode == llmcassette_Record)
+            gli_llm_cassette_record(body, response, code, gli_llm_now_ms() - start);
+    }
+    if (ok && code == 200 && response->buf)
+        gli_llm_usage_record(body, response->buf);
+
+    if (status)
+        *status = code;
+    return ok;
+}
+
+#endif /* WASM_BUILD */
+
+#ifndef WASM_BUILD
+
+/* Two-tier routing. If a fast model is configured, each input goes to
+   it first; the main model is asked only when the fast one fails, times
+   out, answers with nothing usable, or its command is rejected by the
+   game. Escalations are counted by cause, and the rates written to the
+   log at exit, to help tune which model goes where. */
+
+#define llmescalate_Failed (0)
+#define llmescalate_Empty (1)
+#define llmescalate_Invalid (2)
+#define llmescalate_Rejected (3)
+#define llmescalate_Unknown (4)
+#define llmescalate_NumCauses (5)
+
+static const char *escalate_names[llmescalate_NumCauses] = {
+    "failed", "empty", "invalid", "rejected", "unknown"
+};
+
+static struct {
+    int requests[4];    /* indexed by llmtier_* */
+    int escalations[llmescalate_NumCauses];
+} tier_stats;
+
+static int tiered(void)
+{
+    return (gli_llm_config.fast_model[0] || gli_llm_config.fast_endpoint[0]);
+}
+
+/* Could this plausibly be a game command? Models sometimes answer with
+   an explanation, a refusal, or a whole paragraph. */
+static int valid_command(const char *cmd)
+{
+    int words = 0, letters = 0;
+    size_t len = strlen(cmd);
+
+    if (len == 0 || len >= 100)
         return 0;
+    for (const char *p = cmd; *p; p++) {
+        if (isalpha((unsigned char)*p))
+            letters++;
+        if (*p != ' ' && (p == cmd || p[-1] == ' '))
+            words++;
     }
-    
-    const char *slash = strchr(p, '/');
-    const char *colon = strchr(p, ':');
-    
-    if (colon && (!slash || colon < slash)) {
-        size_t host_len = colon - p;
-        memcpy(host, p, host_len);
-        host[host_len] = '\0';
-        *port = atoi(colon + 1);
-        p = slash ? slash : (p + strlen(p));
+    return (letters > 0 && words <= 12);
+}
+
+/* Append the (escaped) system prompt: the template with this turn's
+   slot values, and the candidates instruction if wanted. */
+static void render_system(glk_llm_body_t *body, const char *input, int numcands, const char *numstr)
+{
+    prompt_slots_t ps;
+    gather_slots(&ps, input);
+    gli_llm_template_render(body, ps.slots);
+    free_slots(&ps);
+
+    if (numcands > 1) {
+        BODY_LITERAL(body, "\\n\\nGive up to ");
+        gli_llm_body_str(body, numstr);
+        BODY_LITERAL(body, " candidate commands, the most likely first, as JSON: "
+            "{\\\"candidates\\\":[\\\"command\\\", ...]}. "
+            "Later candidates are tried in order if the game rejects earlier ones.");
+    }
+}
+
+/* Where one tier's requests go. */
+typedef struct {
+    const char *endpoint;
+    const char *api_key;
+    const char *model;
+    int timeout_ms;
+} llm_target_t;
+
+static void tier_target(int tier, llm_target_t *target)
+{
+    target->endpoint = gli_llm_config.api_endpoint;
+    target->api_key = gli_llm_config.api_key;
+    target->model = gli_llm_config.model;
+    target->timeout_ms = gli_llm_config.timeout_ms;
+
+    if (tier == llmtier_Fast) {
+        if (gli_llm_config.fast_endpoint[0])
+            target->endpoint = gli_llm_config.fast_endpoint;
+        if (gli_llm_config.fast_api_key[0])
+            target->api_key = gli_llm_config.fast_api_key;
+        if (gli_llm_config.fast_model[0])
+            target->model = gli_llm_config.fast_model;
+        target->timeout_ms = gli_llm_config.fast_timeout_ms;
+    }
+    if (!target->model[0])
+        target->model = "gpt-3.5-turbo";
+}
+
+static int wanted_candidates(void)
+{
+    int numcands = gli_llm_config.candidates;
+    if (numcands > GLK_LLM_MAX_CANDIDATES)
+        numcands = GLK_LLM_MAX_CANDIDATES;
+    return numcands;
+}
+
+/* Build the interpretation request for input. */
+static void build_request(glk_llm_body_t *body, const char *model, const char *input)
+{
+    int numcands = wanted_candidates();
+    char numstr[16];
+    snprintf(numstr, sizeof(numstr), "%d", numcands);
+
+    gli_llm_body_init(body);
+
+    BODY_LITERAL(body, "{\"model\":\"");
+    gli_llm_body_json(body, model);
+    BODY_LITERAL(body, "\",\"messages\":[");
+    if (gli_llm_config.conversation) {
+        if (!gli_llm_conversation_started()) {
+            glk_llm_body_t system;
+            gli_llm_body_init(&system);
+            render_system(&system, input, numcands, numstr);
+            gli_llm_conversation_start(&system);
+            gli_llm_body_free(&system);
+        }
+        gli_llm_conversation_messages(body, input);
     } else {
-        size_t host_len = slash ? (slash - p) : strlen(p);
-        memcpy(host, p, host_len);
-        host[host_len] = '\0';
-        p = slash ? slash : (p + strlen(p));
+        BODY_LITERAL(body, "{\"role\":\"system\",\"content\":\"");
+        render_system(body, input, numcands, numstr);
+        BODY_LITERAL(body, "\"},{\"role\":\"user\",\"content\":\"");
+        gli_llm_body_json(body, input);
+        BODY_LITERAL(body, "\"}");
     }
-    
-    strcpy(path, *p ? p : "/");
-    
-    return 1;
+    BODY_LITERAL(body, "],");
+    if (numcands > 1) {
+        // Ask for a structured, ranked list in this one request
+        char schema[80];
+        snprintf(schema, sizeof(schema),
+            "{\"type\":\"array\",\"items\":{\"type\":\"string\"},\"maxItems\":%s}", numstr);
+        gli_llm_body_schema(body, "candidates", schema);
+        char maxtokens[16];
+        snprintf(maxtokens, sizeof(maxtokens), "%d", 20 + 30 * numcands);
+        gli_llm_body_options(body);
+        BODY_LITERAL(body, "\"max_tokens\":");
+        gli_llm_body_str(body, maxtokens);
+    } else {
+        gli_llm_body_options(body);
+        BODY_LITERAL(body, "\"max_tokens\":50");
+    }
+    BODY_LITERAL(body, ",\"temperature\":0.3}");
+}
+
+/* Speculative interpretation. The line editor (cgllmedit.c) calls
+   gli_llm_speculate() when the player stops typing for a moment, and
+   the request for what is on the line so far goes out in the
+   background. If the line the player finally enters is the same, in
+   the same turn, ask_model() picks up that request instead of sending
+   its own; otherwise the speculation is dropped. At most one is in
+   flight. */
+static struct {
+    glk_llm_job_t *job;
+    int tier;
+    glui32 turn;
+    char input[256];
+    size_t tokens;
+    int started;
+    int used;
+} speculation;
+
+void gli_llm_speculate(const char *input)
+{
+    gli_llm_speculate_cancel();
+
+    if (!gli_llm_backend_ready() || !input[0])
+        return;
+    char local[256];
+    if (gli_llm_prefetch_match(input, local, sizeof(local)))
+        return;
+    // The system prompt of a new conversation would carry this input
+    if (gli_llm_config.conversation && !gli_llm_conversation_started())
+        return;
+
+    int tier = tiered() ? llmtier_Fast : llmtier_Main;
+    llm_target_t target;
+    tier_target(tier, &target);
+
+    glk_llm_body_t body;
+    build_request(&body, target.model, input);
+    speculation.tokens = gli_llm_body_tokens(&body);
+
+    /* The job may outlive this turn, and the body can point into
+       conversation state that changes; give it its own copy. */
+    char *flat = gli_llm_body_flatten(&body);
+    gli_llm_body_free(&body);
+    if (!flat)
+        return;
+    gli_llm_body_init(&body);
+    gli_llm_body_copy(&body, flat, strlen(flat));
+    free(flat);
+
+    speculation.job = gli_llm_job_start(gli_llm_send, target.endpoint, target.api_key,
+        target.timeout_ms, &body);
+    if (!speculation.job)
+        return;
+    speculation.tier = tier;
+    speculation.turn = gli_llm_context.turn;
+    strncpy(speculation.input, input, sizeof(speculation.input) - 1);
+    speculation.input[sizeof(speculation.input) - 1] = '\0';
+    speculation.started++;
+}
+
+void gli_llm_speculate_cancel(void)
+{
+    if (!speculation.job)
+        return;
+    gli_llm_job_release(speculation.job);
+    speculation.job = NULL;
+}
+
+/* Is there a speculative request for exactly this? */
+int gli_llm_speculating(const char *input)
+{
+    return (speculation.job && speculation.turn == gli_llm_context.turn
+        && strcmp(speculation.input, input) == 0);
+}
+
+static int vocab_retry = 0;
+
+/* Ask one tier's model to interpret input. Fills cands with up to
+   GLK_LLM_MAX_CANDIDATES valid commands, best first, and returns how
+   many; on 0, *cause says why. */
+static int ask_model(int tier, const char *input, char cands[][256], int *cause)
+{
+    llm_target_t target;
+    tier_target(tier, &target);
+    const char *model = target.model;
+    int numcands = wanted_candidates();
+
+    glk_llm_strbuf_t response;
+    gli_llm_strbuf_init(&response);
+
+    tier_stats.requests[tier]++;
+    size_t tokens = 0;
+    int ok = 0, status = 0;
+    int speculated = 0;
+    double start = gli_llm_now_ms();
+    if (gli_llm_speculating(input) && speculation.tier == tier) {
+        // Already asked while the player was typing; if that failed,
+        // ask again as usual
+        speculated = gli_llm_job_wait(speculation.job, target.timeout_ms)
+            && gli_llm_job_result(speculation.job, &response, &status);
+        if (speculated) {
+            tokens = speculation.tokens;
+            ok = 1;
+            speculation.used++;
+        } else {
+            gli_llm_log("speculation failed for \"%s\"; asking again", input);
+        }
+    }
+    gli_llm_speculate_cancel();
+    if (!speculated) {
+        glk_llm_body_t body;
+        build_request(&body, model, input);
+        tokens = gli_llm_body_tokens(&body);
+        ok = gli_llm_send(target.endpoint, target.api_key, target.timeout_ms, &body, &response, &status);
+        gli_llm_body_free(&body);
+    }
+    double elapsed = gli_llm_now_ms() - start;
+
+    if (ok && gli_llm_conversation_started()) {
+        if (status >= 400 && gli_llm_conversation_refused()) {
+            // Start over with the full context
+            gli_llm_strbuf_free(&response);
+            return ask_model(tier, input, cands, cause);
+        }
+        gli_llm_conversation_response(response.buf);
+    }
+
+    char *interpreted = ok ? parse_json_response(response.buf) : NULL;
+    gli_llm_strbuf_free(&response);
+
+    if (!interpreted) {
+        *cause = llmescalate_Failed;
+        gli_llm_log("tier=%s model=%s tokens=%lu ms=%.0f%s result=failed",
+            (tier == llmtier_Fast) ? "fast" : "main", model, (unsigned long)tokens, elapsed,
+            speculated ? " speculated" : "");
+        return 0;
+    }
+
+    char raw[GLK_LLM_MAX_CANDIDATES][256];
+    int count = 0;
+    if (numcands > 1) {
+        count = gli_llm_json_string_array(interpreted, "candidates",
+            &raw[0][0], sizeof(raw[0]), numcands);
+    }
+    if (count <= 0) {
+        strncpy(raw[0], interpreted, sizeof(raw[0]) - 1);
+        raw[0][sizeof(raw[0]) - 1] = '\0';
+        count = 1;
+    }
+    free(interpreted);
+
+    // Commands with words the game doesn't know would only waste a turn
+    int valid = 0, empty = 1, unknown = 0;
+    char unknown_words[128] = "";
+    for (int ix = 0; ix < count; ix++) {
+        clean_command(raw[ix]);
+        if (raw[ix][0])
+            empty = 0;
+        if (!valid_command(raw[ix]))
+            continue;
+        if (!gli_llm_vocab_check(raw[ix], unknown_words, sizeof(unknown_words))) {
+            unknown = 1;
+            continue;
+        }
+        strcpy(cands[valid++], raw[ix]);
+    }
+
+    if (!valid)
+        *cause = empty ? llmescalate_Empty : unknown ? llmescalate_Unknown : llmescalate_Invalid;
+    else if (gli_llm_conversation_started())
+        gli_llm_conversation_commit(cands[0]);
+    gli_llm_log("tier=%s model=%s tokens=%lu ms=%.0f%s result=%s",
+        (tier == llmtier_Fast) ? "fast" : "main", model, (unsigned long)tokens, elapsed,
+        speculated ? " speculated" : "", valid ? "ok" : escalate_names[*cause]);
+
+    if (!valid && unknown && !vocab_retry) {
+        // Once more, naming the words to stay away from
+        char noted[512];
+        snprintf(noted, sizeof(noted), "%s\n(The game does not understand: %s. "
+            "Use only words from the game output.)", input, unknown_words);
+        vocab_retry = 1;
+        valid = ask_model(tier, noted, cands, cause);
+        vocab_retry = 0;
+    }
+    return valid;
+}
+
+static int ask_tier(int tier, const char *input, char cands[][256])
+{
+    int cause = llmescalate_Failed;
+    int count = ask_model(tier, input, cands, &cause);
+    if (!count && tier == llmtier_Fast)
+        tier_stats.escalations[cause]++;
+    return count;
+}
+
+static void log_tier_stats(void)
+{
+    gli_llm_speculate_cancel();
+    if (speculation.started)
+        gli_llm_log("speculation: started=%d used=%d", speculation.started, speculation.used);
+
+    int fast = tier_stats.requests[llmtier_Fast];
+    if (!fast)
+        return;
+
+    int total = 0;
+    for (int ix = 0; ix < llmescalate_NumCauses; ix++)
+        total += tier_stats.escalations[ix];
+    gli_llm_log("tiers: fast=%d main=%d escalated=%d (%.1f%%) failed=%d empty=%d invalid=%d rejected=%d unknown=%d",
+        fast, tier_stats.requests[llmtier_Main], total, 100.0 * total / fast,
+        tier_stats.escalations[llmescalate_Failed], tier_stats.escalations[llmescalate_Empty],
+        tier_stats.escalations[llmescalate_Invalid], tier_stats.escalations[llmescalate_Rejected],
+        tier_stats.escalations[llmescalate_Unknown]);
+}
+
+#else /* WASM_BUILD */
+
+void gli_llm_speculate(const char *input)
+{
+}
+
+void gli_llm_speculate_cancel(void)
+{
+}
+
+int gli_llm_speculating(const char *input)
+{
+    return 0;
+}
+
+static void log_tier_stats(void)
+{
 }
 
+#endif /* WASM_BUILD */
+
 int gli_llm_process_input(const char *input, char *output, glui32 maxlen)
 {
     if (!gli_llm_config.enabled) {
@@ -292,374 +1219,439 @@ int gli_llm_process_input(const char *input, char *output, glui32 maxlen)
     int changed = js_llm_process_input(input, context_json, scene_info, output, maxlen);
     return changed;
 #else
-    if (!gli_llm_config.api_endpoint[0]) {
+    if (!gli_llm_backend_ready()) {
         strncpy(output, input, maxlen);
         output[maxlen - 1] = '\0';
         return 0;
     }
-    
-    char protocol[16], host[256], path[512];
-    int port;
-    
-    if (!parse_url(gli_llm_config.api_endpoint, protocol, host, &port, path)) {
-        strncpy(output, input, maxlen);
+
+    gli_llm_context.num_alternates = 0;
+    gli_llm_context.next_alternate = 0;
+    gli_llm_context.tier = llmtier_None;
+
+    // "ta lampan" and the like, from the phrasebook
+    if (gli_llm_phrasebook_translate(input, output, maxlen)) {
+        gli_llm_speculate_cancel();
+        gli_llm_context.tier = llmtier_Local;
+        strcpy(gli_llm_context.last_command, output);
+        return 1;
+    }
+
+    // Typos fixed against the game's words, for the local checks; the
+    // model still sees what the player typed
+    char corrected[256];
+    const char *local = input;
+    if (gli_llm_config.spelling && gli_llm_spell_correct(input, corrected, sizeof(corrected))) {
+        gli_llm_log("spelling: \"%s\" -> \"%s\"", input, corrected);
+        local = corrected;
+    }
+
+    // "brass", when the game asked which key
+    if (gli_llm_disambig_answer(local, output, maxlen)) {
+        gli_llm_speculate_cancel();
+        gli_llm_context.tier = llmtier_Local;
+        strcpy(gli_llm_context.last_command, output);
+        return 1;
+    }
+
+    // "take it", when it's clear what it is
+    char resolved[256];
+    if (gli_llm_ref_resolve(local, resolved, sizeof(resolved))) {
+        gli_llm_speculate_cancel();
+        gli_llm_context.tier = llmtier_Local;
+        strncpy(output, resolved, maxlen);
         output[maxlen - 1] = '\0';
-        return 0;
+        strcpy(gli_llm_context.last_command, output);
+        gli_llm_log("pronouns: \"%s\" -> \"%s\"", local, output);
+        return 1;
     }
-    
-    struct addrinfo hints, *result;
-    memset(&hints, 0, sizeof(hints));
-    hints.ai_family = AF_UNSPEC;
-    hints.ai_socktype = SOCK_STREAM;
-    
-    char port_str[16];
-    snprintf(port_str, sizeof(port_str), "%d", port);
-    
-    if (getaddrinfo(host, port_str, &hints, &result) != 0) {
-        strncpy(output, input, maxlen);
+
+    // Already a command in the game's own words
+    if (gli_llm_vocab_command(local)) {
+        gli_llm_speculate_cancel();
+        gli_llm_context.tier = llmtier_Local;
+        strncpy(output, local, maxlen);
         output[maxlen - 1] = '\0';
-        return 0;
+        strcpy(gli_llm_context.last_command, output);
+        gli_llm_log("vocabulary: \"%s\" passed through", local);
+        return (strcmp(input, output) != 0);
     }
-    
-    int sock = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
-    if (sock < 0) {
-        freeaddrinfo(result);
+
+    if (gli_llm_prefetch_match(local, output, maxlen)) {
+        gli_llm_speculate_cancel();
+        gli_llm_context.tier = llmtier_Local;
+        strcpy(gli_llm_context.last_command, output);
+        return (strcmp(input, output) != 0);
+    }
+
+    if (gli_llm_shared_lookup(input, output, maxlen)) {
+        gli_llm_speculate_cancel();
+        gli_llm_context.tier = llmtier_Local;
+        strcpy(gli_llm_context.last_command, output);
+        return (strcmp(input, output) != 0);
+    }
+
+    // Over budget: an earlier interpretation of the same words, or else
+    // the input as typed (with typos fixed if that makes it all game
+    // words); no request
+    if (gli_llm_budget_exhausted()) {
+        gli_llm_speculate_cancel();
+        if (gli_llm_memory_lookup(input, output, maxlen)) {
+            gli_llm_context.tier = llmtier_Local;
+            strcpy(gli_llm_context.last_command, output);
+        } else {
+            const char *typed = (local != input && gli_llm_vocab_plain(local)) ? local : input;
+            strncpy(output, typed, maxlen);
+            output[maxlen - 1] = '\0';
+        }
+        return (strcmp(input, output) != 0);
+    }
+
+    char cands[GLK_LLM_MAX_CANDIDATES][256];
+    int tier = tiered() ? llmtier_Fast : llmtier_Main;
+    int count = ask_tier(tier, input, cands);
+    if (!count && tier == llmtier_Fast) {
+        tier = llmtier_Main;
+        count = ask_tier(tier, input, cands);
+    }
+
+    if (!count) {
         strncpy(output, input, maxlen);
         output[maxlen - 1] = '\0';
         return 0;
     }
-    
-    if (connect(sock, result->ai_addr, result->ai_addrlen) < 0) {
-        close(sock);
-        freeaddrinfo(result);
-        strncpy(output, input, maxlen);
-        output[maxlen - 1] = '\0';
+
+    // Submit the top candidate; keep the rest for local retries
+    strncpy(output, cands[0], maxlen);
+    output[maxlen - 1] = '\0';
+    for (int ix = 1; ix < count; ix++)
+        strcpy(gli_llm_context.alternates[ix - 1], cands[ix]);
+    gli_llm_context.num_alternates = count - 1;
+    gli_llm_context.tier = tier;
+    strcpy(gli_llm_context.last_command, cands[0]);
+
+    return (strcmp(input, output) != 0);
+#endif
+}
+
+
+/* Add a command to the queue which glk_select() feeds to the game
+   ahead of player input. Returns 0 if the queue is full. */
+int gli_llm_queue_command(const char *command)
+{
+    if (gli_llm_context.queue_count >= GLK_LLM_MAX_QUEUED_COMMANDS)
+        return 0;
+
+    int tail = gli_llm_context.queue_tail;
+    strncpy(gli_llm_context.command_queue[tail], command, sizeof(gli_llm_context.command_queue[tail]) - 1);
+    gli_llm_context.command_queue[tail][sizeof(gli_llm_context.command_queue[tail]) - 1] = '\0';
+    gli_llm_context.queue_tail = (tail + 1) % GLK_LLM_MAX_QUEUED_COMMANDS;
+    gli_llm_context.queue_count++;
+    return 1;
+}
+
+/* If the game's parser rejected the command we sent and the model gave
+   us other candidates for it, queue the next one instead of waiting
+   for the player to retype. Returns 1 if a retry was queued. */
+int gli_llm_retry_candidate(void)
+{
+    if (!gli_llm_context.parser_error)
+        return 0;
+    if (gli_llm_context.next_alternate >= gli_llm_context.num_alternates)
+        return 0;
+
+    const char *command = gli_llm_context.alternates[gli_llm_context.next_alternate++];
+    if (!gli_llm_queue_command(command))
+        return 0;
+    strcpy(gli_llm_context.last_command, command);
+    gli_llm_memory_propose(gli_llm_context.last_user_input, command);
+    return 1;
+}
+
+/* If the game rejected a command from the fast model (or one answered
+   locally) and there are no candidates left to try, ask the main model
+   and queue its answer. Returns 1 if a command was queued. */
+int gli_llm_escalate(void)
+{
+#ifdef WASM_BUILD
+    return 0;
+#else
+    if (!gli_llm_context.parser_error)
+        return 0;
+    if (gli_llm_context.tier != llmtier_Fast && gli_llm_context.tier != llmtier_Local)
+        return 0;
+    if (gli_llm_context.next_alternate < gli_llm_context.num_alternates)
         return 0;
+
+    // Only once per input, whatever the main model comes up with
+    if (gli_llm_context.tier == llmtier_Fast)
+        tier_stats.escalations[llmescalate_Rejected]++;
+    gli_llm_context.tier = llmtier_None;
+
+    char cands[GLK_LLM_MAX_CANDIDATES][256];
+    int count = ask_tier(llmtier_Main, gli_llm_context.last_user_input, cands);
+
+    // No point sending the game what it just refused
+    int first = 0;
+    while (first < count && strcmp(cands[first], gli_llm_context.last_command) == 0)
+        first++;
+    if (first >= count || !gli_llm_queue_command(cands[first]))
+        return 0;
+
+    gli_llm_context.num_alternates = 0;
+    for (int ix = first + 1; ix < count; ix++) {
+        if (strcmp(cands[ix], gli_llm_context.last_command) != 0)
+            strcpy(gli_llm_context.alternates[gli_llm_context.num_alternates++], cands[ix]);
     }
-    
-    freeaddrinfo(result);
-    
-    SSL_CTX *ctx = NULL;
-    SSL *ssl = NULL;
-    
-    if (strcmp(protocol, "https") == 0) {
-        SSL_library_init();
-        SSL_load_error_strings();
-        ctx = SSL_CTX_new(TLS_client_method());
-        if (!ctx) {
-            close(sock);
-            strncpy(output, input, maxlen);
-            output[maxlen - 1] = '\0';
-            return 0;
-        }
-        
-        // Disable certificate verification for compatibility
-        SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, NULL);
-        
-        ssl = SSL_new(ctx);
-        SSL_set_fd(ssl, sock);
-        
-        // Set SNI (Server Name Indication) - required by many servers
-        SSL_set_tlsext_host_name(ssl, host);
-        
-        if (SSL_connect(ssl) <= 0) {
-            SSL_free(ssl);
-            SSL_CTX_free(ctx);
-            close(sock);
-            strncpy(output, input, maxlen);
-            output[maxlen - 1] = '\0';
-            return 0;
+    gli_llm_context.next_alternate = 0;
+    gli_llm_context.tier = llmtier_Main;
+    strcpy(gli_llm_context.last_command, cands[first]);
+
+    gli_llm_add_history(gli_llm_context.last_user_input, cands[first]);
+    gli_llm_memory_propose(gli_llm_context.last_user_input, cands[first]);
+    return 1;
+#endif /* WASM_BUILD */
+}
+
+/* Called when the game asks for a line, before any input is read. The
+   output since the last input tells us how that input went. */
+void gli_llm_prepare_input(void)
+{
+    gli_llm_memory_settle(gli_llm_context.parser_error);
+    gli_llm_vocab_settle(gli_llm_context.parser_error);
+    gli_llm_ref_settle(gli_llm_context.parser_error);
+    gli_llm_disambig_settle();
+
+    // A rejected interpretation is retried with the model's next
+    // candidate, or failing that the main model, before the player is
+    // asked again
+    if (!gli_llm_retry_candidate() && !gli_llm_escalate())
+        gli_llm_check_and_suggest();
+}
+
+/* Contextual help. When the game's output matches a parser-failure
+   pattern, we start a background request for a one-line hint about the
+   input that failed. The hint is cached per (failed input, room) and is
+   only shown if it is ready when the game next asks for a line;
+   otherwise the player never waits for it. A late answer still lands in
+   the cache for the next time the same thing fails. */
+
+#define GLK_LLM_HELP_CACHE 32
+#define GLK_LLM_HELP_JOBS 4
+
+typedef struct {
+    glk_llm_hash_t key;
+    char hint[512];
+    glui32 stamp;
+} help_entry_t;
+
+static help_entry_t help_cache[GLK_LLM_HELP_CACHE];
+static glui32 help_stamp = 0;
+static glk_llm_hash_t help_wanted = 0;
+
+#ifndef WASM_BUILD
+typedef struct {
+    glk_llm_hash_t key;
+    glk_llm_job_t *job;
+} help_job_t;
+
+static help_job_t help_jobs[GLK_LLM_HELP_JOBS];
+#endif /* WASM_BUILD */
+
+static glk_llm_hash_t help_key(const char *user_input)
+{
+    char room[256];
+    gli_llm_current_room(room, sizeof(room));
+    glk_llm_hash_t key = gli_llm_hash_str(room, gli_llm_hash_str(user_input, 0));
+    return key ? key : 1;
+}
+
+static help_entry_t *help_lookup(glk_llm_hash_t key)
+{
+    for (int ix = 0; ix < GLK_LLM_HELP_CACHE; ix++) {
+        if (help_cache[ix].key == key) {
+            help_cache[ix].stamp = ++help_stamp;
+            return &help_cache[ix];
         }
     }
-    
-    char escaped_input[1024];
-    escape_json_string(input, escaped_input, sizeof(escaped_input));
-    
-    char context_json[4096] = "";
-    if (gli_llm_config.context_lines > 0 && gli_llm_context.count > 0) {
-        char temp[256];
-        strcat(context_json, "Recent game output:\\n");
-        
-        int start = gli_llm_context.position - gli_llm_context.count;
-        if (start < 0) start += GLK_LLM_CONTEXT_LINES;
-        
-        for (int i = 0; i < gli_llm_context.count && i < gli_llm_config.context_lines; i++) {
-            int idx = (start + i) % GLK_LLM_CONTEXT_LINES;
-            char escaped_context[512];
-            escape_json_string(gli_llm_context.lines[idx], escaped_context, sizeof(escaped_context));
-            snprintf(temp, sizeof(temp), "%s\\n", escaped_context);
-            strncat(context_json, temp, sizeof(context_json) - strlen(context_json) - 1);
+    return NULL;
+}
+
+static void help_store(glk_llm_hash_t key, const char *hint)
+{
+    help_entry_t *entry = &help_cache[0];
+    for (int ix = 0; ix < GLK_LLM_HELP_CACHE; ix++) {
+        if (help_cache[ix].key == key) {
+            entry = &help_cache[ix];
+            break;
         }
-        strcat(context_json, "\\n");
+        if (help_cache[ix].stamp < entry->stamp)
+            entry = &help_cache[ix];
     }
-    
-    // Build comprehensive scene context with location awareness
-    char scene_info[2048] = "";
-    char current_location[256] = "";
-    
-    if (gli_llm_context.count > 0) {
-        // Try to extract current location name (usually first line or has distinctive formatting)
-        int recent_idx = (gli_llm_context.position - 1 + GLK_LLM_CONTEXT_LINES) % GLK_LLM_CONTEXT_LINES;
-        const char *recent = gli_llm_context.lines[recent_idx];
-        
-        // Look for location name patterns (usually short lines at start of descriptions)
-        if (recent[0] && strlen(recent) < 50 && !strstr(recent, "You") && !strstr(recent, "you")) {
-            strncpy(current_location, recent, sizeof(current_location) - 1);
-        }
-        
-        strncat(scene_info, "CURRENT LOCATION: ", sizeof(scene_info) - strlen(scene_info) - 1);
-        if (current_location[0]) {
-            strncat(scene_info, current_location, sizeof(scene_info) - strlen(scene_info) - 1);
-        } else {
-            strncat(scene_info, "(unknown)", sizeof(scene_info) - strlen(scene_info) - 1);
-        }
-        strncat(scene_info, "\n\nSCENE DESCRIPTION:\n", sizeof(scene_info) - strlen(scene_info) - 1);
-        
-        // Include last 5 lines of context for full scene understanding
-        int lines_to_include = (gli_llm_context.count < 5) ? gli_llm_context.count : 5;
-        int start_idx = gli_llm_context.position - lines_to_include;
-        if (start_idx < 0) start_idx += GLK_LLM_CONTEXT_LINES;
-        
-        for (int i = 0; i < lines_to_include; i++) {
-            int idx = (start_idx + i) % GLK_LLM_CONTEXT_LINES;
-            if (gli_llm_context.lines[idx][0]) {
-                strncat(scene_info, gli_llm_context.lines[idx], sizeof(scene_info) - strlen(scene_info) - 1);
-                strncat(scene_info, "\n", sizeof(scene_info) - strlen(scene_info) - 1);
+
+    entry->key = key;
+    strncpy(entry->hint, hint, sizeof(entry->hint) - 1);
+    entry->hint[sizeof(entry->hint) - 1] = '\0';
+    entry->stamp = ++help_stamp;
+}
+
+#ifndef WASM_BUILD
+/* Move any finished help requests into the cache. */
+static void help_harvest(void)
+{
+    for (int ix = 0; ix < GLK_LLM_HELP_JOBS; ix++) {
+        help_job_t *hj = &help_jobs[ix];
+        if (!hj->job || !gli_llm_job_done(hj->job))
+            continue;
+
+        glk_llm_strbuf_t response;
+        if (gli_llm_job_result(hj->job, &response, NULL)) {
+            char *hint = parse_json_response(response.buf);
+            if (hint) {
+                char *nl = strchr(hint, '\n');
+                if (nl) *nl = '\0';
+                if (hint[0])
+                    help_store(hj->key, hint);
+                free(hint);
             }
+            gli_llm_strbuf_free(&response);
         }
+
+        gli_llm_job_release(hj->job);
+        hj->job = NULL;
     }
-    
-    char system_prompt[8192];
-    snprintf(system_prompt, sizeof(system_prompt),
-        "You are an intelligent text adventure command interpreter for Glulx games. Most Glulx games are built with Inform (I6/I7) and use Inform-standard grammar, but not all. Default to Inform-normalized commands and abbreviations unless the context clearly shows a custom command set.\n\n"
-
-        "CRITICAL RULES:\n"
-        "1. Output ONLY the command(s) - NO quotes, explanations, or extra text\n"
-        "2. Use scene descriptions to resolve spatial references\n"
-        "3. Prefer the shortest valid Inform form\n"
-        "4. You MAY output a short sequence of commands when multiple steps are clearly required; separate commands with '. ' (a period followed by a space). Keep sequences minimal\n"
-        "5. NEVER interpret 'go to X' as 'look' - either find the direction or return empty\n"
-        "6. Use standard Inform abbreviations where unambiguous: n, s, e, w, ne, nw, se, sw, u, d, in, out, l, x thing, i, z, g\n"
-        "7. Punctuation: only use commas in multi-object lists and '. ' to separate multiple commands. No other punctuation, and keep it to one line\n"
-        "8. If the game appears to use non-Inform verbs (from context), adapt to those instead of forcing Inform terms\n\n"
-
-        "LOCATION AWARENESS:\n"
-        "- Check the CURRENT LOCATION field\n"
-        "- If player says 'go to X' and X matches the current location, return EMPTY STRING\n"
-        "- Example: Current='Back Alley', Input='go to the alley' → (empty, don't output 'look')\n\n"
-
-        "SPATIAL REASONING:\n"
-        "- Read the scene description carefully\n"
-        "- Use standard direction abbreviations when moving: n, s, e, w, ne, nw, se, sw, u, d, in, out\n"
-        "- 'go to X' should use the direction mentioned: if 'bedroom is north' then 'go to bedroom' → n\n"
-        "- 'enter X' becomes the direction if X is mentioned with a direction (e.g., 'door south leads outside' + 'go outside' → s)\n"
-        "- Look for phrases like 'X is to the Y' or 'door to Y leads to X'\n"
-        "- If no direction is clear for 'go to X', return EMPTY STRING (don't guess)\n\n"
-
-        "MULTI-OBJECT HANDLING (Inform-aware):\n"
-        "- Inform commonly supports multiple objects for some verbs. When clearly intended and supported, use a single command with a list:\n"
-        "  - Typically multi: take, drop, take all, drop all, take all from <container>, drop all except <object>\n"
-        "  - Typically single: wear, take off, open, close, lock, unlock, examine, read, eat, drink, attack, talk, put/insert\n"
-        "- Join multiple objects with commas or 'and' for supported verbs: e.g., 'take coin, gem, ring' or 'drop coin and gem'\n"
-        "- If the verb likely does not support multiple objects, pick ONE logical/most salient item and output a single-object command\n"
-        "- Do not invent implicit actions; only chain multiple commands with '. ' when the steps are clearly implied or explicitly requested\n\n"
-
-        "SEQUENCING (Multiple commands on one line):\n"
-        "- When a request implies necessary steps, output a short chain using '. ' as the separator: e.g., 'unlock door with key. open door. n'\n"
-        "- Resolve pronouns within the chain by repeating the noun: 'take key. unlock door with key' (avoid 'it')\n"
-        "- Keep the chain minimal and relevant\n\n"
-
-        "NORMALIZED INFORM COMMANDS:\n"
-        "- Movement: 'go north'/'north' → n; 'up' → u; 'down' → d; 'inside'/'enter (no target)' → in; 'outside'/'exit' → out\n"
-        "- Look: 'look around'/'whats here' → l\n"
-        "- Inventory: 'what do I have'/'check inventory' → i\n"
-        "- Examine/Inspect: 'inspect X'/'check X'/'look at X' → x X\n"
-        "- Take: 'pick up X'/'grab X'/'get X' → take X; multi: 'take X and Y' → take X and Y; 'take all' and 'take all from bag' are valid\n"
-        "- Drop: 'drop X and Y' → drop X and Y; 'drop all' and 'drop all except sword' are valid\n"
-        "- Containers/Supporters: 'take X from Y' → take X from Y; 'put/insert X in/into Y' → put X in Y (usually single object)\n"
-        "- Clothing: 'put on X'/'wear X' → wear X; 'take off X'/'remove X (clothing)' → take off X\n"
-        "- Doors/Locks: 'use key on door' → unlock door with key (or open/lock based on context)\n"
-        "- Conversation: 'talk to Y' → talk to Y; 'ask Y about Z' → ask Y about Z; 'tell Y about Z' → tell Y about Z; 'ask Y for X' → ask Y for X\n"
-        "- Time/Repeat: 'wait' → z; 'again'/'repeat that' → g\n\n"
-
-        "CONTEXT:\n"
-        "%s\n"
-        "%s\n\n"
-
-        "EXAMPLES:\n"
-        "Current='Living Room', Scene='bedroom is north' + Input='go to bedroom' → n\n"
-        "Current='Back Alley', Scene='...' + Input='go to the alley' → (empty)\n"
-        "Current='Street', Scene='alley runs north' + Input='go to alley' → n\n"
-        "Scene='door south leads outside' + Input='go outside' → s\n"
-        "Scene='has coat, boots, scarf' + Input='wear winter clothes' → wear coat\n"
-        "Input='put on coat and boots' → wear coat\n"
-        "Input='read the letter' → read letter\n"
-        "Input='whats around' → l\n"
-        "Input='what do i have' → i\n"
-        "Input='take sword and shield' → take sword and shield\n"
-        "Input='take coin, gem, and ring' → take coin, gem, ring\n"
-        "Input='take all from bag' → take all from bag\n"
-        "Input='drop everything except sword' → drop all except sword\n"
-        "Input='open the red door and go north' → open red door. n\n"
-        "Input='unlock the iron door with the brass key, then enter' → unlock iron door with brass key. in\n"
-        "Input='take the key and unlock the blue door with it' → take key. unlock blue door with key\n"
-        "Input='go somewhere unclear' → (empty, don't guess)\n",
-        context_json, scene_info);
+}
 
-    
-    char escaped_system[8192];
-    escape_json_string(system_prompt, escaped_system, sizeof(escaped_system));
-    
-    char json_body[16384];
-    snprintf(json_body, sizeof(json_body),
-        "{"
-        "\"model\":\"%s\","
-        "\"messages\":["
-        "{\"role\":\"system\",\"content\":\"%s\"},"
-        "{\"role\":\"user\",\"content\":\"%s\"}"
-        "],"
-        "\"max_tokens\":50,"
-        "\"temperature\":0.3"
-        "}",
-        gli_llm_config.model[0] ? gli_llm_config.model : "gpt-3.5-turbo",
-        escaped_system,
-        escaped_input
-    );
-    
-    char request[10240];
-    int request_len = snprintf(request, sizeof(request),
-        "POST %s HTTP/1.1\r\n"
-        "Host: %s\r\n"
-        "Authorization: Bearer %s\r\n"
-        "Content-Type: application/json\r\n"
-        "Content-Length: %zu\r\n"
-        "Connection: close\r\n"
-        "\r\n"
-        "%s",
-        path, host, gli_llm_config.api_key, strlen(json_body), json_body
-    );
-    
-    int sent;
-    if (ssl) {
-        sent = SSL_write(ssl, request, request_len);
-    } else {
-        sent = write(sock, request, request_len);
+/* Abandon help requests still in flight. */
+static void help_stop(void)
+{
+    for (int ix = 0; ix < GLK_LLM_HELP_JOBS; ix++) {
+        gli_llm_job_release(help_jobs[ix].job);
+        help_jobs[ix].job = NULL;
     }
-    
-    if (sent < request_len) {
-        if (ssl) {
-            SSL_free(ssl);
-            SSL_CTX_free(ctx);
-        }
-        close(sock);
-        strncpy(output, input, maxlen);
-        output[maxlen - 1] = '\0';
+}
+#else /* WASM_BUILD */
+static void help_stop(void)
+{
+}
+#endif /* WASM_BUILD */
+
+// Generate contextual help using LLM. If a hint for this input and room
+// is already cached, copy it to output and return 1. Otherwise start a
+// background request for one (if there isn't one in flight) and return 0.
+int gli_llm_generate_help(const char *user_input, char *output, size_t max_len)
+{
+    if (!gli_llm_config.enabled || !gli_llm_config.help) {
         return 0;
     }
-    
-    char response[16384];
-    int total_received = 0;
-    int received;
-    
-    while (total_received < sizeof(response) - 1) {
-        if (ssl) {
-            received = SSL_read(ssl, response + total_received, sizeof(response) - total_received - 1);
-        } else {
-            received = read(sock, response + total_received, sizeof(response) - total_received - 1);
-        }
-        
-        if (received <= 0) break;
-        total_received += received;
+    if (!user_input || !user_input[0]) {
+        return 0;
     }
-    
-    response[total_received] = '\0';
-    
-    if (ssl) {
-        SSL_free(ssl);
-        SSL_CTX_free(ctx);
+
+    glk_llm_hash_t key = help_key(user_input);
+    help_entry_t *entry = help_lookup(key);
+    if (entry) {
+        strncpy(output, entry->hint, max_len - 1);
+        output[max_len - 1] = '\0';
+        return 1;
     }
-    close(sock);
-    
-    char *body = strstr(response, "\r\n\r\n");
-    if (!body) {
-        strncpy(output, input, maxlen);
-        output[maxlen - 1] = '\0';
+
+#ifdef WASM_BUILD
+    return 0;
+#else
+    if (!gli_llm_backend_ready()) {
         return 0;
     }
-    body += 4;
-    
-    // Handle chunked transfer encoding
-    if (strstr(response, "Transfer-Encoding: chunked")) {
-        char *chunk_data = strchr(body, '\n');
-        if (chunk_data) body = chunk_data + 1;
+
+    help_job_t *slot = NULL;
+    for (int ix = 0; ix < GLK_LLM_HELP_JOBS; ix++) {
+        if (help_jobs[ix].job && help_jobs[ix].key == key)
+            return 0;
+        if (!help_jobs[ix].job && !slot)
+            slot = &help_jobs[ix];
     }
-    
-    char *interpreted = parse_json_response(body);
-    if (!interpreted) {
-        strncpy(output, input, maxlen);
-        output[maxlen - 1] = '\0';
+    if (!slot) {
+        // Too many requests in flight; don't queue up more
         return 0;
     }
 
-    strncpy(output, interpreted, maxlen);
-    output[maxlen - 1] = '\0';
+    prompt_slots_t ps;
+    gather_slots(&ps, user_input);
 
-    // Remove newlines from output
-    char *nl = strchr(output, '\n');
-    if (nl) *nl = '\0';
-    nl = strchr(output, '\r');
-    if (nl) *nl = '\0';
+    glk_llm_body_t body;
+    gli_llm_body_init(&body);
 
-    int changed = (strcmp(input, output) != 0);
+    BODY_LITERAL(&body, "{\"model\":\"");
+    gli_llm_body_json(&body, gli_llm_config.model[0] ? gli_llm_config.model : "gpt-3.5-turbo");
+    BODY_LITERAL(&body, "\",\"messages\":[{\"role\":\"system\",\"content\":\""
+        "The player typed a command but the game didn't understand. "
+        "Write a SHORT, helpful response (1 sentence) that:\\n"
+        "1. Fits the game's narrative tone\\n"
+        "2. Suggests what they might try instead based on the scene\\n"
+        "3. Is written in second person ('you')\\n\\n"
+        "Scene context:\\n");
+    gli_llm_body_json(&body, ps.scene.buf ? ps.scene.buf : "");
+    BODY_LITERAL(&body, "\"},{\"role\":\"user\",\"content\":\"");
+    gli_llm_body_json(&body, user_input);
+    BODY_LITERAL(&body, "\"}],");
+    gli_llm_body_options(&body);
+    BODY_LITERAL(&body, "\"max_tokens\":60,\"temperature\":0.5}");
 
-    free(interpreted);
+    free_slots(&ps);
 
-    return changed;
-#endif
+    slot->job = gli_llm_job_start(gli_llm_send, gli_llm_config.api_endpoint, gli_llm_config.api_key,
+        gli_llm_config.timeout_ms, &body);
+    slot->key = key;
+    return 0;
+#endif /* WASM_BUILD */
 }
 
-
-// Generate contextual help using LLM
-int gli_llm_generate_help(const char *user_input, char *output, size_t max_len)
+/* Called from gli_llm_add_context() for every captured line of game
+   output. A parser failure kicks off a hint for the last input. */
+static void check_parser_error(const char *text)
 {
-    if (!gli_llm_config.enabled) {
-        return 0;
-    }
-    
-    // Build scene context
-    char scene[2048] = "";
-    if (gli_llm_context.count > 0) {
-        int lines = (gli_llm_context.count < 5) ? gli_llm_context.count : 5;
-        int start = gli_llm_context.position - lines;
-        if (start < 0) start += GLK_LLM_CONTEXT_LINES;
-        
-        for (int i = 0; i < lines; i++) {
-            int idx = (start + i) % GLK_LLM_CONTEXT_LINES;
-            if (gli_llm_context.lines[idx][0]) {
-                strncat(scene, gli_llm_context.lines[idx], sizeof(scene) - strlen(scene) - 1);
-                strncat(scene, " ", sizeof(scene) - strlen(scene) - 1);
-            }
-        }
+    if (!gli_llm_is_parser_error(text))
+        return;
+
+    gli_llm_context.parser_error = 1;
+
+    // No hint while there are still candidates to retry, or the main
+    // model still to ask
+    if (gli_llm_context.next_alternate < gli_llm_context.num_alternates)
+        return;
+    if (gli_llm_context.tier == llmtier_Fast || gli_llm_context.tier == llmtier_Local)
+        return;
+
+    if (gli_llm_config.help && !help_wanted && gli_llm_context.last_user_input[0]) {
+        char hint[512];
+        help_wanted = help_key(gli_llm_context.last_user_input);
+        gli_llm_generate_help(gli_llm_context.last_user_input, hint, sizeof(hint));
     }
-    
-    // Build prompt for helpful message
-    char prompt[4096];
-    snprintf(prompt, sizeof(prompt),
-        "The player tried: '%s' but the game didn't understand. "
-        "Write a SHORT, helpful response (1 sentence) that:\n"
-        "1. Fits the game's narrative tone\n"
-        "2. Suggests what they might try instead based on the scene\n"
-        "3. Is written in second person ('you')\n\n"
-        "Scene context: %s\n\n"
-        "Response:", user_input, scene);
-    
-    // This would call the LLM - for now, return 0 to use default
-    // TODO: Implement actual LLM call for help generation
-    return 0;
 }
 
-// Simple placeholder - not used in simplified version
+// Called when the game asks for a line: show a hint for the last parser
+// failure if one is ready by now, and drop it if not.
 void gli_llm_check_and_suggest(void)
 {
-    // Removed for simplicity - let game show its own errors
+    if (!gli_llm_config.enabled || !gli_llm_config.help) {
+        return;
+    }
+
+#ifndef WASM_BUILD
+    if (help_wanted && gli_llm_config.help_wait_ms > 0) {
+        for (int ix = 0; ix < GLK_LLM_HELP_JOBS; ix++) {
+            if (help_jobs[ix].job && help_jobs[ix].key == help_wanted)
+                gli_llm_job_wait(help_jobs[ix].job, gli_llm_config.help_wait_ms);
+        }
+    }
+    help_harvest();
+#endif /* WASM_BUILD */
+
+    if (help_wanted) {
+        help_entry_t *entry = help_lookup(help_wanted);
+        if (entry) {
+            printf("[Hint: %s]\n", entry->hint);
+        }
+        help_wanted = 0;
+    }
 }
@@ -0,0 +1,277 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef WASM_BUILD
+#include <pthread.h>
+#endif
+#include "glk.h"
+#include "cheapglk.h"
+#include "glk_llm.h"
+
+/* Token and cost accounting. Every response that comes back through
+   gli_llm_send() is read for its usage block (OpenAI's prompt_tokens
+   and completion_tokens, Anthropic's input_tokens and output_tokens,
+   or Ollama's prompt_eval_count and eval_count), and the counts are
+   added to running totals for the session, per model. A response with
+   no usage at all is counted with the local tokenizer instead, and
+   marked as estimated in the summary.
+
+   With price= lines (dollars per million input and output tokens, and
+   optionally cached input tokens, for a model name or prefix), the
+   totals are also priced. With budget_tokens or budget_usd set, the
+   session stops making requests once it has spent that much: the local
+   interpreters (phrasebook, spelling, vocabulary, session memory and
+   the rest) still run, and anything they can't answer goes to the
+   game as typed.
+
+   Requests are made from background threads as well as the main one,
+   so the totals are kept under a lock.
+*/
+
+#define ACCT_MAX_MODELS (8)
+
+typedef struct {
+    char model[64];
+    int requests;
+    int estimated;      /* requests with no usage block */
+    double prompt;
+    double cached;
+    double completion;
+    double cost;
+} acct_model_t;
+
+typedef struct {
+    char model[64];
+    double input;       /* dollars per million tokens */
+    double output;
+    double cached;
+} acct_price_t;
+
+static acct_model_t models[ACCT_MAX_MODELS];
+static int nummodels = 0;
+static acct_price_t prices[GLK_LLM_MAX_PATTERNS];
+static int numprices = -1;     /* not yet parsed */
+
+static struct {
+    double tokens;
+    double cost;
+    int blocked;        /* requests not made */
+    int exhausted;
+    glui32 exhausted_turn;
+    int local_inputs;   /* inputs answered locally because of it */
+} totals;
+
+#ifndef WASM_BUILD
+static pthread_mutex_t acct_lock = PTHREAD_MUTEX_INITIALIZER;
+#define ACCT_LOCK() pthread_mutex_lock(&acct_lock)
+#define ACCT_UNLOCK() pthread_mutex_unlock(&acct_lock)
+#else
+#define ACCT_LOCK()
+#define ACCT_UNLOCK()
+#endif
+
+/* "model input output [cached]" lines from the config. */
+static void parse_prices(void)
+{
+    numprices = 0;
+    for (int ix = 0; ix < gli_llm_config.num_prices; ix++) {
+        acct_price_t *price = &prices[numprices];
+        int count = sscanf(gli_llm_config.prices[ix], "%63s %lf %lf %lf",
+            price->model, &price->input, &price->output, &price->cached);
+        if (count < 3) {
+            gli_llm_log("usage: can't read price \"%s\"", gli_llm_config.prices[ix]);
+            continue;
+        }
+        if (count < 4)
+            price->cached = price->input;
+        numprices++;
+    }
+}
+
+/* The price for model: an exact name, or else the longest matching
+   prefix ("gpt-4o-mini" for "gpt-4o-mini-2024-07-18"). */
+static acct_price_t *find_price(const char *model)
+{
+    acct_price_t *best = NULL;
+    size_t bestlen = 0;
+    for (int ix = 0; ix < numprices; ix++) {
+        size_t len = strlen(prices[ix].model);
+        if (strncmp(prices[ix].model, model, len) == 0 && len > bestlen) {
+            best = &prices[ix];
+            bestlen = len;
+        }
+    }
+    return best;
+}
+
+static acct_model_t *find_model(const char *model)
+{
+    for (int ix = 0; ix < nummodels; ix++) {
+        if (strcmp(models[ix].model, model) == 0)
+            return &models[ix];
+    }
+    // Past the limit, the last row takes everything else
+    if (nummodels == ACCT_MAX_MODELS) {
+        strcpy(models[ACCT_MAX_MODELS - 1].model, "(other)");
+        return &models[ACCT_MAX_MODELS - 1];
+    }
+    acct_model_t *row = &models[nummodels++];
+    memset(row, 0, sizeof(*row));
+    strncpy(row->model, model, sizeof(row->model) - 1);
+    return row;
+}
+
+static int over_budget(void)
+{
+    if (gli_llm_config.budget_tokens > 0 && totals.tokens >= gli_llm_config.budget_tokens)
+        return 1;
+    if (gli_llm_config.budget_usd > 0 && totals.cost >= gli_llm_config.budget_usd)
+        return 1;
+    return 0;
+}
+
+/* Add a response's usage to the totals. body is the request, for an
+   estimate if the server didn't say. */
+void gli_llm_usage_record(const glk_llm_body_t *body, const char *response)
+{
+    double prompt = 0, completion = 0, cached = 0;
+    int estimated = 0;
+
+    if (gli_llm_json_number(response, "prompt_tokens", &prompt)
+        || gli_llm_json_number(response, "input_tokens", &prompt)
+        || gli_llm_json_number(response, "prompt_eval_count", &prompt)) {
+        if (!gli_llm_json_number(response, "completion_tokens", &completion)
+            && !gli_llm_json_number(response, "output_tokens", &completion))
+            gli_llm_json_number(response, "eval_count", &completion);
+        if (!gli_llm_json_number(response, "cached_tokens", &cached))
+            gli_llm_json_number(response, "cache_read_input_tokens", &cached);
+    }
+    else {
+        prompt = gli_llm_body_tokens(body);
+        char *content = gli_llm_json_string(response, "content");
+        if (content) {
+            completion = gli_llm_count_tokens_str(content);
+            free(content);
+        }
+        estimated = 1;
+    }
+
+    char *model = gli_llm_json_string(response, "model");
+
+    ACCT_LOCK();
+    if (numprices < 0)
+        parse_prices();
+    const char *name = (model && model[0]) ? model : gli_llm_config.model;
+    acct_model_t *row = find_model(name[0] ? name : "(unknown)");
+    row->requests++;
+    row->estimated += estimated;
+    row->prompt += prompt;
+    row->cached += cached;
+    row->completion += completion;
+
+    acct_price_t *price = find_price(name);
+    if (price) {
+        double cost = ((prompt - cached) * price->input + cached * price->cached
+            + completion * price->output) / 1000000.0;
+        row->cost += cost;
+        totals.cost += cost;
+    }
+    totals.tokens += prompt + completion;
+    ACCT_UNLOCK();
+
+    free(model);
+}
+
+/* May another request be made? Called from gli_llm_send(). */
+int gli_llm_budget_allows(void)
+{
+    ACCT_LOCK();
+    int allowed = !over_budget();
+    if (!allowed)
+        totals.blocked++;
+    ACCT_UNLOCK();
+    return allowed;
+}
+
+/* Is there budget left? Unlike gli_llm_budget_allows(), asking doesn't
+   count as a blocked request; for requests the player never asked for,
+   such as warm-ups, which are simply skipped. */
+int gli_llm_budget_left(void)
+{
+    ACCT_LOCK();
+    int left = !over_budget();
+    ACCT_UNLOCK();
+    return left;
+}
+
+/* Is the session over budget, so that inputs should be handled
+   locally? The first time it is, say so. */
+int gli_llm_budget_exhausted(void)
+{
+    if (gli_llm_config.budget_tokens <= 0 && gli_llm_config.budget_usd <= 0)
+        return 0;
+
+    ACCT_LOCK();
+    int exhausted = over_budget();
+    int first = (exhausted && !totals.exhausted);
+    if (first) {
+        totals.exhausted = 1;
+        totals.exhausted_turn = gli_llm_context.turn;
+    }
+    if (exhausted)
+        totals.local_inputs++;
+    ACCT_UNLOCK();
+
+    if (first) {
+        gli_llm_log("budget: spent (%.0f tokens, $%.4f) at turn %lu; interpreting locally from now on",
+            totals.tokens, totals.cost, (unsigned long)totals.exhausted_turn);
+    }
+    return exhausted;
+}
+
+/* Called from gli_llm_exit(): the session's usage, to the log, and to
+   stderr if usage_summary is set. */
+void gli_llm_usage_summary(void)
+{
+    ACCT_LOCK();
+    if (!nummodels && !totals.blocked) {
+        ACCT_UNLOCK();
+        return;
+    }
+
+    char lines[ACCT_MAX_MODELS + 2][256];
+    int numlines = 0;
+    int requests = 0;
+    double prompt = 0, cached = 0, completion = 0;
+    for (int ix = 0; ix < nummodels; ix++) {
+        acct_model_t *row = &models[ix];
+        requests += row->requests;
+        prompt += row->prompt;
+        cached += row->cached;
+        completion += row->completion;
+        snprintf(lines[numlines++], sizeof(lines[0]),
+            "usage: %s: %d requests, %.0f prompt tokens (%.0f cached), %.0f completion tokens, $%.4f%s",
+            row->model, row->requests, row->prompt, row->cached, row->completion, row->cost,
+            row->estimated ? " (partly estimated)" : "");
+    }
+    snprintf(lines[numlines++], sizeof(lines[0]),
+        "usage: total: %d requests, %.0f prompt tokens (%.0f cached), %.0f completion tokens, $%.4f",
+        requests, prompt, cached, completion, totals.cost);
+    if (totals.exhausted) {
+        snprintf(lines[numlines++], sizeof(lines[0]),
+            "usage: budget spent at turn %lu; %d inputs not sent to the model, %d other requests not made",
+            (unsigned long)totals.exhausted_turn, totals.local_inputs, totals.blocked);
+    }
+
+    memset(models, 0, sizeof(models));
+    nummodels = 0;
+    memset(&totals, 0, sizeof(totals));
+    numprices = -1;
+    ACCT_UNLOCK();
+
+    for (int ix = 0; ix < numlines; ix++) {
+        gli_llm_log("%s", lines[ix]);
+        if (gli_llm_config.usage_summary)
+            fprintf(stderr, "%s\n", lines[ix]);
+    }
+}
@@ -0,0 +1,365 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef WASM_BUILD
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "glk.h"
+#include "cheapglk.h"
+#include "glk_llm.h"
+
+/* Cassettes: recorded LLM exchanges, for running without a network.
+
+   In record mode, every request that goes through gli_llm_send() is
+   passed on as usual, and the response body is appended to the cassette
+   file, keyed by a hash of the request body. In replay mode, no network
+   is touched at all: requests are answered from the cassette, optionally
+   after sleeping for as long as the original request took.
+
+   A cassette is two files. The data file (the configured name) holds
+   the response bodies back to back. The index (the same name plus
+   ".idx") is a header followed by fixed-size entries, and is mapped
+   into memory for replay, so even a large cassette opens instantly.
+   The index is written in recording order, and sorted by hash when the
+   recording is closed cleanly; replay binary-searches a sorted index
+   and scans an unsorted one.
+
+   If the same request was recorded more than once, replay hands out the
+   recorded responses in order, and then repeats the last one.
+*/
+
+#define CASSETTE_MAGIC "GLKCASS1"
+
+typedef struct {
+    char magic[8];
+    glui32 count;
+    glui32 sorted;
+} cassette_header_t;
+
+typedef struct {
+    glk_llm_hash_t hash;
+    uint64_t offset;
+    glui32 length;
+    glui32 status;
+    glui32 elapsed_ms;
+    glui32 seq;       /* recording order, to keep repeats in order */
+} cassette_entry_t;
+
+#ifndef WASM_BUILD
+
+static int cassette_mode = llmcassette_Off;
+
+/* Record mode */
+static FILE *datafile = NULL;
+static FILE *indexfile = NULL;
+static char *indexname = NULL;
+static cassette_header_t header;
+static pthread_mutex_t record_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Replay mode */
+static const char *datamap = NULL;
+static size_t datamaplen = 0;
+static const cassette_header_t *indexmap = NULL;
+static size_t indexmaplen = 0;
+static const cassette_entry_t *replay_entries = NULL;
+static glui32 replay_count = 0;
+static unsigned char *replay_used = NULL;
+static pthread_mutex_t replay_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static char *index_filename(const char *filename)
+{
+    char *res = malloc(strlen(filename) + 5);
+    if (res)
+        sprintf(res, "%s.idx", filename);
+    return res;
+}
+
+static const void *map_file(const char *filename, size_t *len)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    *len = st.st_size;
+    return map;
+}
+
+static int open_replay(const char *filename)
+{
+    char *idxname = index_filename(filename);
+    if (!idxname)
+        return 0;
+
+    indexmap = map_file(idxname, &indexmaplen);
+    free(idxname);
+    if (!indexmap || indexmaplen < sizeof(cassette_header_t)
+        || memcmp(indexmap->magic, CASSETTE_MAGIC, 8) != 0) {
+        gli_llm_cassette_close();
+        return 0;
+    }
+
+    replay_entries = (const cassette_entry_t *)(indexmap + 1);
+    replay_count = indexmap->count;
+    size_t room = (indexmaplen - sizeof(cassette_header_t)) / sizeof(cassette_entry_t);
+    if (replay_count > room)
+        replay_count = room;
+
+    // An empty recording has no data file; that's fine
+    if (replay_count)
+        datamap = map_file(filename, &datamaplen);
+
+    replay_used = calloc(replay_count ? replay_count : 1, 1);
+    if (!replay_used) {
+        gli_llm_cassette_close();
+        return 0;
+    }
+
+    cassette_mode = llmcassette_Replay;
+    return 1;
+}
+
+static int open_record(const char *filename)
+{
+    indexname = index_filename(filename);
+    datafile = fopen(filename, "wb");
+    indexfile = indexname ? fopen(indexname, "w+b") : NULL;
+    if (!datafile || !indexfile) {
+        gli_llm_cassette_close();
+        return 0;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CASSETTE_MAGIC, 8);
+    fwrite(&header, sizeof(header), 1, indexfile);
+    fflush(indexfile);
+
+    cassette_mode = llmcassette_Record;
+    return 1;
+}
+
+int gli_llm_cassette_open(const char *filename, int mode)
+{
+    gli_llm_cassette_close();
+
+    if (!filename || !filename[0])
+        return 0;
+    if (mode == llmcassette_Replay)
+        return open_replay(filename);
+    if (mode == llmcassette_Record)
+        return open_record(filename);
+    return 0;
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+    const cassette_entry_t *ea = a;
+    const cassette_entry_t *eb = b;
+    if (ea->hash != eb->hash)
+        return (ea->hash < eb->hash) ? -1 : 1;
+    if (ea->seq != eb->seq)
+        return (ea->seq < eb->seq) ? -1 : 1;
+    return 0;
+}
+
+/* Rewrite the index sorted by hash, so replay can binary-search it. */
+static void sort_index(void)
+{
+    fseek(indexfile, 0, SEEK_SET);
+    if (fread(&header, sizeof(header), 1, indexfile) != 1 || !header.count)
+        return;
+
+    cassette_entry_t *list = malloc(header.count * sizeof(cassette_entry_t));
+    if (!list)
+        return;
+
+    fseek(indexfile, sizeof(cassette_header_t), SEEK_SET);
+    if (fread(list, sizeof(cassette_entry_t), header.count, indexfile) == header.count) {
+        qsort(list, header.count, sizeof(cassette_entry_t), compare_entries);
+        header.sorted = 1;
+        fseek(indexfile, 0, SEEK_SET);
+        fwrite(&header, sizeof(header), 1, indexfile);
+        fwrite(list, sizeof(cassette_entry_t), header.count, indexfile);
+    }
+    free(list);
+}
+
+void gli_llm_cassette_close(void)
+{
+    /* Background requests may still be finishing; they check the mode
+       again under these locks, so everything is torn down under them. */
+    pthread_mutex_lock(&record_lock);
+    pthread_mutex_lock(&replay_lock);
+    if (cassette_mode == llmcassette_Record && indexfile)
+        sort_index();
+    cassette_mode = llmcassette_Off;
+
+    if (datafile) fclose(datafile);
+    if (indexfile) fclose(indexfile);
+    datafile = NULL;
+    indexfile = NULL;
+    free(indexname);
+    indexname = NULL;
+
+    if (datamap) munmap((void *)datamap, datamaplen);
+    if (indexmap) munmap((void *)indexmap, indexmaplen);
+    datamap = NULL;
+    indexmap = NULL;
+    replay_entries = NULL;
+    replay_count = 0;
+    free(replay_used);
+    replay_used = NULL;
+    pthread_mutex_unlock(&replay_lock);
+    pthread_mutex_unlock(&record_lock);
+}
+
+/* Find the next unused recording for this hash. Falls back to the last
+   recording of it once they have all been used. */
+static int find_entry(glk_llm_hash_t hash)
+{
+    int first = -1, last = -1;
+
+    if (indexmap->sorted) {
+        glui32 lo = 0, hi = replay_count;
+        while (lo < hi) {
+            glui32 mid = lo + (hi - lo) / 2;
+            if (replay_entries[mid].hash < hash)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        for (glui32 ix = lo; ix < replay_count && replay_entries[ix].hash == hash; ix++) {
+            if (first < 0 && !replay_used[ix])
+                first = ix;
+            last = ix;
+        }
+    } else {
+        for (glui32 ix = 0; ix < replay_count; ix++) {
+            if (replay_entries[ix].hash != hash)
+                continue;
+            if (first < 0 && !replay_used[ix])
+                first = ix;
+            last = ix;
+        }
+    }
+
+    if (first >= 0) {
+        replay_used[first] = 1;
+        return first;
+    }
+    return last;
+}
+
+/* Answer a request from the cassette. Returns 0 if it was never
+   recorded, as a failed request would. */
+int gli_llm_cassette_replay(glk_llm_body_t *body, glk_llm_strbuf_t *response, int *status)
+{
+    if (cassette_mode != llmcassette_Replay)
+        return 0;
+
+    glk_llm_hash_t hash = gli_llm_body_hash(body);
+
+    pthread_mutex_lock(&replay_lock);
+    int ix = (cassette_mode == llmcassette_Replay) ? find_entry(hash) : -1;
+    if (ix < 0) {
+        pthread_mutex_unlock(&replay_lock);
+        return 0;
+    }
+
+    const cassette_entry_t *ent = &replay_entries[ix];
+    glui32 elapsed_ms = ent->elapsed_ms;
+    int ok = (ent->offset + ent->length <= datamaplen && (!ent->length || datamap)
+        && gli_llm_strbuf_append(response, datamap + ent->offset, ent->length));
+    if (ok && status)
+        *status = ent->status;
+    pthread_mutex_unlock(&replay_lock);
+
+    if (ok && gli_llm_config.cassette_timing && elapsed_ms)
+        usleep(elapsed_ms * 1000);
+    return ok;
+}
+
+/* Add a completed exchange to the cassette being recorded. Safe to call
+   from background request threads. */
+void gli_llm_cassette_record(glk_llm_body_t *body, glk_llm_strbuf_t *response, int status, double elapsed_ms)
+{
+    if (cassette_mode != llmcassette_Record)
+        return;
+
+    cassette_entry_t ent;
+    memset(&ent, 0, sizeof(ent));
+    ent.hash = gli_llm_body_hash(body);
+    ent.length = response->len;
+    ent.status = status;
+    ent.elapsed_ms = (elapsed_ms > 0) ? (glui32)elapsed_ms : 0;
+
+    pthread_mutex_lock(&record_lock);
+    if (cassette_mode != llmcassette_Record || !indexfile) {
+        // Closed while this request was in flight
+        pthread_mutex_unlock(&record_lock);
+        return;
+    }
+
+    // Take the count from the file rather than memory, and append at
+    // its real end: forked processes (glkllmeval runs each item in one)
+    // may share the recording
+    fseek(indexfile, 0, SEEK_SET);
+    if (fread(&header, sizeof(header), 1, indexfile) != 1) {
+        pthread_mutex_unlock(&record_lock);
+        return;
+    }
+    fseek(datafile, 0, SEEK_END);
+    ent.offset = ftell(datafile);
+    ent.seq = header.count;
+    if (ent.length)
+        fwrite(response->buf, 1, ent.length, datafile);
+    fflush(datafile);
+
+    // Append the entry and bump the count, so a recording cut short
+    // is still usable (just unsorted)
+    fseek(indexfile, 0, SEEK_END);
+    fwrite(&ent, sizeof(ent), 1, indexfile);
+    header.count++;
+    header.sorted = 0;
+    fseek(indexfile, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, indexfile);
+    fflush(indexfile);
+
+    pthread_mutex_unlock(&record_lock);
+}
+
+#else /* WASM_BUILD */
+
+int gli_llm_cassette_open(const char *filename, int mode)
+{
+    return 0;
+}
+
+void gli_llm_cassette_close(void)
+{
+}
+
+int gli_llm_cassette_replay(glk_llm_body_t *body, glk_llm_strbuf_t *response, int *status)
+{
+    return 0;
+}
+
+void gli_llm_cassette_record(glk_llm_body_t *body, glk_llm_strbuf_t *response, int status, double elapsed_ms)
+{
+}
+
+#endif /* WASM_BUILD */
@@ -0,0 +1,296 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "glk.h"
+#include "cheapglk.h"
+#include "glk_llm.h"
+
+/* Conversation mode, for model servers that keep a KV cache of the
+   prompt prefix between requests (llama.cpp, vLLM with prefix caching,
+   and the like).
+
+   Normally every request carries a freshly rendered system prompt with
+   the recent game output in it, so the prefix changes every turn and
+   the server has to process the whole prompt again. In conversation
+   mode the system prompt is rendered once, when the conversation
+   starts, and each turn appends only what is new: a user message with
+   the game output since the last request and the player's input, and
+   then the model's command as an assistant message. Everything before
+   the new user message is byte-for-byte what was sent last time.
+
+   When the conversation grows past conversation_budget tokens (as
+   counted by cgllmtok.c), the oldest turns are dropped in one go, down to three
+   quarters of the budget, so the prefix only changes every few turns.
+   The dropped turns are kept as a one-line-per-turn summary message
+   right after the system prompt.
+
+   If the server reports how much of the prompt it found in its cache,
+   and that is much less than the prefix we sent last time, the server
+   has lost our state (evicted, restarted, another client). Keeping a
+   long conversation then buys nothing, so it is restarted: the next
+   request is a full resend with the current context rendered into a
+   new system prompt. The same happens if the server rejects the
+   request outright (an overlong prompt, say).
+
+   All text is stored already JSON-escaped, so it goes into the request
+   body as static pieces with no copying.
+*/
+
+#define CONV_SUMMARY_LINES 16
+
+typedef struct {
+    char *user;         /* escaped user message */
+    char *assistant;    /* escaped command */
+    char input[128];    /* raw, for the summary */
+    char command[128];
+    size_t tokens;
+} conv_turn_t;
+
+static int started = 0;
+static glk_llm_strbuf_t system_text;
+static conv_turn_t *turns = NULL;
+static int numturns = 0;
+static int maxturns = 0;
+static char summary_lines[CONV_SUMMARY_LINES][260];
+static int numsummary = 0;
+static glk_llm_strbuf_t summary_text;
+static glui32 since_turn = 0;
+
+/* The message being sent this turn, until it is committed. */
+static glk_llm_strbuf_t pending;
+static char pending_input[128];
+
+/* Estimated tokens in the reusable prefix of the last request
+   (everything but the new user message). */
+static size_t prefix_tokens = 0;
+
+static size_t estimate_tokens(const char *text, size_t len)
+{
+    return text ? gli_llm_count_tokens(text, len) : 0;
+}
+
+int gli_llm_conversation_started(void)
+{
+    return started;
+}
+
+void gli_llm_conversation_reset(void)
+{
+    for (int ix = 0; ix < numturns; ix++) {
+        free(turns[ix].user);
+        free(turns[ix].assistant);
+    }
+    free(turns);
+    turns = NULL;
+    numturns = 0;
+    maxturns = 0;
+    numsummary = 0;
+    gli_llm_strbuf_free(&system_text);
+    gli_llm_strbuf_free(&summary_text);
+    gli_llm_strbuf_free(&pending);
+    started = 0;
+    prefix_tokens = 0;
+}
+
+/* Begin a conversation with the given (escaped) system prompt. */
+void gli_llm_conversation_start(const glk_llm_body_t *system)
+{
+    gli_llm_conversation_reset();
+
+    char *text = gli_llm_body_flatten(system);
+    if (!text)
+        return;
+    gli_llm_strbuf_init(&system_text);
+    gli_llm_strbuf_append_str(&system_text, text);
+    free(text);
+
+    // The system prompt already has the output so far
+    since_turn = gli_llm_context.turn;
+    started = 1;
+}
+
+static void rebuild_summary(void)
+{
+    gli_llm_strbuf_free(&summary_text);
+    gli_llm_strbuf_init(&summary_text);
+    if (!numsummary)
+        return;
+
+    gli_llm_strbuf_append_str(&summary_text, "Earlier in this session (input -> command):\n");
+    for (int ix = 0; ix < numsummary; ix++) {
+        gli_llm_strbuf_append_str(&summary_text, summary_lines[ix]);
+        gli_llm_strbuf_append_str(&summary_text, "\n");
+    }
+
+    // Escape in place, by way of a second buffer
+    glk_llm_strbuf_t escaped;
+    gli_llm_strbuf_init(&escaped);
+    gli_llm_strbuf_append_json(&escaped, summary_text.buf);
+    gli_llm_strbuf_free(&summary_text);
+    summary_text = escaped;
+}
+
+static void summarize_turn(const conv_turn_t *turn)
+{
+    if (numsummary == CONV_SUMMARY_LINES) {
+        memmove(summary_lines[0], summary_lines[1], sizeof(summary_lines[0]) * (CONV_SUMMARY_LINES - 1));
+        numsummary--;
+    }
+    snprintf(summary_lines[numsummary++], sizeof(summary_lines[0]), "%s -> %s",
+        turn->input, turn->command);
+}
+
+static size_t conversation_tokens(void)
+{
+    size_t total = estimate_tokens(system_text.buf, system_text.len)
+        + estimate_tokens(summary_text.buf, summary_text.len);
+    for (int ix = 0; ix < numturns; ix++)
+        total += turns[ix].tokens;
+    return total;
+}
+
+/* Drop the oldest turns if over budget. */
+static void trim_to_budget(void)
+{
+    size_t budget = gli_llm_config.conversation_budget;
+    if (!budget || conversation_tokens() <= budget)
+        return;
+
+    int drop = 0;
+    size_t total = conversation_tokens();
+    while (drop < numturns && total > budget * 3 / 4) {
+        total -= turns[drop].tokens;
+        summarize_turn(&turns[drop]);
+        free(turns[drop].user);
+        free(turns[drop].assistant);
+        drop++;
+    }
+    memmove(turns, turns + drop, (numturns - drop) * sizeof(conv_turn_t));
+    numturns -= drop;
+    rebuild_summary();
+
+    gli_llm_log("conversation: dropped %d turns, ~%lu tokens left", drop, (unsigned long)conversation_tokens());
+}
+
+/* Append the messages array contents (without the brackets) for this
+   turn's request: the system prompt, the summary, the kept turns, and
+   a new user message with the output since the last request and the
+   player's input. */
+void gli_llm_conversation_messages(glk_llm_body_t *body, const char *input)
+{
+    // The new user message
+    glk_llm_strbuf_t raw;
+    gli_llm_strbuf_init(&raw);
+    int first = 1;
+    for (int n = gli_llm_context.count; n > 0; n--) {
+        int idx = (gli_llm_context.position - n + 2 * GLK_LLM_CONTEXT_LINES) % GLK_LLM_CONTEXT_LINES;
+        if ((int)(gli_llm_context.line_turns[idx] - since_turn) < 0)
+            continue;
+        if (first)
+            gli_llm_strbuf_append_str(&raw, "Game output:\n");
+        first = 0;
+        gli_llm_strbuf_append_str(&raw, gli_llm_context.lines[idx]);
+        gli_llm_strbuf_append_str(&raw, "\n");
+    }
+    if (!first)
+        gli_llm_strbuf_append_str(&raw, "\nPlayer input: ");
+    gli_llm_strbuf_append_str(&raw, input);
+
+    gli_llm_strbuf_free(&pending);
+    gli_llm_strbuf_init(&pending);
+    gli_llm_strbuf_append_json(&pending, raw.buf);
+    gli_llm_strbuf_free(&raw);
+    strncpy(pending_input, input, sizeof(pending_input) - 1);
+    pending_input[sizeof(pending_input) - 1] = '\0';
+
+    BODY_LITERAL(body, "{\"role\":\"system\",\"content\":\"");
+    gli_llm_body_static(body, system_text.buf, system_text.len);
+    BODY_LITERAL(body, "\"}");
+    if (summary_text.len) {
+        BODY_LITERAL(body, ",{\"role\":\"user\",\"content\":\"");
+        gli_llm_body_static(body, summary_text.buf, summary_text.len);
+        BODY_LITERAL(body, "\"},{\"role\":\"assistant\",\"content\":\"OK\"}");
+    }
+    for (int ix = 0; ix < numturns; ix++) {
+        BODY_LITERAL(body, ",{\"role\":\"user\",\"content\":\"");
+        gli_llm_body_static(body, turns[ix].user, strlen(turns[ix].user));
+        BODY_LITERAL(body, "\"},{\"role\":\"assistant\",\"content\":\"");
+        gli_llm_body_static(body, turns[ix].assistant, strlen(turns[ix].assistant));
+        BODY_LITERAL(body, "\"}");
+    }
+    BODY_LITERAL(body, ",{\"role\":\"user\",\"content\":\"");
+    gli_llm_body_static(body, pending.buf, pending.len);
+    BODY_LITERAL(body, "\"}");
+
+    prefix_tokens = conversation_tokens();
+}
+
+/* Look at a successful response. If the server says it had to process
+   far more of the prompt than was new, it no longer has our prefix
+   cached; restart the conversation. Returns 1 if it did. */
+int gli_llm_conversation_response(const char *response)
+{
+    double cached;
+    if (!started || !numturns)
+        return 0;
+
+    // OpenAI-style usage.prompt_tokens_details, or llama.cpp timings
+    if (!gli_llm_json_number(response, "cached_tokens", &cached)
+        && !gli_llm_json_number(response, "cache_n", &cached))
+        return 0;
+
+    if (cached >= prefix_tokens / 2)
+        return 0;
+
+    gli_llm_log("conversation: cache miss (%.0f of ~%lu prefix tokens cached), restarting",
+        cached, (unsigned long)prefix_tokens);
+    gli_llm_conversation_reset();
+    return 1;
+}
+
+/* The server rejected the request (HTTP error). If there is a
+   conversation to blame, drop it and return 1, so the caller can resend
+   with the full context. */
+int gli_llm_conversation_refused(void)
+{
+    if (!started || !numturns)
+        return 0;
+
+    gli_llm_log("conversation: request refused after %d turns, restarting", numturns);
+    gli_llm_conversation_reset();
+    return 1;
+}
+
+/* The request went through and the model's answer is being used: make
+   this turn part of the conversation. */
+void gli_llm_conversation_commit(const char *command)
+{
+    if (!started || !pending.buf)
+        return;
+
+    if (numturns == maxturns) {
+        int newmax = maxturns ? maxturns * 2 : 16;
+        conv_turn_t *list = realloc(turns, newmax * sizeof(conv_turn_t));
+        if (!list)
+            return;
+        turns = list;
+        maxturns = newmax;
+    }
+
+    glk_llm_strbuf_t escaped;
+    gli_llm_strbuf_init(&escaped);
+    gli_llm_strbuf_append_json(&escaped, command);
+
+    conv_turn_t *turn = &turns[numturns++];
+    turn->user = pending.buf;
+    turn->assistant = escaped.buf ? escaped.buf : strdup("");
+    strcpy(turn->input, pending_input);
+    strncpy(turn->command, command, sizeof(turn->command) - 1);
+    turn->command[sizeof(turn->command) - 1] = '\0';
+    turn->tokens = estimate_tokens(pending.buf, pending.len)
+        + estimate_tokens(escaped.buf, escaped.len) + 8;
+    gli_llm_strbuf_init(&pending);
+
+    since_turn = gli_llm_context.turn;
+    trim_to_budget();
+}
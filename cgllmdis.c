@@ -0,0 +1,362 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include "glk.h"
+#include "cheapglk.h"
+#include "glk_llm.h"
+
+/* Answers to "Which do you mean, the red key or the brass key?". The
+   player's reply ("brass", "the second one", "the brasss key") is not a
+   command, and the full interpretation prompt does badly with it. With
+   disambiguation=1 we pick the choices out of the game's question and
+   match the reply against them here:
+
+   - an ordinal ("first", "2nd", "last", "the latter");
+   - words that are all in exactly one choice ("brass", "red one");
+   - the same, allowing a typo or two in each word.
+
+   The reply is then sent as the choice itself. Only when none of these
+   work is a model asked, with a small prompt of its own that names the
+   choices and nothing else ("the shiny one"). A reply that starts with
+   a verb, and matches no choice, is a new command and takes the normal
+   path.
+*/
+
+#define DIS_MAX_CHOICES 8
+
+static char question[256];
+static char choices[DIS_MAX_CHOICES][64];
+static int numchoices = 0;
+
+static struct {
+    int questions;
+    int local;
+    int model;
+} dis_stats;
+
+static const char *ordinals[] = {
+    "first", "second", "third", "fourth", "fifth", "sixth", "seventh", "eighth", NULL
+};
+
+/* Words in a reply that say nothing about which. */
+static const char *filler[] = {
+    "the", "a", "an", "one", "ones", "i", "mean", "meant", "please", "that",
+    "this", "it", "is", "oh", "um", NULL
+};
+
+static int in_list(const char **list, const char *word)
+{
+    for (int ix = 0; list[ix]; ix++) {
+        if (strcmp(list[ix], word) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+/* Split text into lower-case words. A comma becomes a word of its own. */
+static int split_words(const char *text, char words[][24], int max, int commas)
+{
+    int count = 0;
+    const char *p = text;
+
+    while (*p && count < max) {
+        if (*p == ',' && commas) {
+            strcpy(words[count++], ",");
+            p++;
+            continue;
+        }
+        if (!isalnum((unsigned char)*p)) {
+            p++;
+            continue;
+        }
+        size_t len = 0;
+        while (*p && (isalnum((unsigned char)*p) || *p == '-')) {
+            if (len < sizeof(words[0]) - 1)
+                words[count][len++] = tolower((unsigned char)*p);
+            p++;
+        }
+        words[count][len] = '\0';
+        count++;
+    }
+    return count;
+}
+
+/* "Which do you mean, the red key, the brass key or the iron key?" */
+static void parse_question(const char *text)
+{
+    const char *mean = gli_llm_find_nocase(text, "do you mean");
+    if (!mean)
+        return;
+    mean += strlen("do you mean");
+    const char *end = strchr(mean, '?');
+    char list[256];
+    size_t len = end ? (size_t)(end - mean) : strlen(mean);
+    if (len >= sizeof(list))
+        return;
+    memcpy(list, mean, len);
+    list[len] = '\0';
+
+    char words[48][24];
+    int count = split_words(list, words, 48, TRUE);
+    char choice[64] = "";
+    numchoices = 0;
+    for (int ix = 0; ix <= count; ix++) {
+        int boundary = (ix == count || words[ix][0] == ',' || strcmp(words[ix], "or") == 0);
+        if (!boundary) {
+            if (!choice[0] && (strcmp(words[ix], "the") == 0 || strcmp(words[ix], "a") == 0
+                || strcmp(words[ix], "an") == 0))
+                continue;
+            size_t used = strlen(choice);
+            snprintf(choice + used, sizeof(choice) - used, "%s%s", used ? " " : "", words[ix]);
+            continue;
+        }
+        if (choice[0] && numchoices < DIS_MAX_CHOICES)
+            strcpy(choices[numchoices++], choice);
+        choice[0] = '\0';
+    }
+
+    if (numchoices < 2) {
+        numchoices = 0;
+        return;
+    }
+    snprintf(question, sizeof(question), "%s", text);
+    dis_stats.questions++;
+}
+
+/* Called when the game asks for a line: was the last thing it said a
+   "which do you mean" question? */
+void gli_llm_disambig_settle(void)
+{
+    numchoices = 0;
+    if (!gli_llm_config.disambiguation)
+        return;
+
+    glui32 last = gli_llm_context.turn - 1;
+    for (int n = gli_llm_context.count; n > 0; n--) {
+        int idx = (gli_llm_context.position - n + 2 * GLK_LLM_CONTEXT_LINES) % GLK_LLM_CONTEXT_LINES;
+        if (gli_llm_context.line_turns[idx] == last)
+            parse_question(gli_llm_context.lines[idx]);
+    }
+}
+
+/* Levenshtein distance, giving up past limit. Words are short. */
+static int word_distance(const char *a, const char *b, int limit)
+{
+    int la = strlen(a), lb = strlen(b);
+    if (la - lb > limit || lb - la > limit)
+        return limit + 1;
+
+    int row[24];
+    for (int j = 0; j <= lb; j++)
+        row[j] = j;
+    for (int i = 1; i <= la; i++) {
+        int diag = row[0];
+        row[0] = i;
+        for (int j = 1; j <= lb; j++) {
+            int up = row[j];
+            int cost = diag + (a[i - 1] != b[j - 1]);
+            if (up + 1 < cost)
+                cost = up + 1;
+            if (row[j - 1] + 1 < cost)
+                cost = row[j - 1] + 1;
+            row[j] = cost;
+            diag = up;
+        }
+    }
+    return row[lb];
+}
+
+/* Is word in the choice: the same, a prefix of three letters or more
+   ("brass" for "brassy"), or with fuzzy set, within a typo or two? */
+static int word_in_choice(const char *word, const char *choice, int fuzzy)
+{
+    char words[8][24];
+    int count = split_words(choice, words, 8, FALSE);
+    size_t len = strlen(word);
+
+    for (int ix = 0; ix < count; ix++) {
+        if (strcmp(words[ix], word) == 0)
+            return 1;
+        if (len >= 3 && strncmp(words[ix], word, len) == 0)
+            return 1;
+        if (fuzzy && len >= 4) {
+            int limit = (len >= 7) ? 2 : 1;
+            if (word_distance(word, words[ix], limit) <= limit)
+                return 1;
+        }
+    }
+    return 0;
+}
+
+/* The one choice that has every word of the reply, or -1. */
+static int match_words(char words[][24], int count, int fuzzy)
+{
+    int found = -1;
+    for (int cx = 0; cx < numchoices; cx++) {
+        int all = 1;
+        for (int ix = 0; ix < count && all; ix++)
+            all = word_in_choice(words[ix], choices[cx], fuzzy);
+        if (!all)
+            continue;
+        if (found >= 0)
+            return -1;
+        found = cx;
+    }
+    return found;
+}
+
+static int match_ordinal(const char *word)
+{
+    for (int ix = 0; ordinals[ix]; ix++) {
+        char nth[8];
+        snprintf(nth, sizeof(nth), "%d", ix + 1);
+        if (strcmp(word, ordinals[ix]) == 0 || strcmp(word, nth) == 0)
+            return (ix < numchoices) ? ix : -1;
+        // 1st, 2nd, 3rd, 4th...
+        size_t nlen = strlen(nth);
+        if (strncmp(word, nth, nlen) == 0 && strlen(word) == nlen + 2 && isalpha((unsigned char)word[nlen]))
+            return (ix < numchoices) ? ix : -1;
+    }
+    if (strcmp(word, "last") == 0 || strcmp(word, "latter") == 0)
+        return numchoices - 1;
+    if (strcmp(word, "former") == 0)
+        return 0;
+    return -1;
+}
+
+#ifndef WASM_BUILD
+
+/* Ask which choice the reply means, offering only the choices (and
+   NONE). Returns the index, or -1. */
+static int ask_choice(const char *reply)
+{
+    if (!gli_llm_config.enabled || !gli_llm_backend_ready())
+        return -1;
+
+    // The fast tier, if there is one, can pick from a list
+    const char *endpoint = gli_llm_config.api_endpoint;
+    const char *api_key = gli_llm_config.api_key;
+    const char *model = gli_llm_config.model;
+    int timeout_ms = gli_llm_config.timeout_ms;
+    if (gli_llm_config.fast_endpoint[0])
+        endpoint = gli_llm_config.fast_endpoint;
+    if (gli_llm_config.fast_api_key[0])
+        api_key = gli_llm_config.fast_api_key;
+    if (gli_llm_config.fast_model[0]) {
+        model = gli_llm_config.fast_model;
+        timeout_ms = gli_llm_config.fast_timeout_ms;
+    }
+
+    glk_llm_body_t body;
+    gli_llm_body_init(&body);
+    BODY_LITERAL(&body, "{\"model\":\"");
+    gli_llm_body_json(&body, model[0] ? model : "gpt-3.5-turbo");
+    BODY_LITERAL(&body, "\",\"messages\":[{\"role\":\"system\",\"content\":\""
+        "A text adventure asked the player which thing they meant. Given the "
+        "question and the player's answer, reply with the choice they mean, "
+        "or NONE if the answer picks none of them.\"},"
+        "{\"role\":\"user\",\"content\":\"Question: ");
+    gli_llm_body_json(&body, question);
+    BODY_LITERAL(&body, "\\nAnswer: ");
+    gli_llm_body_json(&body, reply);
+    BODY_LITERAL(&body, "\"}],");
+    glk_llm_strbuf_t schema;
+    gli_llm_strbuf_init(&schema);
+    gli_llm_strbuf_append_str(&schema, "{\"type\":\"string\",\"enum\":[");
+    for (int ix = 0; ix < numchoices; ix++) {
+        gli_llm_strbuf_append_str(&schema, "\"");
+        gli_llm_strbuf_append_json(&schema, choices[ix]);
+        gli_llm_strbuf_append_str(&schema, "\",");
+    }
+    gli_llm_strbuf_append_str(&schema, "\"NONE\"]}");
+    gli_llm_body_schema(&body, "choice", schema.buf ? schema.buf : "{\"type\":\"string\"}");
+    gli_llm_strbuf_free(&schema);
+    gli_llm_body_options(&body);
+    BODY_LITERAL(&body, "\"max_tokens\":20,\"temperature\":0}");
+
+    glk_llm_strbuf_t response;
+    gli_llm_strbuf_init(&response);
+    double start = gli_llm_now_ms();
+    int ok = gli_llm_send(endpoint, api_key, timeout_ms, &body, &response, NULL);
+    gli_llm_body_free(&body);
+
+    int found = -1;
+    char *content = ok ? gli_llm_json_string(response.buf, "content") : NULL;
+    gli_llm_strbuf_free(&response);
+    if (content) {
+        // Strict output is {"choice":...}; take a bare answer too
+        char *choice = gli_llm_json_string(content, "choice");
+        const char *answer = choice ? choice : content;
+        for (int ix = 0; ix < numchoices; ix++) {
+            if (strcasecmp(answer, choices[ix]) == 0)
+                found = ix;
+        }
+        free(choice);
+        free(content);
+    }
+    gli_llm_log("disambiguation: model=%s ms=%.0f result=%s", model[0] ? model : "gpt-3.5-turbo",
+        gli_llm_now_ms() - start, (found >= 0) ? choices[found] : "none");
+    return found;
+}
+
+#else /* WASM_BUILD */
+
+static int ask_choice(const char *reply)
+{
+    return -1;
+}
+
+#endif /* WASM_BUILD */
+
+/* If the game has just asked which thing was meant, and input picks one
+   of the choices, copy the choice to output and return 1. */
+int gli_llm_disambig_answer(const char *input, char *output, size_t len)
+{
+    if (!numchoices)
+        return 0;
+
+    char raw[16][24], words[16][24];
+    int rawcount = split_words(input, raw, 16, FALSE);
+    int count = 0;
+    for (int ix = 0; ix < rawcount; ix++) {
+        if (!in_list(filler, raw[ix]))
+            strcpy(words[count++], raw[ix]);
+    }
+    if (!count)
+        return 0;
+
+    int found = -1;
+    const char *how = NULL;
+    if (count == 1 && (found = match_ordinal(words[0])) >= 0)
+        how = "ordinal";
+    else if ((found = match_words(words, count, FALSE)) >= 0)
+        how = "words";
+    else if ((found = match_words(words, count, TRUE)) >= 0)
+        how = "fuzzy";
+    else if (!gli_llm_vocab_is_verb(raw[0]) && rawcount <= 6 && (found = ask_choice(input)) >= 0)
+        how = "model";
+
+    if (found < 0)
+        return 0;
+    if (strcmp(how, "model") == 0)
+        dis_stats.model++;
+    else
+        dis_stats.local++;
+    gli_llm_log("disambiguation: \"%s\" -> \"%s\" (%s)", input, choices[found], how);
+
+    strncpy(output, choices[found], len - 1);
+    output[len - 1] = '\0';
+    numchoices = 0;
+    return 1;
+}
+
+/* Called from gli_llm_exit(). */
+void gli_llm_disambig_stats(void)
+{
+    if (dis_stats.questions) {
+        gli_llm_log("disambiguation: questions=%d local=%d model=%d",
+            dis_stats.questions, dis_stats.local, dis_stats.model);
+    }
+}
@@ -0,0 +1,214 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef WASM_BUILD
+#include <signal.h>
+#include <poll.h>
+#include <unistd.h>
+#include <termios.h>
+#endif
+#include "glk.h"
+#include "cheapglk.h"
+#include "glk_llm.h"
+
+/* A small line editor for terminal sessions. fgets() hands over a line
+   only when return is pressed, so interpretation could not start any
+   earlier. With line_editor=1, and stdin a terminal, lines are read a
+   key at a time in raw mode instead, and whenever the player stops
+   typing for speculate_ms the line so far is sent off for
+   interpretation (gli_llm_speculate()). If the player then presses
+   return without changing it, the answer is often already there.
+
+   Editing is deliberately minimal: typing at the end of the line,
+   backspace, ^U (erase line), ^W (erase word), ^D on an empty line for
+   end of input. ^C and ^Z restore the terminal before they act. Other
+   control keys and escape sequences (arrow keys) are ignored.
+
+   When stdin is not a terminal, or the editor is off, this is plain
+   fgets().
+*/
+
+#ifndef WASM_BUILD
+
+static struct termios saved_termios;
+static int termios_saved = 0;
+static int raw_active = 0;
+
+static void raw_off(void)
+{
+    if (raw_active) {
+        tcsetattr(STDIN_FILENO, TCSAFLUSH, &saved_termios);
+        raw_active = 0;
+    }
+}
+
+static int raw_on(void)
+{
+    if (!termios_saved) {
+        if (tcgetattr(STDIN_FILENO, &saved_termios) < 0)
+            return 0;
+        termios_saved = 1;
+        atexit(raw_off);
+    }
+
+    struct termios raw = saved_termios;
+    raw.c_lflag &= ~(ICANON | ECHO | ISIG | IEXTEN);
+    raw.c_iflag &= ~(IXON | ICRNL);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) < 0)
+        return 0;
+    raw_active = 1;
+    return 1;
+}
+
+static void echo(const char *text, size_t len)
+{
+    fwrite(text, 1, len, stdout);
+    fflush(stdout);
+}
+
+/* Remove the last character (all bytes of it, for UTF-8) from the
+   line, and from the screen. */
+static int erase_char(char *buf, int pos)
+{
+    if (pos == 0)
+        return 0;
+    pos--;
+    while (pos > 0 && (buf[pos] & 0xC0) == 0x80)
+        pos--;
+    echo("\b \b", 3);
+    return pos;
+}
+
+/* Send the line off for interpretation if it has changed since the
+   last time. */
+static void send_ahead(const char *buf, int pos, char *last, int lastlen)
+{
+    char text[256];
+    while (pos > 0 && buf[pos - 1] == ' ')
+        pos--;
+    memcpy(text, buf, pos);
+    text[pos] = '\0';
+
+    // Input for the debugger or in [brackets] is never interpreted
+    if (!text[0] || text[0] == '/' || text[0] == '[' || strcmp(text, last) == 0)
+        return;
+    strncpy(last, text, lastlen - 1);
+    last[lastlen - 1] = '\0';
+    gli_llm_speculate(text);
+}
+
+/* Read a line, with the trailing newline, like fgets(). Returns NULL at
+   end of input. If speculate is false the line is never sent ahead (the
+   game is asking for a name, say). */
+char *gli_llm_read_line(char *buf, int len, int speculate)
+{
+    if (!gli_llm_config.enabled || !gli_llm_config.line_editor
+        || !isatty(STDIN_FILENO) || !isatty(STDOUT_FILENO))
+        return fgets(buf, len, stdin);
+
+    fflush(stdout);
+    if (!raw_on())
+        return fgets(buf, len, stdin);
+
+    char last[256] = "";
+    int pos = 0;
+    int idle_ms = speculate ? gli_llm_config.speculate_ms : 0;
+    int result = 1;
+
+    while (1) {
+        struct pollfd pfd;
+        pfd.fd = STDIN_FILENO;
+        pfd.events = POLLIN;
+        int ready = poll(&pfd, 1, (idle_ms > 0 && pos > 0) ? idle_ms : -1);
+        if (ready == 0) {
+            send_ahead(buf, pos, last, sizeof(last));
+            // Don't time out again until something changes
+            ready = poll(&pfd, 1, -1);
+        }
+        if (ready < 0)
+            continue;
+
+        unsigned char ch;
+        ssize_t got = read(STDIN_FILENO, &ch, 1);
+        if (got <= 0) {
+            result = 0;
+            break;
+        }
+
+        if (ch == '\r' || ch == '\n') {
+            echo("\n", 1);
+            break;
+        }
+        else if (ch == 0x7F || ch == '\b') {
+            pos = erase_char(buf, pos);
+        }
+        else if (ch == 0x15) {
+            // ^U
+            while (pos > 0)
+                pos = erase_char(buf, pos);
+        }
+        else if (ch == 0x17) {
+            // ^W
+            while (pos > 0 && buf[pos - 1] == ' ')
+                pos = erase_char(buf, pos);
+            while (pos > 0 && buf[pos - 1] != ' ')
+                pos = erase_char(buf, pos);
+        }
+        else if (ch == 0x04) {
+            // ^D
+            if (pos == 0) {
+                result = 0;
+                break;
+            }
+        }
+        else if (ch == 0x03 || ch == 0x1A) {
+            // ^C, ^Z: let the signal act on a sane terminal
+            raw_off();
+            raise(ch == 0x03 ? SIGINT : SIGTSTP);
+            raw_on();
+            echo(buf, pos);
+        }
+        else if (ch == 0x1B) {
+            // Escape sequence: ESC [ ... final, or ESC O x
+            unsigned char seq;
+            if (poll(&pfd, 1, 50) <= 0 || read(STDIN_FILENO, &seq, 1) <= 0)
+                continue;
+            if (seq == '[' || seq == 'O') {
+                do {
+                    if (poll(&pfd, 1, 50) <= 0 || read(STDIN_FILENO, &seq, 1) <= 0)
+                        break;
+                } while (seq < 0x40 || seq > 0x7E);
+            }
+        }
+        else if (ch >= 0x20 && pos < len - 2) {
+            buf[pos++] = ch;
+            echo((char *)&ch, 1);
+        }
+    }
+
+    raw_off();
+
+    // Trailing spaces would only spoil the match with a speculation
+    while (pos > 0 && buf[pos - 1] == ' ')
+        pos--;
+    buf[pos] = '\0';
+    if (!result || !gli_llm_speculating(buf))
+        gli_llm_speculate_cancel();
+    if (!result)
+        return NULL;
+
+    buf[pos++] = '\n';
+    buf[pos] = '\0';
+    return buf;
+}
+
+#else /* WASM_BUILD */
+
+char *gli_llm_read_line(char *buf, int len, int speculate)
+{
+    return fgets(buf, len, stdin);
+}
+
+#endif /* WASM_BUILD */
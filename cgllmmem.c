@@ -0,0 +1,260 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "glk.h"
+#include "cheapglk.h"
+#include "glk_llm.h"
+
+/* Session memory of interpretations. Every time the model turns an
+   input into a different command, we remember the pair; when the game
+   next asks for input, we note whether it accepted the command (no
+   parser error in between). Accepted pairs that share words with a new
+   input are offered back to the model as examples, so "grab the thingy"
+   comes out as "take amulet" again without the model having to work it
+   out from scratch.
+
+   The store is a small fixed array. When it is full, the entry with the
+   lowest keep-score (rejected, rarely confirmed, old) is replaced.
+*/
+
+typedef struct {
+    char input[128];
+    char command[128];
+    int accepted;   /* times the game accepted this interpretation */
+    int rejected;   /* times it was refused */
+    glui32 stamp;   /* turn of last use */
+} memory_entry_t;
+
+static memory_entry_t entries[GLK_LLM_MEMORY_MAX];
+static int numentries = 0;
+static glui32 memory_turn = 0;
+
+static char pending_input[128];
+static char pending_command[128];
+static int pending = 0;
+
+/* Lower case and single spaces, for comparing inputs; trailing
+   characters in strip (if any) are dropped too. Shared with the
+   shared cache (cgllmshm.c). */
+void gli_llm_normalize(const char *src, char *dest, size_t len, const char *strip)
+{
+    size_t pos = 0;
+    int space = 0;
+
+    while (*src == ' ' || *src == '\t')
+        src++;
+    for (; *src && pos < len - 1; src++) {
+        if (*src == ' ' || *src == '\t') {
+            space = 1;
+            continue;
+        }
+        if (space && pos < len - 2)
+            dest[pos++] = ' ';
+        space = 0;
+        dest[pos++] = tolower((unsigned char)*src);
+    }
+    while (strip && pos && strchr(strip, dest[pos - 1]))
+        pos--;
+    dest[pos] = '\0';
+}
+
+static int memory_capacity(void)
+{
+    int size = gli_llm_config.memory_size;
+    if (size > GLK_LLM_MEMORY_MAX)
+        size = GLK_LLM_MEMORY_MAX;
+    return size;
+}
+
+/* Note an interpretation that has just been sent to the game. Its fate
+   is decided by the next gli_llm_memory_settle(). */
+void gli_llm_memory_propose(const char *input, const char *command)
+{
+    gli_llm_shared_propose(input, command);
+    if (memory_capacity() <= 0)
+        return;
+
+    gli_llm_normalize(input, pending_input, sizeof(pending_input), NULL);
+    gli_llm_normalize(command, pending_command, sizeof(pending_command), NULL);
+    pending = (pending_input[0] && pending_command[0]
+        && strcmp(pending_input, pending_command) != 0);
+}
+
+static memory_entry_t *find_slot(void)
+{
+    int capacity = memory_capacity();
+    if (numentries < capacity)
+        return &entries[numentries++];
+
+    // Evict the entry least worth keeping
+    memory_entry_t *worst = &entries[0];
+    long worstscore = 0;
+    for (int ix = 0; ix < numentries; ix++) {
+        memory_entry_t *ent = &entries[ix];
+        long score = 4 * (long)ent->accepted - 8 * (long)ent->rejected + (long)ent->stamp;
+        if (ix == 0 || score < worstscore) {
+            worst = ent;
+            worstscore = score;
+        }
+    }
+    return worst;
+}
+
+/* The game has asked for input again, so the last interpretation either
+   worked or produced a parser error. Record which. */
+void gli_llm_memory_settle(int rejected)
+{
+    gli_llm_shared_settle(rejected);
+    memory_turn++;
+    if (!pending)
+        return;
+    pending = 0;
+
+    for (int ix = 0; ix < numentries; ix++) {
+        memory_entry_t *ent = &entries[ix];
+        if (strcmp(ent->input, pending_input) == 0 && strcmp(ent->command, pending_command) == 0) {
+            if (rejected)
+                ent->rejected++;
+            else
+                ent->accepted++;
+            ent->stamp = memory_turn;
+            return;
+        }
+    }
+
+    // Only successes are worth a new slot
+    if (rejected)
+        return;
+
+    memory_entry_t *ent = find_slot();
+    strcpy(ent->input, pending_input);
+    strcpy(ent->command, pending_command);
+    ent->accepted = 1;
+    ent->rejected = 0;
+    ent->stamp = memory_turn;
+}
+
+/* If this exact input (give or take case and spacing) has been
+   interpreted before, and the game took it more often than not, copy
+   the command to output and return 1. Used when no request can be
+   made. */
+int gli_llm_memory_lookup(const char *input, char *output, size_t len)
+{
+    char norm[128];
+    gli_llm_normalize(input, norm, sizeof(norm), NULL);
+
+    memory_entry_t *best = NULL;
+    for (int ix = 0; ix < numentries; ix++) {
+        memory_entry_t *ent = &entries[ix];
+        if (strcmp(ent->input, norm) != 0 || ent->accepted <= ent->rejected)
+            continue;
+        if (!best || ent->accepted - ent->rejected > best->accepted - best->rejected)
+            best = ent;
+    }
+    if (!best)
+        return 0;
+    strncpy(output, best->command, len - 1);
+    output[len - 1] = '\0';
+    return 1;
+}
+
+/* Filler words which say nothing about what an input means. */
+static const char *stop_words[] = {
+    "a", "an", "the", "to", "go", "at", "on", "in", "of", "my", "it",
+    "and", "then", "with", "some", "this", "that", NULL
+};
+
+static int is_stop_word(const char *word, size_t len)
+{
+    for (int ix = 0; stop_words[ix]; ix++) {
+        if (strlen(stop_words[ix]) == len && strncmp(stop_words[ix], word, len) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+/* Count the words of a that also appear in b (both normalized). */
+static int shared_words(const char *a, const char *b)
+{
+    int count = 0;
+    while (*a) {
+        const char *end = strchr(a, ' ');
+        size_t len = end ? (size_t)(end - a) : strlen(a);
+
+        if (!is_stop_word(a, len)) {
+            const char *p = b;
+            while (*p) {
+                const char *pend = strchr(p, ' ');
+                size_t plen = pend ? (size_t)(pend - p) : strlen(p);
+                if (plen == len && strncmp(a, p, len) == 0) {
+                    count++;
+                    break;
+                }
+                p += plen;
+                while (*p == ' ') p++;
+            }
+        }
+
+        a += len;
+        while (*a == ' ') a++;
+    }
+    return count;
+}
+
+/* Write the most relevant remembered interpretations for this input to
+   sb, in the same form as the prompt's built-in examples. */
+void gli_llm_memory_examples(const char *input, glk_llm_strbuf_t *sb)
+{
+    int wanted = gli_llm_config.memory_examples;
+    if (wanted <= 0 || numentries == 0)
+        return;
+    if (wanted > GLK_LLM_MEMORY_MAX)
+        wanted = GLK_LLM_MEMORY_MAX;
+
+    char norm[128];
+    gli_llm_normalize(input, norm, sizeof(norm), NULL);
+
+    int chosen[GLK_LLM_MEMORY_MAX];
+    long scores[GLK_LLM_MEMORY_MAX];
+    int numchosen = 0;
+
+    for (int ix = 0; ix < numentries; ix++) {
+        memory_entry_t *ent = &entries[ix];
+        if (ent->accepted <= ent->rejected)
+            continue;
+        int overlap = shared_words(norm, ent->input);
+        if (!overlap)
+            continue;
+
+        // Relevance first, then how often it worked, then recency
+        long score = 1000L * overlap
+            + 50L * (ent->accepted - ent->rejected)
+            - (long)(memory_turn - ent->stamp);
+
+        // Insertion into the sorted top list
+        int pos = numchosen;
+        while (pos > 0 && scores[pos-1] < score)
+            pos--;
+        if (pos >= wanted)
+            continue;
+        int last = (numchosen < wanted) ? numchosen : wanted - 1;
+        for (int jx = last; jx > pos; jx--) {
+            chosen[jx] = chosen[jx-1];
+            scores[jx] = scores[jx-1];
+        }
+        chosen[pos] = ix;
+        scores[pos] = score;
+        if (numchosen < wanted)
+            numchosen++;
+    }
+
+    for (int ix = 0; ix < numchosen; ix++) {
+        memory_entry_t *ent = &entries[chosen[ix]];
+        gli_llm_strbuf_append_str(sb, "Input='");
+        gli_llm_strbuf_append_str(sb, ent->input);
+        gli_llm_strbuf_append_str(sb, "' → ");
+        gli_llm_strbuf_append_str(sb, ent->command);
+        gli_llm_strbuf_append_str(sb, "\n");
+    }
+}
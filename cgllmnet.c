@@ -0,0 +1,1456 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#ifndef WASM_BUILD
+#include <errno.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#endif
+#include "glk.h"
+#include "glk_llm.h"
+
+#ifndef IOV_MAX
+/* The smallest limit POSIX allows. */
+#define IOV_MAX (16)
+#endif
+
+#ifndef MSG_NOSIGNAL
+/* Where there is no such flag, a write to a closed peer raises SIGPIPE. */
+#define MSG_NOSIGNAL (0)
+#endif
+
+/* HTTP plumbing for the LLM layer: growable strings, the request body
+   builder, and the blocking HTTP client.
+
+   A request body is kept as a list of pieces rather than one flat
+   buffer. Text that outlives the request (the compiled prompt template,
+   fixed JSON fragments) is referenced in place; only the per-turn values
+   are copied, into a single side buffer. When the request is sent, the
+   header fragments and body pieces go out together with writev(), so
+   the prompt is never copied into an intermediate request buffer. The
+   Content-Length is the sum of the piece lengths.
+*/
+
+void gli_llm_strbuf_init(glk_llm_strbuf_t *sb)
+{
+    sb->buf = NULL;
+    sb->len = 0;
+    sb->size = 0;
+}
+
+void gli_llm_strbuf_free(glk_llm_strbuf_t *sb)
+{
+    free(sb->buf);
+    gli_llm_strbuf_init(sb);
+}
+
+int gli_llm_strbuf_append(glk_llm_strbuf_t *sb, const char *text, size_t len)
+{
+    if (sb->len + len + 1 > sb->size) {
+        size_t newsize = sb->size ? sb->size : 256;
+        while (sb->len + len + 1 > newsize)
+            newsize *= 2;
+        char *newbuf = realloc(sb->buf, newsize);
+        if (!newbuf) return 0;
+        sb->buf = newbuf;
+        sb->size = newsize;
+    }
+    memcpy(sb->buf + sb->len, text, len);
+    sb->len += len;
+    sb->buf[sb->len] = '\0';
+    return 1;
+}
+
+int gli_llm_strbuf_append_str(glk_llm_strbuf_t *sb, const char *text)
+{
+    return gli_llm_strbuf_append(sb, text, strlen(text));
+}
+
+int gli_llm_strbuf_append_json(glk_llm_strbuf_t *sb, const char *text)
+{
+    const char *run = text;
+    const char *p;
+
+    // Copy unescaped runs in one go; only special characters are expanded
+    for (p = text; *p; p++) {
+        unsigned char ch = *p;
+        char esc[8];
+        if (ch == '"' || ch == '\\') {
+            esc[0] = '\\'; esc[1] = ch; esc[2] = '\0';
+        } else if (ch == '\n') {
+            strcpy(esc, "\\n");
+        } else if (ch == '\r') {
+            strcpy(esc, "\\r");
+        } else if (ch == '\t') {
+            strcpy(esc, "\\t");
+        } else if (ch < 0x20) {
+            snprintf(esc, sizeof(esc), "\\u%04x", ch);
+        } else {
+            continue;
+        }
+        if (!gli_llm_strbuf_append(sb, run, p - run)
+            || !gli_llm_strbuf_append_str(sb, esc))
+            return 0;
+        run = p + 1;
+    }
+
+    return gli_llm_strbuf_append(sb, run, p - run);
+}
+
+void gli_llm_body_init(glk_llm_body_t *body)
+{
+    body->pieces = NULL;
+    body->numpieces = 0;
+    body->maxpieces = 0;
+    body->len = 0;
+    body->failed = 0;
+    gli_llm_strbuf_init(&body->dyn);
+}
+
+void gli_llm_body_free(glk_llm_body_t *body)
+{
+    free(body->pieces);
+    gli_llm_strbuf_free(&body->dyn);
+    gli_llm_body_init(body);
+}
+
+static glk_llm_piece_t *body_new_piece(glk_llm_body_t *body)
+{
+    if (body->numpieces >= body->maxpieces) {
+        int newmax = body->maxpieces ? body->maxpieces * 2 : 32;
+        glk_llm_piece_t *newpieces = realloc(body->pieces, newmax * sizeof(glk_llm_piece_t));
+        if (!newpieces) {
+            body->failed = 1;
+            return NULL;
+        }
+        body->pieces = newpieces;
+        body->maxpieces = newmax;
+    }
+    return &body->pieces[body->numpieces++];
+}
+
+/* Reference text which will stay valid until the request is sent. */
+void gli_llm_body_static(glk_llm_body_t *body, const char *text, size_t len)
+{
+    if (!len || body->failed) return;
+
+    glk_llm_piece_t *piece = body_new_piece(body);
+    if (!piece) return;
+    piece->text = text;
+    piece->offset = 0;
+    piece->len = len;
+    body->len += len;
+}
+
+/* Extend the body with whatever was just appended to body->dyn. Adjacent
+   dynamic pieces are merged. */
+static void body_extend_dyn(glk_llm_body_t *body, size_t oldlen)
+{
+    size_t added = body->dyn.len - oldlen;
+    if (!added) return;
+
+    glk_llm_piece_t *last = body->numpieces ? &body->pieces[body->numpieces-1] : NULL;
+    if (last && !last->text && last->offset + last->len == oldlen) {
+        last->len += added;
+    } else {
+        glk_llm_piece_t *piece = body_new_piece(body);
+        if (!piece) return;
+        piece->text = NULL;
+        piece->offset = oldlen;
+        piece->len = added;
+    }
+    body->len += added;
+}
+
+void gli_llm_body_copy(glk_llm_body_t *body, const char *text, size_t len)
+{
+    if (body->failed) return;
+
+    size_t oldlen = body->dyn.len;
+    if (!gli_llm_strbuf_append(&body->dyn, text, len)) {
+        body->failed = 1;
+        return;
+    }
+    body_extend_dyn(body, oldlen);
+}
+
+void gli_llm_body_str(glk_llm_body_t *body, const char *text)
+{
+    gli_llm_body_copy(body, text, strlen(text));
+}
+
+void gli_llm_body_json(glk_llm_body_t *body, const char *text)
+{
+    if (body->failed) return;
+
+    size_t oldlen = body->dyn.len;
+    if (!gli_llm_strbuf_append_json(&body->dyn, text)) {
+        body->failed = 1;
+        return;
+    }
+    body_extend_dyn(body, oldlen);
+}
+
+/* Append a "response_format" (with a trailing comma) asking for strict
+   JSON output: an object with the single required field name, whose
+   schema is the given JSON text. */
+void gli_llm_body_schema(glk_llm_body_t *body, const char *name, const char *property)
+{
+    BODY_LITERAL(body, "\"response_format\":{\"type\":\"json_schema\",\"json_schema\":{\"name\":\"");
+    gli_llm_body_str(body, name);
+    BODY_LITERAL(body, "\",\"strict\":true,\"schema\":{\"type\":\"object\",\"properties\":{\"");
+    gli_llm_body_str(body, name);
+    BODY_LITERAL(body, "\":");
+    gli_llm_body_str(body, property);
+    BODY_LITERAL(body, "},\"required\":[\"");
+    gli_llm_body_str(body, name);
+    BODY_LITERAL(body, "\"],\"additionalProperties\":false}}},");
+}
+
+static const char *piece_ptr(const glk_llm_body_t *body, const glk_llm_piece_t *piece)
+{
+    return piece->text ? piece->text : body->dyn.buf + piece->offset;
+}
+
+/* Flatten the body into a newly allocated, NUL-terminated string. Used
+   where a contiguous copy is unavoidable. */
+char *gli_llm_body_flatten(const glk_llm_body_t *body)
+{
+    if (body->failed) return NULL;
+
+    char *res = malloc(body->len + 1);
+    if (!res) return NULL;
+
+    size_t pos = 0;
+    for (int ix = 0; ix < body->numpieces; ix++) {
+        const glk_llm_piece_t *piece = &body->pieces[ix];
+        memcpy(res + pos, piece_ptr(body, piece), piece->len);
+        pos += piece->len;
+    }
+    res[pos] = '\0';
+    return res;
+}
+
+/* Minimal JSON reading. The LLM responses we care about are small and
+   we only need a few fields out of them, so rather than parse the whole
+   document we look for "key": and read the value after it. */
+
+static const char *json_find_value(const char *json, const char *key)
+{
+    size_t keylen = strlen(key);
+    const char *p = json;
+
+    while ((p = strchr(p, '"')) != NULL) {
+        p++;
+        if (strncmp(p, key, keylen) == 0 && p[keylen] == '"') {
+            const char *val = p + keylen + 1;
+            while (*val == ' ' || *val == '\t' || *val == '\n' || *val == '\r')
+                val++;
+            if (*val == ':') {
+                val++;
+                while (*val == ' ' || *val == '\t' || *val == '\n' || *val == '\r')
+                    val++;
+                return val;
+            }
+        }
+        // Skip the rest of this string, honoring escapes
+        while (*p && *p != '"') {
+            if (*p == '\\' && p[1]) p++;
+            p++;
+        }
+        if (*p) p++;
+    }
+    return NULL;
+}
+
+static void put_utf8(glk_llm_strbuf_t *sb, unsigned long ch)
+{
+    char buf[4];
+    size_t len;
+    if (ch < 0x80) {
+        buf[0] = ch;
+        len = 1;
+    } else if (ch < 0x800) {
+        buf[0] = 0xC0 | (ch >> 6);
+        buf[1] = 0x80 | (ch & 0x3F);
+        len = 2;
+    } else if (ch < 0x10000) {
+        buf[0] = 0xE0 | (ch >> 12);
+        buf[1] = 0x80 | ((ch >> 6) & 0x3F);
+        buf[2] = 0x80 | (ch & 0x3F);
+        len = 3;
+    } else {
+        buf[0] = 0xF0 | (ch >> 18);
+        buf[1] = 0x80 | ((ch >> 12) & 0x3F);
+        buf[2] = 0x80 | ((ch >> 6) & 0x3F);
+        buf[3] = 0x80 | (ch & 0x3F);
+        len = 4;
+    }
+    gli_llm_strbuf_append(sb, buf, len);
+}
+
+/* Decode the JSON string literal starting at p (which must point at the
+   opening quote) into sb. Returns a pointer past the closing quote, or
+   NULL if the string is malformed. */
+static const char *json_read_string(const char *p, glk_llm_strbuf_t *sb)
+{
+    if (*p != '"') return NULL;
+    p++;
+
+    while (*p && *p != '"') {
+        const char *run = p;
+        while (*p && *p != '"' && *p != '\\')
+            p++;
+        gli_llm_strbuf_append(sb, run, p - run);
+
+        if (*p == '\\') {
+            p++;
+            switch (*p) {
+                case 'n': gli_llm_strbuf_append(sb, "\n", 1); break;
+                case 'r': gli_llm_strbuf_append(sb, "\r", 1); break;
+                case 't': gli_llm_strbuf_append(sb, "\t", 1); break;
+                case 'b': gli_llm_strbuf_append(sb, "\b", 1); break;
+                case 'f': gli_llm_strbuf_append(sb, "\f", 1); break;
+                case 'u': {
+                    char hex[5];
+                    if (strlen(p + 1) < 4) return NULL;
+                    memcpy(hex, p + 1, 4);
+                    hex[4] = '\0';
+                    unsigned long ch = strtoul(hex, NULL, 16);
+                    p += 4;
+                    // Combine a surrogate pair if one follows
+                    if (ch >= 0xD800 && ch < 0xDC00 && p[1] == '\\' && p[2] == 'u' && strlen(p + 3) >= 4) {
+                        memcpy(hex, p + 3, 4);
+                        unsigned long lo = strtoul(hex, NULL, 16);
+                        if (lo >= 0xDC00 && lo < 0xE000) {
+                            ch = 0x10000 + ((ch - 0xD800) << 10) + (lo - 0xDC00);
+                            p += 6;
+                        }
+                    }
+                    put_utf8(sb, ch);
+                    break;
+                }
+                case '\0':
+                    return NULL;
+                default:
+                    gli_llm_strbuf_append(sb, p, 1);
+                    break;
+            }
+            p++;
+        }
+    }
+
+    if (*p != '"') return NULL;
+    if (!sb->buf) gli_llm_strbuf_append(sb, "", 0);
+    return p + 1;
+}
+
+/* Return the (unescaped) string value of the first "key" in json, in a
+   newly allocated buffer, or NULL. */
+char *gli_llm_json_string(const char *json, const char *key)
+{
+    if (!json) return NULL;
+
+    const char *val = json_find_value(json, key);
+    if (!val) return NULL;
+
+    glk_llm_strbuf_t sb;
+    gli_llm_strbuf_init(&sb);
+    if (!json_read_string(val, &sb)) {
+        gli_llm_strbuf_free(&sb);
+        return NULL;
+    }
+    return sb.buf;
+}
+
+/* Read the first "key": [array of strings] in json into out (up to max
+   entries of outlen bytes each). Returns the number of entries read. */
+int gli_llm_json_string_array(const char *json, const char *key, char *out, size_t outlen, int max)
+{
+    if (!json) return 0;
+
+    const char *p = json_find_value(json, key);
+    if (!p || *p != '[') return 0;
+    p++;
+
+    int count = 0;
+    while (count < max) {
+        while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r' || *p == ',')
+            p++;
+        if (*p != '"')
+            break;
+
+        glk_llm_strbuf_t sb;
+        gli_llm_strbuf_init(&sb);
+        p = json_read_string(p, &sb);
+        if (!p) {
+            gli_llm_strbuf_free(&sb);
+            break;
+        }
+        char *dest = out + count * outlen;
+        strncpy(dest, sb.buf, outlen - 1);
+        dest[outlen - 1] = '\0';
+        gli_llm_strbuf_free(&sb);
+        count++;
+    }
+    return count;
+}
+
+/* Read the first "key": number in json. Returns 1 if found. */
+int gli_llm_json_number(const char *json, const char *key, double *result)
+{
+    if (!json) return 0;
+
+    const char *val = json_find_value(json, key);
+    if (!val) return 0;
+
+    char *end;
+    double num = strtod(val, &end);
+    if (end == val) return 0;
+    *result = num;
+    return 1;
+}
+
+/* Milliseconds on a monotonic clock, for timing requests. */
+double gli_llm_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/* Hash the bytes of a request body, piece by piece. */
+glk_llm_hash_t gli_llm_body_hash(const glk_llm_body_t *body)
+{
+    glk_llm_hash_t hash = 0;
+    for (int ix = 0; ix < body->numpieces; ix++) {
+        const glk_llm_piece_t *piece = &body->pieces[ix];
+        hash = gli_llm_hash(piece_ptr(body, piece), piece->len, hash);
+    }
+    return hash;
+}
+
+/* 64-bit FNV-1a. Pass 0 as the seed to start a new hash, or a previous
+   result to continue it. */
+glk_llm_hash_t gli_llm_hash(const void *data, size_t len, glk_llm_hash_t seed)
+{
+    const unsigned char *p = data;
+    glk_llm_hash_t hash = seed ? seed : 0xcbf29ce484222325ULL;
+
+    while (len--) {
+        hash ^= *p++;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+glk_llm_hash_t gli_llm_hash_str(const char *text, glk_llm_hash_t seed)
+{
+    return gli_llm_hash(text, strlen(text), seed);
+}
+
+#ifndef WASM_BUILD
+
+/* A parsed endpoint. For a Unix domain socket, sockpath is set and host
+   and port are unused (except for the Host header). */
+typedef struct {
+    char protocol[16];
+    char host[256];
+    int port;
+    char path[512];
+    char sockpath[108];
+} http_url_t;
+
+/* Decode %XX escapes, as used for the socket path of http+unix:// URLs.
+   Returns 0 if the result doesn't fit. */
+static int percent_decode(const char *src, size_t len, char *dest, size_t destlen)
+{
+    size_t pos = 0;
+    for (size_t ix = 0; ix < len; ix++) {
+        char ch = src[ix];
+        if (ch == '%' && ix + 2 < len) {
+            char hex[3] = { src[ix+1], src[ix+2], '\0' };
+            char *end;
+            long val = strtol(hex, &end, 16);
+            if (*end == '\0') {
+                ch = (char)val;
+                ix += 2;
+            }
+        }
+        if (pos + 1 >= destlen)
+            return 0;
+        dest[pos++] = ch;
+    }
+    dest[pos] = '\0';
+    return 1;
+}
+
+/* Endpoints on a Unix domain socket, for a model server on the same
+   host:
+
+     unix:///run/llm.sock                      POST to /
+     unix:///run/llm.sock:/v1/chat/completions POST to that path
+     http+unix://%2Frun%2Fllm.sock/v1/chat/completions
+
+   A socket path starting with "@" names a socket in the Linux abstract
+   namespace. */
+static int parse_unix_url(const char *p, int encoded, http_url_t *url)
+{
+    const char *pathstart;
+    size_t socklen;
+
+    if (encoded) {
+        pathstart = strchr(p, '/');
+        socklen = pathstart ? (size_t)(pathstart - p) : strlen(p);
+        if (!percent_decode(p, socklen, url->sockpath, sizeof(url->sockpath)))
+            return 0;
+    } else {
+        pathstart = strstr(p, ":/");
+        socklen = pathstart ? (size_t)(pathstart - p) : strlen(p);
+        if (socklen >= sizeof(url->sockpath))
+            return 0;
+        memcpy(url->sockpath, p, socklen);
+        url->sockpath[socklen] = '\0';
+        if (pathstart)
+            pathstart++;
+    }
+
+    if (!url->sockpath[0])
+        return 0;
+    if (pathstart && strlen(pathstart) >= sizeof(url->path))
+        return 0;
+
+    strcpy(url->protocol, "http");
+    strcpy(url->host, "localhost");
+    url->port = 0;
+    strcpy(url->path, (pathstart && *pathstart) ? pathstart : "/");
+    return 1;
+}
+
+static int parse_url(const char *urlstr, http_url_t *url)
+{
+    const char *p = urlstr;
+
+    url->sockpath[0] = '\0';
+
+    if (strncmp(p, "unix://", 7) == 0) {
+        return parse_unix_url(p + 7, 0, url);
+    } else if (strncmp(p, "http+unix://", 12) == 0) {
+        return parse_unix_url(p + 12, 1, url);
+    } else if (strncmp(p, "https://", 8) == 0) {
+        strcpy(url->protocol, "https");
+        p += 8;
+        url->port = 443;
+    } else if (strncmp(p, "http://", 7) == 0) {
+        strcpy(url->protocol, "http");
+        p += 7;
+        url->port = 80;
+    } else {
+        return 0;
+    }
+
+    const char *slash = strchr(p, '/');
+    const char *colon = strchr(p, ':');
+    const char *hostend = slash ? slash : (p + strlen(p));
+
+    if (colon && colon < hostend) {
+        url->port = atoi(colon + 1);
+        hostend = colon;
+    }
+    if ((size_t)(hostend - p) >= sizeof(url->host))
+        return 0;
+    memcpy(url->host, p, hostend - p);
+    url->host[hostend - p] = '\0';
+
+    p = slash ? slash : (p + strlen(p));
+    if (strlen(p) >= sizeof(url->path))
+        return 0;
+    strcpy(url->path, *p ? p : "/");
+
+    return 1;
+}
+
+static SSL_CTX *ssl_ctx = NULL;
+static pthread_once_t ssl_once = PTHREAD_ONCE_INIT;
+
+static void init_ssl_ctx(void)
+{
+    SSL_library_init();
+    SSL_load_error_strings();
+    ssl_ctx = SSL_CTX_new(TLS_client_method());
+    if (!ssl_ctx)
+        return;
+
+    // Disable certificate verification for compatibility
+    SSL_CTX_set_verify(ssl_ctx, SSL_VERIFY_NONE, NULL);
+}
+
+/* Background requests may get here from several threads at once. */
+static SSL_CTX *get_ssl_ctx(void)
+{
+    pthread_once(&ssl_once, init_ssl_ctx);
+    return ssl_ctx;
+}
+
+/* Time left until deadline (from gli_llm_now_ms()), or -1 for none. */
+static int time_left(double deadline)
+{
+    if (deadline <= 0)
+        return -1;
+    double left = deadline - gli_llm_now_ms();
+    return (left > 1) ? (int)left : 1;
+}
+
+static int past_deadline(double deadline)
+{
+    return (deadline > 0 && gli_llm_now_ms() >= deadline);
+}
+
+/* Limit each blocking read and write on sock to ms milliseconds. */
+static void set_socket_timeout(int sock, int ms)
+{
+    if (ms < 0)
+        return;
+    struct timeval tv;
+    tv.tv_sec = ms / 1000;
+    tv.tv_usec = (ms % 1000) * 1000;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+/* connect(), giving up at the deadline. */
+static int connect_deadline(int sock, const struct sockaddr *addr, socklen_t addrlen, double deadline)
+{
+    if (deadline <= 0)
+        return connect(sock, addr, addrlen);
+
+    int flags = fcntl(sock, F_GETFL, 0);
+    fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+
+    int res = connect(sock, addr, addrlen);
+    if (res < 0 && errno == EINPROGRESS) {
+        struct pollfd pfd;
+        pfd.fd = sock;
+        pfd.events = POLLOUT;
+        res = -1;
+        if (poll(&pfd, 1, time_left(deadline)) == 1) {
+            int err = 0;
+            socklen_t len = sizeof(err);
+            if (getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err == 0)
+                res = 0;
+        }
+    }
+
+    fcntl(sock, F_SETFL, flags);
+    return res;
+}
+
+static int connect_host(const char *host, int port, double deadline)
+{
+    struct addrinfo hints, *result;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    char port_str[16];
+    snprintf(port_str, sizeof(port_str), "%d", port);
+
+    if (getaddrinfo(host, port_str, &hints, &result) != 0)
+        return -1;
+
+    int sock = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+    if (sock < 0) {
+        freeaddrinfo(result);
+        return -1;
+    }
+
+    if (connect_deadline(sock, result->ai_addr, result->ai_addrlen, deadline) < 0) {
+        close(sock);
+        freeaddrinfo(result);
+        return -1;
+    }
+
+    freeaddrinfo(result);
+    return sock;
+}
+
+static int connect_unix(const char *sockpath, double deadline)
+{
+    struct sockaddr_un addr;
+    size_t len = strlen(sockpath);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (len >= sizeof(addr.sun_path))
+        return -1;
+
+    socklen_t addrlen;
+    if (sockpath[0] == '@') {
+        // Abstract namespace: a leading NUL, and no terminator
+        memcpy(addr.sun_path + 1, sockpath + 1, len - 1);
+        addrlen = offsetof(struct sockaddr_un, sun_path) + len;
+    } else {
+        memcpy(addr.sun_path, sockpath, len);
+        addrlen = sizeof(addr);
+    }
+
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0)
+        return -1;
+
+    if (connect_deadline(sock, (struct sockaddr *)&addr, addrlen, deadline) < 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+/* Write the whole iovec array, coping with short writes. A peer that
+   has hung up (a kept connection gone stale) is an error, not SIGPIPE. */
+static int write_all_iov(int sock, struct iovec *iov, int count)
+{
+    while (count > 0) {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = (count > IOV_MAX) ? IOV_MAX : count;
+        ssize_t sent = sendmsg(sock, &msg, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+
+        // Skip past whatever was fully written; trim a partial entry
+        while (count > 0 && (size_t)sent >= iov->iov_len) {
+            sent -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0 && sent > 0) {
+            iov->iov_base = (char *)iov->iov_base + sent;
+            iov->iov_len -= sent;
+        }
+    }
+    return 1;
+}
+
+/* TLS has no gather write, so coalesce into one buffer and hand it to a
+   single SSL_write(). This is the only copy of the request we make. */
+static int ssl_write_iov(SSL *ssl, const struct iovec *iov, int count)
+{
+    size_t total = 0;
+    for (int ix = 0; ix < count; ix++)
+        total += iov[ix].iov_len;
+
+    char *buf = malloc(total);
+    if (!buf) return 0;
+
+    size_t pos = 0;
+    for (int ix = 0; ix < count; ix++) {
+        memcpy(buf + pos, iov[ix].iov_base, iov[ix].iov_len);
+        pos += iov[ix].iov_len;
+    }
+
+    int sent = SSL_write(ssl, buf, total);
+    free(buf);
+    return (sent == (int)total);
+}
+
+/* Split the raw response into status and body, decoding a chunked body
+   in place. On return, response holds only the body. */
+static int finish_response(glk_llm_strbuf_t *response, int *status)
+{
+    if (!response->buf) return 0;
+
+    char *body = strstr(response->buf, "\r\n\r\n");
+    if (!body) return 0;
+    body += 4;
+
+    if (status) {
+        const char *sp = strchr(response->buf, ' ');
+        *status = sp ? atoi(sp + 1) : 0;
+    }
+
+    int chunked = 0;
+    char *hdr = strstr(response->buf, "\r\n");
+    while (hdr && hdr < body - 2) {
+        hdr += 2;
+        if (strncasecmp(hdr, "Transfer-Encoding:", 18) == 0) {
+            const char *val = hdr + 18;
+            const char *eol = strstr(val, "\r\n");
+            for (; val < eol; val++) {
+                if (strncasecmp(val, "chunked", 7) == 0) {
+                    chunked = 1;
+                    break;
+                }
+            }
+        }
+        hdr = strstr(hdr, "\r\n");
+    }
+
+    size_t bodylen = response->len - (body - response->buf);
+
+    if (chunked) {
+        const char *src = body;
+        const char *end = body + bodylen;
+        char *dest = response->buf;
+        while (src < end) {
+            char *numend;
+            unsigned long size = strtoul(src, &numend, 16);
+            const char *data = strstr(numend, "\r\n");
+            if (!data || size == 0) break;
+            data += 2;
+            if (data + size > end) size = end - data;
+            memmove(dest, data, size);
+            dest += size;
+            src = data + size;
+            if (src + 2 <= end && src[0] == '\r' && src[1] == '\n')
+                src += 2;
+        }
+        response->len = dest - response->buf;
+    } else {
+        memmove(response->buf, body, bodylen);
+        response->len = bodylen;
+    }
+
+    response->buf[response->len] = '\0';
+    return 1;
+}
+
+/* An open connection to an endpoint. gli_llm_http_post() opens one for
+   each request; a caller that holds on to one (the broker does) can
+   send several requests down it, as long as the server keeps it open.
+   target names what it is connected to, so that a request for another
+   endpoint knows to reconnect. */
+struct glk_llm_conn_struct {
+    int sock;
+    SSL *ssl;
+    char target[400];
+    int requests;       /* sent on this connection */
+};
+
+static void conn_target(const http_url_t *url, char *buf, size_t len)
+{
+    if (url->sockpath[0])
+        snprintf(buf, len, "unix:%s", url->sockpath);
+    else
+        snprintf(buf, len, "%s://%s:%d", url->protocol, url->host, url->port);
+}
+
+static void conn_close(glk_llm_conn_t *conn)
+{
+    if (conn->ssl) {
+        SSL_free(conn->ssl);
+        conn->ssl = NULL;
+    }
+    if (conn->sock >= 0) {
+        close(conn->sock);
+        conn->sock = -1;
+    }
+    conn->target[0] = '\0';
+    conn->requests = 0;
+}
+
+static int conn_open(glk_llm_conn_t *conn, const http_url_t *url, double deadline)
+{
+    if (url->sockpath[0])
+        conn->sock = connect_unix(url->sockpath, deadline);
+    else
+        conn->sock = connect_host(url->host, url->port, deadline);
+    if (conn->sock < 0)
+        return 0;
+    set_socket_timeout(conn->sock, time_left(deadline));
+
+    if (strcmp(url->protocol, "https") == 0) {
+        SSL_CTX *ctx = get_ssl_ctx();
+        if (!ctx) {
+            conn_close(conn);
+            return 0;
+        }
+
+        conn->ssl = SSL_new(ctx);
+        SSL_set_fd(conn->ssl, conn->sock);
+
+        // Set SNI (Server Name Indication) - required by many servers
+        SSL_set_tlsext_host_name(conn->ssl, url->host);
+
+        if (SSL_connect(conn->ssl) <= 0) {
+            conn_close(conn);
+            return 0;
+        }
+    }
+
+    conn_target(url, conn->target, sizeof(conn->target));
+    return 1;
+}
+
+/* Is the raw response in buf complete? Only answerable when it has a
+   Content-Length or a chunked body; otherwise the server will close
+   the connection to end it, and *closing is set. */
+static int response_complete(const char *buf, size_t len, int *closing)
+{
+    const char *body = strstr(buf, "\r\n\r\n");
+    if (!body)
+        return 0;
+    body += 4;
+    size_t bodylen = len - (body - buf);
+
+    long length = -1;
+    int chunked = 0;
+    const char *hdr = strstr(buf, "\r\n");
+    while (hdr && hdr < body - 2) {
+        hdr += 2;
+        const char *val = strchr(hdr, ':');
+        const char *eol = strstr(hdr, "\r\n");
+        if (val && val < eol) {
+            val++;
+            while (*val == ' ')
+                val++;
+            if (strncasecmp(hdr, "Content-Length:", 15) == 0)
+                length = atol(val);
+            else if (strncasecmp(hdr, "Transfer-Encoding:", 18) == 0)
+                chunked = (strncasecmp(eol - 7, "chunked", 7) == 0);
+            else if (strncasecmp(hdr, "Connection:", 11) == 0)
+                *closing = (strncasecmp(val, "close", 5) == 0);
+        }
+        hdr = eol;
+    }
+
+    if (length >= 0)
+        return (bodylen >= (size_t)length);
+    if (!chunked) {
+        *closing = 1;
+        return 0;
+    }
+
+    // Walk the chunks to the last, empty one
+    const char *src = body;
+    const char *end = buf + len;
+    while (src < end) {
+        char *numend;
+        unsigned long size = strtoul(src, &numend, 16);
+        const char *data = strstr(numend, "\r\n");
+        if (!data)
+            return 0;
+        data += 2;
+        if (size == 0)
+            return (strstr(data - 2, "\r\n\r\n") != NULL);
+        if ((size_t)(end - data) < size + 2)
+            return 0;
+        src = data + size + 2;
+    }
+    return 0;
+}
+
+/* Send one request down conn and read the response. With keepalive,
+   reading stops at the end of the response rather than at EOF, and
+   *reusable says whether the connection can take another request.
+   *gotany is set if any of the response arrived. */
+static int conn_exchange(glk_llm_conn_t *conn, const http_url_t *url, const char *api_key,
+    glk_llm_body_t *body, glk_llm_strbuf_t *response, int *status, double deadline,
+    int keepalive, int *reusable, int *gotany)
+{
+    *reusable = 0;
+    *gotany = 0;
+
+    char content_length[32];
+    snprintf(content_length, sizeof(content_length), "%zu", body->len);
+
+    // Header fragments, then the body pieces, as one gather list
+    const char *header[] = {
+        "POST ", url->path, " HTTP/1.1\r\n"
+        "Host: ", url->host, "\r\n"
+        "Authorization: Bearer ", api_key, "\r\n"
+        "Content-Type: application/json\r\n"
+        "Content-Length: ", content_length, "\r\n",
+        keepalive ? "Connection: keep-alive\r\n" : "Connection: close\r\n",
+        "\r\n"
+    };
+    int numheader = sizeof(header) / sizeof(header[0]);
+
+    int count = numheader + body->numpieces;
+    struct iovec *iov = malloc(count * sizeof(struct iovec));
+    if (!iov)
+        return 0;
+    for (int ix = 0; ix < numheader; ix++) {
+        iov[ix].iov_base = (void *)header[ix];
+        iov[ix].iov_len = strlen(header[ix]);
+    }
+    for (int ix = 0; ix < body->numpieces; ix++) {
+        iov[numheader+ix].iov_base = (void *)piece_ptr(body, &body->pieces[ix]);
+        iov[numheader+ix].iov_len = body->pieces[ix].len;
+    }
+
+    int sent;
+    if (conn->ssl) {
+        sent = ssl_write_iov(conn->ssl, iov, count);
+    } else {
+        sent = write_all_iov(conn->sock, iov, count);
+    }
+    free(iov);
+    if (!sent)
+        return 0;
+    conn->requests++;
+
+    char chunk[4096];
+    int received;
+    int timedout = 0;
+    int complete = 0;
+    int closing = !keepalive;
+
+    while (1) {
+        if (conn->ssl) {
+            received = SSL_read(conn->ssl, chunk, sizeof(chunk));
+        } else {
+            received = read(conn->sock, chunk, sizeof(chunk));
+        }
+
+        if (received <= 0) {
+            // A read cut off by SO_RCVTIMEO looks like an error, not EOF
+            if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                timedout = 1;
+            closing = 1;
+            break;
+        }
+        *gotany = 1;
+        if (!gli_llm_strbuf_append(response, chunk, received))
+            break;
+        if (keepalive && response_complete(response->buf, response->len, &closing)) {
+            complete = 1;
+            break;
+        }
+        if (past_deadline(deadline)) {
+            timedout = 1;
+            break;
+        }
+        set_socket_timeout(conn->sock, time_left(deadline));
+    }
+
+    if (timedout)
+        return 0;
+    *reusable = (complete && !closing);
+    return finish_response(response, status);
+}
+
+/* POST body to url and read the whole response. On success, returns 1
+   with the response body in response (which must be initialized) and
+   the HTTP status in *status. The whole exchange is abandoned (and 0
+   returned) after timeout_ms, if that is positive. */
+int gli_llm_http_post(const char *urlstr, const char *api_key, int timeout_ms,
+    glk_llm_body_t *body, glk_llm_strbuf_t *response, int *status)
+{
+    http_url_t url;
+
+    if (body->failed)
+        return 0;
+    if (!parse_url(urlstr, &url))
+        return 0;
+
+    double deadline = (timeout_ms > 0) ? gli_llm_now_ms() + timeout_ms : 0;
+
+    glk_llm_conn_t conn;
+    conn.sock = -1;
+    conn.ssl = NULL;
+    if (!conn_open(&conn, &url, deadline))
+        return 0;
+
+    int reusable, gotany;
+    int ok = conn_exchange(&conn, &url, api_key, body, response, status, deadline,
+        0, &reusable, &gotany);
+    conn_close(&conn);
+    return ok;
+}
+
+/* A connection to keep between requests. */
+glk_llm_conn_t *gli_llm_conn_new(void)
+{
+    glk_llm_conn_t *conn = malloc(sizeof(glk_llm_conn_t));
+    if (!conn)
+        return NULL;
+    conn->sock = -1;
+    conn->ssl = NULL;
+    conn->target[0] = '\0';
+    conn->requests = 0;
+    return conn;
+}
+
+void gli_llm_conn_free(glk_llm_conn_t *conn)
+{
+    if (!conn)
+        return;
+    conn_close(conn);
+    free(conn);
+}
+
+/* As gli_llm_http_post(), but over conn, which is reused if it is
+   already open to the same endpoint. A server may close an idle
+   connection at any time; if a reused one fails before answering, the
+   request is tried once more on a new one. */
+int gli_llm_conn_post(glk_llm_conn_t *conn, const char *urlstr, const char *api_key, int timeout_ms,
+    glk_llm_body_t *body, glk_llm_strbuf_t *response, int *status)
+{
+    http_url_t url;
+
+    if (body->failed)
+        return 0;
+    if (!parse_url(urlstr, &url))
+        return 0;
+
+    double deadline = (timeout_ms > 0) ? gli_llm_now_ms() + timeout_ms : 0;
+
+    char target[400];
+    conn_target(&url, target, sizeof(target));
+    if (conn->sock >= 0 && strcmp(conn->target, target) != 0)
+        conn_close(conn);
+
+    int reusable, gotany;
+    if (conn->sock >= 0) {
+        set_socket_timeout(conn->sock, time_left(deadline));
+        int ok = conn_exchange(conn, &url, api_key, body, response, status, deadline,
+            1, &reusable, &gotany);
+        if (ok || gotany) {
+            if (!ok || !reusable)
+                conn_close(conn);
+            return ok;
+        }
+        conn_close(conn);
+        response->len = 0;
+    }
+
+    if (!conn_open(conn, &url, deadline))
+        return 0;
+    int ok = conn_exchange(conn, &url, api_key, body, response, status, deadline,
+        1, &reusable, &gotany);
+    if (!ok || !reusable)
+        conn_close(conn);
+    return ok;
+}
+
+/* Is conn open, and how many requests has it carried? */
+int gli_llm_conn_requests(glk_llm_conn_t *conn)
+{
+    return (conn->sock >= 0) ? conn->requests : 0;
+}
+
+/* Read exactly len bytes, or fail. */
+static int read_all(int sock, char *buf, size_t len, double deadline)
+{
+    while (len > 0) {
+        ssize_t got = read(sock, buf, len);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0 || past_deadline(deadline))
+            return 0;
+        buf += got;
+        len -= got;
+        set_socket_timeout(sock, time_left(deadline));
+    }
+    return 1;
+}
+
+static void put_word(unsigned char *p, glui32 val)
+{
+    p[0] = (val >> 24) & 0xFF;
+    p[1] = (val >> 16) & 0xFF;
+    p[2] = (val >> 8) & 0xFF;
+    p[3] = val & 0xFF;
+}
+
+static glui32 get_word(const unsigned char *p)
+{
+    return ((glui32)p[0] << 24) | ((glui32)p[1] << 16) | ((glui32)p[2] << 8) | p[3];
+}
+
+/* One request and its reply on an open broker connection. Returns 0
+   if the exchange didn't complete (the connection is then unusable);
+   otherwise *ok is the broker's verdict on the request. */
+static int broker_exchange(int sock, const char *url, const char *api_key, int timeout_ms,
+    double deadline, glk_llm_body_t *body, glk_llm_strbuf_t *response, int *status, int *ok)
+{
+    // A kept connection may carry the last request's timeout
+    set_socket_timeout(sock, (deadline > 0) ? time_left(deadline) : 0);
+
+    unsigned char header[20];
+    put_word(header, GLK_LLM_BROKER_MAGIC);
+    put_word(header + 4, (timeout_ms > 0) ? timeout_ms : 0);
+    put_word(header + 8, strlen(url));
+    put_word(header + 12, strlen(api_key));
+    put_word(header + 16, body->len);
+
+    int count = 3 + body->numpieces;
+    struct iovec *iov = malloc(count * sizeof(struct iovec));
+    if (!iov)
+        return 0;
+    iov[0].iov_base = header;
+    iov[0].iov_len = sizeof(header);
+    iov[1].iov_base = (void *)url;
+    iov[1].iov_len = strlen(url);
+    iov[2].iov_base = (void *)api_key;
+    iov[2].iov_len = strlen(api_key);
+    for (int ix = 0; ix < body->numpieces; ix++) {
+        iov[3+ix].iov_base = (void *)piece_ptr(body, &body->pieces[ix]);
+        iov[3+ix].iov_len = body->pieces[ix].len;
+    }
+    int sent = write_all_iov(sock, iov, count);
+    free(iov);
+
+    unsigned char reply[16];
+    if (!sent || !read_all(sock, (char *)reply, sizeof(reply), deadline)
+        || get_word(reply) != GLK_LLM_BROKER_MAGIC)
+        return 0;
+
+    glui32 len = get_word(reply + 12);
+    if (len > GLK_LLM_BROKER_MAX)
+        return 0;
+    char *buf = malloc(len + 1);
+    if (!buf || !read_all(sock, buf, len, deadline)) {
+        free(buf);
+        return 0;
+    }
+
+    response->len = 0;
+    gli_llm_strbuf_append(response, buf, len);
+    free(buf);
+    *ok = get_word(reply + 4);
+    if (status)
+        *status = get_word(reply + 8);
+    return 1;
+}
+
+/* The process's connection to the broker, kept open between requests. */
+static pthread_mutex_t broker_conn_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t broker_conn_once = PTHREAD_ONCE_INIT;
+static int broker_conn = -1;
+static char broker_conn_path[256];
+
+/* A forked child must not talk over its parent's connection. (If the
+   lock was held at the fork, the child just never uses the connection.) */
+static void broker_conn_forget(void)
+{
+    if (broker_conn >= 0)
+        close(broker_conn);
+    broker_conn = -1;
+}
+
+static void broker_conn_setup(void)
+{
+    pthread_atfork(NULL, NULL, broker_conn_forget);
+}
+
+/* Hand the request to a broker (glkllmbroker) listening on sockpath,
+   which makes it on our behalf. Same contract as gli_llm_http_post().
+
+   Requests go over one kept connection. If another thread is using it
+   (a background request, say), this one gets a connection of its own
+   rather than waiting its turn. */
+int gli_llm_broker_post(const char *sockpath, const char *url, const char *api_key, int timeout_ms,
+    glk_llm_body_t *body, glk_llm_strbuf_t *response, int *status)
+{
+    if (body->failed)
+        return 0;
+    if (body->len > GLK_LLM_BROKER_MAX)
+        return 0;
+
+    double deadline = (timeout_ms > 0) ? gli_llm_now_ms() + timeout_ms : 0;
+    int ok = 0;
+
+    pthread_once(&broker_conn_once, broker_conn_setup);
+    if (pthread_mutex_trylock(&broker_conn_lock) != 0) {
+        int sock = connect_unix(sockpath, deadline);
+        if (sock < 0)
+            return 0;
+        broker_exchange(sock, url, api_key, timeout_ms, deadline, body, response, status, &ok);
+        close(sock);
+        return ok;
+    }
+
+    if (broker_conn >= 0 && strcmp(broker_conn_path, sockpath) != 0)
+        broker_conn_forget();
+    for (int attempt = 0; attempt < 2; attempt++) {
+        int reused = (broker_conn >= 0);
+        if (!reused) {
+            broker_conn = connect_unix(sockpath, deadline);
+            if (broker_conn < 0)
+                break;
+            snprintf(broker_conn_path, sizeof(broker_conn_path), "%s", sockpath);
+        }
+        if (broker_exchange(broker_conn, url, api_key, timeout_ms, deadline, body, response, status, &ok))
+            break;
+        broker_conn_forget();
+        // A kept connection may have gone stale (the broker restarted,
+        // say); a fresh one gets one more try
+        if (!reused || past_deadline(deadline))
+            break;
+    }
+    pthread_mutex_unlock(&broker_conn_lock);
+    return ok;
+}
+
+/* Background requests. A job runs one request, through the given sender
+   function (normally gli_llm_send()), on its own thread. The job is
+   shared between that thread and the caller; whoever
+   lets go of it last frees it, so a caller can abandon a job that is
+   still in flight with gli_llm_job_release().
+*/
+
+struct glk_llm_job_struct {
+    glk_llm_sender_t sender;
+    pthread_mutex_t lock;
+    pthread_cond_t finished;    /* signalled when done is set */
+    int refs;
+    int done;
+    int ok;
+    int status;
+    char url[512];
+    char api_key[256];
+    int timeout_ms;
+    glk_llm_body_t body;
+    glk_llm_strbuf_t response;
+};
+
+static void job_unref(glk_llm_job_t *job)
+{
+    pthread_mutex_lock(&job->lock);
+    int refs = --job->refs;
+    pthread_mutex_unlock(&job->lock);
+
+    if (refs == 0) {
+        pthread_cond_destroy(&job->finished);
+        pthread_mutex_destroy(&job->lock);
+        gli_llm_body_free(&job->body);
+        gli_llm_strbuf_free(&job->response);
+        free(job);
+    }
+}
+
+static void *job_thread(void *rock)
+{
+    glk_llm_job_t *job = rock;
+    int status = 0;
+
+    int ok = job->sender(job->url, job->api_key, job->timeout_ms,
+        &job->body, &job->response, &status);
+
+    pthread_mutex_lock(&job->lock);
+    job->ok = ok;
+    job->status = status;
+    job->done = 1;
+    pthread_cond_broadcast(&job->finished);
+    pthread_mutex_unlock(&job->lock);
+
+    job_unref(job);
+    return NULL;
+}
+
+/* Start posting body to url in the background. The job takes over the
+   body; the caller's copy is left empty. Returns NULL if no thread could
+   be started (the body is freed in that case too). */
+glk_llm_job_t *gli_llm_job_start(glk_llm_sender_t sender,
+    const char *url, const char *api_key, int timeout_ms, glk_llm_body_t *body)
+{
+    glk_llm_job_t *job = malloc(sizeof(glk_llm_job_t));
+    if (!job) {
+        gli_llm_body_free(body);
+        return NULL;
+    }
+
+    job->sender = sender;
+    pthread_mutex_init(&job->lock, NULL);
+    pthread_cond_init(&job->finished, NULL);
+    job->refs = 2;
+    job->done = 0;
+    job->ok = 0;
+    job->status = 0;
+    strncpy(job->url, url, sizeof(job->url) - 1);
+    job->url[sizeof(job->url) - 1] = '\0';
+    strncpy(job->api_key, api_key, sizeof(job->api_key) - 1);
+    job->api_key[sizeof(job->api_key) - 1] = '\0';
+    job->timeout_ms = timeout_ms;
+    job->body = *body;
+    gli_llm_body_init(body);
+    gli_llm_strbuf_init(&job->response);
+
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int err = pthread_create(&thread, &attr, job_thread, job);
+    pthread_attr_destroy(&attr);
+
+    if (err) {
+        job->refs = 1;
+        job_unref(job);
+        return NULL;
+    }
+    return job;
+}
+
+/* Has the request finished (successfully or not)? */
+int gli_llm_job_done(glk_llm_job_t *job)
+{
+    pthread_mutex_lock(&job->lock);
+    int done = job->done;
+    pthread_mutex_unlock(&job->lock);
+    return done;
+}
+
+/* Wait up to timeout_ms for the job to finish (with no limit if
+   timeout_ms <= 0, as for requests). Returns whether it has. */
+int gli_llm_job_wait(glk_llm_job_t *job, int timeout_ms)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&job->lock);
+    int err = 0;
+    while (!job->done && err != ETIMEDOUT) {
+        if (timeout_ms > 0)
+            err = pthread_cond_timedwait(&job->finished, &job->lock, &deadline);
+        else
+            pthread_cond_wait(&job->finished, &job->lock);
+    }
+    int done = job->done;
+    pthread_mutex_unlock(&job->lock);
+    return done;
+}
+
+/* Once a job is done, hand back its response body. Returns 1 (and moves
+   the body into response) if the request succeeded. */
+int gli_llm_job_result(glk_llm_job_t *job, glk_llm_strbuf_t *response, int *status)
+{
+    if (!gli_llm_job_done(job) || !job->ok)
+        return 0;
+
+    *response = job->response;
+    gli_llm_strbuf_init(&job->response);
+    if (status)
+        *status = job->status;
+    return 1;
+}
+
+/* Drop the caller's interest in a job, finished or not. */
+void gli_llm_job_release(glk_llm_job_t *job)
+{
+    if (job)
+        job_unref(job);
+}
+
+#endif /* WASM_BUILD */
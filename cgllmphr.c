@@ -0,0 +1,679 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#ifndef WASM_BUILD
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "glk.h"
+#include "cheapglk.h"
+#include "glk_llm.h"
+
+/* Phrasebook: commands in other languages, translated without a model.
+   With phrasebook= naming a text file of phrases, one per line,
+
+       [sv]
+       ta, plocka upp = take
+       norr, norrut = north
+       en, ett =
+
+   an input made entirely of phrasebook phrases and words the game
+   itself has printed ("ta lampa", "plocka upp key") is rewritten phrase
+   by phrase ("take lamp"), and if the result is a plain command in the
+   game's words (see cgllmvoc.c) it goes straight to the game. A phrase
+   with nothing after the "=" is dropped (articles, mostly). Anything
+   that doesn't come apart this way goes to the model as usual.
+
+   The [language] lines only label the phrases that follow, for the log.
+   Phrases are matched longest first, up to the longest in the book;
+   upper-case ASCII and Latin-1 letters are folded to lower case on both
+   sides.
+
+   The text is compiled at startup into a perfect hash table, written
+   next to it as phrasebook.bin and mapped into memory, so a big book
+   costs nothing to open the second time and is shared between
+   processes. The compiled file is rebuilt whenever the text file's size
+   or modification time (to the nanosecond) changes. The table is "hash and displace": keys
+   are hashed into small buckets, and each bucket gets a seed that
+   scatters its keys into free slots of the main table; a lookup is two
+   hashes and one string compare.
+*/
+
+#define PHRASEBOOK_MAGIC "GLKPHRB2"
+#define PHRASEBOOK_EMPTY (0xFFFFFFFF)
+#define PHRASEBOOK_MAX_WORDS 16
+
+typedef struct {
+    char magic[8];
+    glui32 count;           /* phrases */
+    glui32 numslots;
+    glui32 numbuckets;
+    glui32 maxwords;        /* in the longest phrase */
+    glui32 poolsize;
+    glui32 source_mtime_ns;
+    uint64_t source_size;
+    uint64_t source_mtime;
+} phrasebook_header_t;
+
+/* The header is followed by glui32 seeds[numbuckets], glui32
+   slots[numslots] (pool offsets, or PHRASEBOOK_EMPTY), and the pool:
+   "phrase\0command\0language\0" for each phrase. */
+
+static const phrasebook_header_t *book = NULL;
+static size_t booklen = 0;
+static int book_mapped = 0;
+static const glui32 *book_seeds = NULL;
+static const glui32 *book_slots = NULL;
+static const char *book_pool = NULL;
+
+static struct {
+    int lookups;
+    int hits;
+} phrase_stats;
+
+static glk_llm_hash_t mix(glk_llm_hash_t hash)
+{
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+static glui32 slot_for(glk_llm_hash_t hash, glui32 seed, glui32 numslots)
+{
+    return mix(hash ^ (seed * 0x9e3779b97f4a7c15ULL)) % numslots;
+}
+
+/* Lower-case a UTF-8 string in place: ASCII, and the Latin-1 capitals
+   (two bytes, C3 80 to C3 9E). */
+static void fold_case(char *text)
+{
+    unsigned char *p = (unsigned char *)text;
+    for (; *p; p++) {
+        if (*p < 0x80)
+            *p = tolower(*p);
+        else if (*p == 0xC3 && p[1] >= 0x80 && p[1] <= 0x9E && p[1] != 0x97)
+            *++p += 0x20;
+    }
+}
+
+/* Split text into folded words. Letters are ASCII letters and digits,
+   apostrophes, hyphens, and anything non-ASCII. */
+static int split_words(const char *text, char words[][48], int max)
+{
+    int count = 0;
+    const unsigned char *p = (const unsigned char *)text;
+
+    while (*p && count < max) {
+        if (!isalnum(*p) && *p < 0x80 && *p != '\'' && *p != '-') {
+            p++;
+            continue;
+        }
+        size_t len = 0;
+        while (*p && (isalnum(*p) || *p >= 0x80 || *p == '\'' || *p == '-')) {
+            if (len < sizeof(words[0]) - 1)
+                words[count][len++] = *p;
+            p++;
+        }
+        words[count][len] = '\0';
+        fold_case(words[count]);
+        count++;
+    }
+    return count;
+}
+
+#ifndef WASM_BUILD
+
+/* A phrase from the text file, while compiling. */
+typedef struct {
+    char *phrase;
+    char *command;
+    int language;       /* index into the language names */
+    glk_llm_hash_t hash;
+} source_entry_t;
+
+typedef struct {
+    source_entry_t *entries;
+    int count;
+    int max;
+    glui32 *seen;       /* open-addressed entry index + 1, for duplicates */
+    glui32 seenmask;
+    char languages[32][16];
+    int numlanguages;
+} source_t;
+
+static void source_free(source_t *src)
+{
+    for (int ix = 0; ix < src->count; ix++) {
+        free(src->entries[ix].phrase);
+        free(src->entries[ix].command);
+    }
+    free(src->entries);
+    free(src->seen);
+    memset(src, 0, sizeof(*src));
+}
+
+/* The slot in the duplicate set for this phrase: either its entry's,
+   or the empty one where it would go. */
+static glui32 *source_seen(source_t *src, const char *norm, glk_llm_hash_t hash)
+{
+    glui32 slot = hash & src->seenmask;
+    while (src->seen[slot]) {
+        source_entry_t *entry = &src->entries[src->seen[slot] - 1];
+        if (entry->hash == hash && strcmp(entry->phrase, norm) == 0)
+            break;
+        slot = (slot + 1) & src->seenmask;
+    }
+    return &src->seen[slot];
+}
+
+/* Keep the duplicate set at most half full. */
+static int source_grow_seen(source_t *src)
+{
+    glui32 size = src->seen ? (src->seenmask + 1) * 2 : 1024;
+    glui32 *seen = calloc(size, sizeof(glui32));
+    if (!seen)
+        return 0;
+    free(src->seen);
+    src->seen = seen;
+    src->seenmask = size - 1;
+    for (int ix = 0; ix < src->count; ix++) {
+        glui32 slot = src->entries[ix].hash & src->seenmask;
+        while (seen[slot])
+            slot = (slot + 1) & src->seenmask;
+        seen[slot] = ix + 1;
+    }
+    return 1;
+}
+
+static char *trim(char *text)
+{
+    while (*text == ' ' || *text == '\t')
+        text++;
+    size_t len = strlen(text);
+    while (len && (text[len - 1] == ' ' || text[len - 1] == '\t'
+        || text[len - 1] == '\r' || text[len - 1] == '\n'))
+        text[--len] = '\0';
+    return text;
+}
+
+static void source_add(source_t *src, const char *phrase, const char *command, int language)
+{
+    char words[PHRASEBOOK_MAX_WORDS][48];
+    int count = split_words(phrase, words, PHRASEBOOK_MAX_WORDS);
+    if (!count)
+        return;
+
+    char norm[256] = "";
+    for (int ix = 0; ix < count; ix++) {
+        size_t used = strlen(norm);
+        snprintf(norm + used, sizeof(norm) - used, "%s%s", ix ? " " : "", words[ix]);
+    }
+    glk_llm_hash_t hash = gli_llm_hash_str(norm, 0);
+    if ((glui32)(src->count + 1) * 2 > (src->seen ? src->seenmask + 1 : 0)
+        && !source_grow_seen(src))
+        return;
+    glui32 *seen = source_seen(src, norm, hash);
+    if (*seen) {
+        gli_llm_log("phrasebook: \"%s\" listed twice; keeping the first", norm);
+        return;
+    }
+
+    if (src->count == src->max) {
+        int newmax = src->max ? src->max * 2 : 256;
+        source_entry_t *list = realloc(src->entries, newmax * sizeof(source_entry_t));
+        if (!list)
+            return;
+        src->entries = list;
+        src->max = newmax;
+    }
+    source_entry_t *entry = &src->entries[src->count];
+    entry->phrase = strdup(norm);
+    entry->command = strdup(command);
+    entry->language = language;
+    entry->hash = hash;
+    if (!entry->phrase || !entry->command) {
+        free(entry->phrase);
+        free(entry->command);
+        return;
+    }
+    src->count++;
+    *seen = src->count;
+}
+
+static int read_source(const char *filename, source_t *src)
+{
+    FILE *f = fopen(filename, "r");
+    if (!f)
+        return 0;
+
+    strcpy(src->languages[0], "");
+    src->numlanguages = 1;
+    int language = 0;
+    char line[1024];
+    while (fgets(line, sizeof(line), f)) {
+        char *text = trim(line);
+        if (!text[0] || text[0] == '#')
+            continue;
+        if (text[0] == '[') {
+            char *close = strchr(text, ']');
+            if (close && src->numlanguages < 32) {
+                *close = '\0';
+                language = src->numlanguages++;
+                snprintf(src->languages[language], sizeof(src->languages[0]), "%s", text + 1);
+            }
+            continue;
+        }
+
+        char *eq = strchr(text, '=');
+        if (!eq)
+            continue;
+        *eq = '\0';
+        char *command = trim(eq + 1);
+        fold_case(command);
+
+        // Alternatives: "norr, norrut = north"
+        char *phrase = strtok(text, ",");
+        while (phrase) {
+            source_add(src, phrase, command, language);
+            phrase = strtok(NULL, ",");
+        }
+    }
+    fclose(f);
+    return 1;
+}
+
+typedef struct {
+    glui32 size;
+    glui32 bucket;
+} bucket_order_t;
+
+/* Biggest first; ties in bucket order, so the image is reproducible. */
+static int compare_buckets(const void *a, const void *b)
+{
+    const bucket_order_t *ba = a;
+    const bucket_order_t *bb = b;
+    if (ba->size != bb->size)
+        return (ba->size > bb->size) ? -1 : 1;
+    return (ba->bucket > bb->bucket) - (ba->bucket < bb->bucket);
+}
+
+/* Build the compiled image in memory. Returns NULL if the seeds can't
+   be found (practically never) or memory runs out. */
+static phrasebook_header_t *compile(source_t *src, size_t *len)
+{
+    glui32 count = src->count;
+    glui32 numbuckets = count / 4 + 1;
+    glui32 numslots = count + count / 4 + 1;
+    glui32 maxwords = 1;
+
+    size_t poolsize = 0;
+    for (glui32 ix = 0; ix < count; ix++) {
+        source_entry_t *entry = &src->entries[ix];
+        poolsize += strlen(entry->phrase) + strlen(entry->command)
+            + strlen(src->languages[entry->language]) + 3;
+        glui32 words = 1;
+        for (const char *p = entry->phrase; *p; p++) {
+            if (*p == ' ')
+                words++;
+        }
+        if (words > maxwords)
+            maxwords = words;
+    }
+
+    size_t size = sizeof(phrasebook_header_t) + (numbuckets + numslots) * sizeof(glui32) + poolsize;
+    phrasebook_header_t *image = calloc(1, size);
+    glui32 *where = malloc((count + 1) * sizeof(glui32));
+    glui32 *bucket_of = malloc((count + 1) * sizeof(glui32));
+    glui32 *by_bucket = malloc((count + 1) * sizeof(glui32));
+    glui32 *start = calloc(numbuckets + 1, sizeof(glui32));
+    bucket_order_t *order = malloc(numbuckets * sizeof(bucket_order_t));
+    int ok = (image && where && bucket_of && by_bucket && start && order);
+
+    glui32 *seeds = NULL, *slots = NULL;
+    if (ok) {
+        memcpy(image->magic, PHRASEBOOK_MAGIC, 8);
+        image->count = count;
+        image->numslots = numslots;
+        image->numbuckets = numbuckets;
+        image->maxwords = maxwords;
+        image->poolsize = poolsize;
+        seeds = (glui32 *)(image + 1);
+        slots = seeds + numbuckets;
+        char *pool = (char *)(slots + numslots);
+
+        // The pool, and each phrase's bucket
+        size_t used = 0;
+        for (glui32 ix = 0; ix < count; ix++) {
+            source_entry_t *entry = &src->entries[ix];
+            where[ix] = used;
+            used += sprintf(pool + used, "%s", entry->phrase) + 1;
+            used += sprintf(pool + used, "%s", entry->command) + 1;
+            used += sprintf(pool + used, "%s", src->languages[entry->language]) + 1;
+            bucket_of[ix] = entry->hash % numbuckets;
+            start[bucket_of[ix] + 1]++;
+        }
+
+        // Each bucket's phrases together, in book order
+        for (glui32 ix = 0; ix < numbuckets; ix++) {
+            order[ix].size = start[ix + 1];
+            order[ix].bucket = ix;
+            start[ix + 1] += start[ix];
+        }
+        for (glui32 ix = 0; ix < count; ix++)
+            by_bucket[start[bucket_of[ix]]++] = ix;
+        for (glui32 ix = numbuckets; ix > 0; ix--)
+            start[ix] = start[ix - 1];
+        start[0] = 0;
+
+        // Biggest buckets first, while the table is emptiest
+        qsort(order, numbuckets, sizeof(bucket_order_t), compare_buckets);
+
+        for (glui32 ix = 0; ix < numslots; ix++)
+            slots[ix] = PHRASEBOOK_EMPTY;
+    }
+
+    glui32 tried[64];
+    for (glui32 ox = 0; ok && ox < numbuckets; ox++) {
+        glui32 bucket = order[ox].bucket;
+        glui32 nummembers = order[ox].size;
+        const glui32 *members = by_bucket + start[bucket];
+        if (!nummembers)
+            break;
+        if (nummembers >= 64) {
+            ok = 0;
+            break;
+        }
+
+        glui32 seed;
+        for (seed = 0; seed < (1u << 20); seed++) {
+            glui32 fits = 0;
+            for (; fits < nummembers; fits++) {
+                glui32 slot = slot_for(src->entries[members[fits]].hash, seed, numslots);
+                int taken = (slots[slot] != PHRASEBOOK_EMPTY);
+                for (glui32 jx = 0; jx < fits && !taken; jx++)
+                    taken = (tried[jx] == slot);
+                if (taken)
+                    break;
+                tried[fits] = slot;
+            }
+            if (fits == nummembers)
+                break;
+        }
+        if (seed == (1u << 20)) {
+            ok = 0;
+            break;
+        }
+        seeds[bucket] = seed;
+        for (glui32 jx = 0; jx < nummembers; jx++)
+            slots[tried[jx]] = where[members[jx]];
+    }
+
+    free(where);
+    free(bucket_of);
+    free(by_bucket);
+    free(start);
+    free(order);
+    if (!ok) {
+        free(image);
+        return NULL;
+    }
+    *len = size;
+    return image;
+}
+
+static char *binary_filename(const char *filename)
+{
+    char *res = malloc(strlen(filename) + 5);
+    if (res)
+        sprintf(res, "%s.bin", filename);
+    return res;
+}
+
+static const void *map_file(const char *filename, size_t *len)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    *len = st.st_size;
+    return map;
+}
+
+/* Does the mapped image hang together, and was it made from this
+   source? */
+static int image_valid(const phrasebook_header_t *image, size_t len, const struct stat *st)
+{
+    if (len < sizeof(phrasebook_header_t) || memcmp(image->magic, PHRASEBOOK_MAGIC, 8) != 0)
+        return 0;
+    if (image->source_size != (uint64_t)st->st_size || image->source_mtime != (uint64_t)st->st_mtime
+        || image->source_mtime_ns != (glui32)st->st_mtim.tv_nsec)
+        return 0;
+    size_t need = sizeof(phrasebook_header_t)
+        + ((size_t)image->numbuckets + image->numslots) * sizeof(glui32) + image->poolsize;
+    if (need != len || !image->numslots || !image->numbuckets)
+        return 0;
+    // lookup() runs string functions over the pool; it must end in a NUL
+    const char *pool = (const char *)image + len - image->poolsize;
+    return (image->poolsize > 0 && pool[image->poolsize - 1] == '\0');
+}
+
+static void use_image(const phrasebook_header_t *image, size_t len, int mapped)
+{
+    book = image;
+    booklen = len;
+    book_mapped = mapped;
+    book_seeds = (const glui32 *)(image + 1);
+    book_slots = book_seeds + image->numbuckets;
+    book_pool = (const char *)(book_slots + image->numslots);
+}
+
+int gli_llm_phrasebook_load(const char *filename)
+{
+    gli_llm_phrasebook_free();
+    if (!filename || !filename[0])
+        return 0;
+
+    struct stat st;
+    if (stat(filename, &st) < 0)
+        return 0;
+    char *binname = binary_filename(filename);
+    if (!binname)
+        return 0;
+
+    size_t len = 0;
+    const phrasebook_header_t *mapped = map_file(binname, &len);
+    if (mapped && image_valid(mapped, len, &st)) {
+        use_image(mapped, len, TRUE);
+        free(binname);
+        return 1;
+    }
+    if (mapped)
+        munmap((void *)mapped, len);
+
+    source_t src;
+    memset(&src, 0, sizeof(src));
+    if (!read_source(filename, &src)) {
+        free(binname);
+        return 0;
+    }
+    phrasebook_header_t *image = compile(&src, &len);
+    int count = src.count;
+    source_free(&src);
+    if (!image) {
+        free(binname);
+        return 0;
+    }
+    image->source_size = st.st_size;
+    image->source_mtime = st.st_mtime;
+    image->source_mtime_ns = st.st_mtim.tv_nsec;
+
+    // Written aside and renamed, so another game starting up never maps
+    // half a file
+    char *tmpname = malloc(strlen(binname) + 16);
+    int written = 0;
+    if (tmpname) {
+        sprintf(tmpname, "%s.%ld", binname, (long)getpid());
+        FILE *f = fopen(tmpname, "wb");
+        if (f) {
+            written = (fwrite(image, 1, len, f) == len);
+            written = (fclose(f) == 0) && written;
+            if (written)
+                written = (rename(tmpname, binname) == 0);
+            if (!written)
+                remove(tmpname);
+        }
+        free(tmpname);
+    }
+
+    mapped = written ? map_file(binname, &len) : NULL;
+    if (mapped && image_valid(mapped, len, &st)) {
+        free(image);
+        use_image(mapped, len, TRUE);
+    }
+    else {
+        // Can't write next to the text; keep the compiled copy in memory
+        if (mapped)
+            munmap((void *)mapped, len);
+        use_image(image, len, FALSE);
+    }
+    gli_llm_log("phrasebook: compiled %d phrases from %s", count, filename);
+    free(binname);
+    return 1;
+}
+
+void gli_llm_phrasebook_free(void)
+{
+    if (book) {
+        if (phrase_stats.lookups) {
+            gli_llm_log("phrasebook: lookups=%d translated=%d",
+                phrase_stats.lookups, phrase_stats.hits);
+        }
+        if (book_mapped)
+            munmap((void *)book, booklen);
+        else
+            free((void *)book);
+    }
+    book = NULL;
+    booklen = 0;
+    book_seeds = book_slots = NULL;
+    book_pool = NULL;
+    memset(&phrase_stats, 0, sizeof(phrase_stats));
+}
+
+#else /* WASM_BUILD */
+
+int gli_llm_phrasebook_load(const char *filename)
+{
+    return 0;
+}
+
+void gli_llm_phrasebook_free(void)
+{
+}
+
+#endif /* WASM_BUILD */
+
+/* The pool entry for a (folded, single-spaced) phrase, or NULL. The
+   command and language after it are checked to lie inside the pool. */
+static const char *lookup(const char *phrase)
+{
+    glk_llm_hash_t hash = gli_llm_hash_str(phrase, 0);
+    glui32 bucket = hash % book->numbuckets;
+    glui32 offset = book_slots[slot_for(hash, book_seeds[bucket], book->numslots)];
+    if (offset == PHRASEBOOK_EMPTY || offset >= book->poolsize)
+        return NULL;
+    const char *entry = book_pool + offset;
+    if (strcmp(entry, phrase) != 0)
+        return NULL;
+    const char *end = book_pool + book->poolsize;
+    const char *command = entry + strlen(entry) + 1;
+    if (command >= end || command + strlen(command) + 1 >= end)
+        return NULL;
+    return entry;
+}
+
+/* If input comes apart into phrasebook phrases and the game's own
+   words, and the result is a plain command, write it to output and
+   return 1. */
+int gli_llm_phrasebook_translate(const char *input, char *output, size_t len)
+{
+    if (!book || !book->count)
+        return 0;
+
+    char words[PHRASEBOOK_MAX_WORDS][48];
+    int count = split_words(input, words, PHRASEBOOK_MAX_WORDS);
+    if (!count || count == PHRASEBOOK_MAX_WORDS)
+        return 0;
+    phrase_stats.lookups++;
+
+    char result[256] = "", plain[256] = "";
+    const char *language = NULL;
+    int ix = 0, used = 0;
+    while (ix < count) {
+        // Longest phrase first
+        const char *entry = NULL;
+        int take = (int)book->maxwords;
+        if (take > count - ix)
+            take = count - ix;
+        for (; take > 0; take--) {
+            char phrase[256] = "";
+            for (int jx = ix; jx < ix + take; jx++) {
+                size_t pos = strlen(phrase);
+                snprintf(phrase + pos, sizeof(phrase) - pos, "%s%s", pos ? " " : "", words[jx]);
+            }
+            if ((entry = lookup(phrase)))
+                break;
+        }
+
+        const char *piece;
+        if (entry) {
+            ix += take;
+            piece = entry + strlen(entry) + 1;
+            if (!language || !language[0])
+                language = piece + strlen(piece) + 1;
+            used++;
+        }
+        else {
+            piece = words[ix++];
+        }
+        if (!piece[0])
+            continue;
+        size_t pos = strlen(result);
+        snprintf(result + pos, sizeof(result) - pos, "%s%s", pos ? " " : "", piece);
+    }
+
+    // Nothing was translated, or it was English already
+    for (int jx = 0; jx < count; jx++) {
+        size_t pos = strlen(plain);
+        snprintf(plain + pos, sizeof(plain) - pos, "%s%s", pos ? " " : "", words[jx]);
+    }
+    if (!used || !result[0] || strcmp(result, plain) == 0)
+        return 0;
+    if (!gli_llm_vocab_plain(result))
+        return 0;
+
+    strncpy(output, result, len - 1);
+    output[len - 1] = '\0';
+    phrase_stats.hits++;
+    gli_llm_log("phrasebook: \"%s\" -> \"%s\"%s%s%s", input, output,
+        (language && language[0]) ? " (" : "", language ? language : "",
+        (language && language[0]) ? ")" : "");
+    return 1;
+}
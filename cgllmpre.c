@@ -0,0 +1,290 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include "glk.h"
+#include "cheapglk.h"
+#include "glk_llm.h"
+
+/* Predictive prefetch. Players spend a few seconds reading each new
+   room before they type, and the network sits idle meanwhile. With
+   prefetch=1, as soon as the game asks for a command we ask the model,
+   in the background, what the player is likely to do next here and how
+   they might put it ("go to the bedroom" -> "n", "grab the key" ->
+   "take key"). The answers go into a phrase table for this turn only.
+
+   If the player's input is then close enough to one of the phrasings
+   (or to one of the commands itself), the command is used at once,
+   with no request at all. Anything else, including input typed before
+   the prefetch has come back, takes the normal path. A prefetched
+   command the game rejects is escalated to the model like a fast-tier
+   one.
+
+   Matching is on normalized text (lower case, no punctuation, no
+   articles), allowing an edit distance of one per eight characters.
+*/
+
+#define GLK_LLM_PREFETCH_MAX 32
+
+typedef struct {
+    char phrase[128];   /* normalized */
+    char command[128];
+} phrase_entry_t;
+
+static phrase_entry_t phrases[GLK_LLM_PREFETCH_MAX];
+static int numphrases = 0;
+static glui32 phrase_turn = 0;
+
+static struct {
+    int requests;
+    int lookups;
+    int hits;
+} prefetch_stats;
+
+/* Lower case, letters and digits only, single spaces, no articles. */
+static void normalize(const char *src, char *dest, size_t len)
+{
+    size_t pos = 0;
+    const char *p = src;
+
+    while (*p) {
+        while (*p && !isalnum((unsigned char)*p) && !((unsigned char)*p & 0x80))
+            p++;
+        const char *word = p;
+        while (*p && (isalnum((unsigned char)*p) || ((unsigned char)*p & 0x80)))
+            p++;
+        size_t wlen = p - word;
+        if (!wlen)
+            break;
+        if ((wlen == 3 && strncasecmp(word, "the", 3) == 0)
+            || (wlen == 2 && strncasecmp(word, "an", 2) == 0)
+            || (wlen == 1 && (word[0] == 'a' || word[0] == 'A')))
+            continue;
+        if (pos && pos < len - 1)
+            dest[pos++] = ' ';
+        for (size_t ix = 0; ix < wlen && pos < len - 1; ix++)
+            dest[pos++] = tolower((unsigned char)word[ix]);
+    }
+    dest[pos] = '\0';
+}
+
+/* Levenshtein distance, giving up once it must exceed limit. */
+static int edit_distance(const char *a, const char *b, int limit)
+{
+    int la = strlen(a), lb = strlen(b);
+    if (la - lb > limit || lb - la > limit)
+        return limit + 1;
+    if (lb >= 128)
+        return limit + 1;
+
+    int row[128];
+    for (int j = 0; j <= lb; j++)
+        row[j] = j;
+    for (int i = 1; i <= la; i++) {
+        int diag = row[0];
+        int best = row[0] = i;
+        for (int j = 1; j <= lb; j++) {
+            int up = row[j];
+            int cost = diag + (a[i - 1] != b[j - 1]);
+            if (up + 1 < cost)
+                cost = up + 1;
+            if (row[j - 1] + 1 < cost)
+                cost = row[j - 1] + 1;
+            row[j] = cost;
+            diag = up;
+            if (cost < best)
+                best = cost;
+        }
+        if (best > limit)
+            return limit + 1;
+    }
+    return row[lb];
+}
+
+static void add_phrase(const char *phrase, const char *command)
+{
+    if (numphrases >= GLK_LLM_PREFETCH_MAX)
+        return;
+    phrase_entry_t *entry = &phrases[numphrases];
+    normalize(phrase, entry->phrase, sizeof(entry->phrase));
+    strncpy(entry->command, command, sizeof(entry->command) - 1);
+    entry->command[sizeof(entry->command) - 1] = '\0';
+    if (!entry->phrase[0] || !entry->command[0])
+        return;
+    for (int ix = 0; ix < numphrases; ix++) {
+        if (strcmp(phrases[ix].phrase, entry->phrase) == 0)
+            return;
+    }
+    numphrases++;
+}
+
+#ifndef WASM_BUILD
+
+static glk_llm_job_t *prefetch_job = NULL;
+static glui32 job_turn = 0;
+
+/* Each entry is "phrasing => command". */
+static void harvest(void)
+{
+    if (!prefetch_job || !gli_llm_job_done(prefetch_job))
+        return;
+
+    glk_llm_strbuf_t response;
+    if (gli_llm_job_result(prefetch_job, &response, NULL) && job_turn == gli_llm_context.turn) {
+        char *content = gli_llm_json_string(response.buf, "content");
+        if (content) {
+            char list[GLK_LLM_PREFETCH_MAX][256];
+            int count = gli_llm_json_string_array(content, "phrases",
+                &list[0][0], sizeof(list[0]), GLK_LLM_PREFETCH_MAX);
+            for (int ix = 0; ix < count; ix++) {
+                char *arrow = strstr(list[ix], "=>");
+                if (!arrow)
+                    continue;
+                *arrow = '\0';
+                char *command = arrow + 2;
+                while (*command == ' ')
+                    command++;
+                size_t clen = strlen(command);
+                while (clen && command[clen - 1] == ' ')
+                    command[--clen] = '\0';
+                // A made-up word would only waste a turn; leave those
+                // inputs to the model
+                char unknown[128] = "";
+                if (!gli_llm_vocab_check(command, unknown, sizeof(unknown))) {
+                    gli_llm_log("prefetch: dropping \"%s\" (unknown: %s)", command, unknown);
+                    continue;
+                }
+                add_phrase(list[ix], command);
+                add_phrase(command, command);
+            }
+            phrase_turn = job_turn;
+            gli_llm_log("prefetch: %d phrases", numphrases);
+            free(content);
+        }
+        gli_llm_strbuf_free(&response);
+    }
+
+    gli_llm_job_release(prefetch_job);
+    prefetch_job = NULL;
+}
+
+/* Called when the game asks for a command: forget the last turn's
+   phrases and start asking about this one. */
+void gli_llm_prefetch_start(void)
+{
+    if (prefetch_job) {
+        gli_llm_job_release(prefetch_job);
+        prefetch_job = NULL;
+    }
+    numphrases = 0;
+
+    if (!gli_llm_config.enabled || !gli_llm_config.prefetch || !gli_llm_backend_ready())
+        return;
+    if (gli_llm_context.queue_count > 0)
+        return;
+
+    // The fast tier, if there is one, is good enough for guessing
+    const char *endpoint = gli_llm_config.api_endpoint;
+    const char *api_key = gli_llm_config.api_key;
+    const char *model = gli_llm_config.model;
+    if (gli_llm_config.fast_endpoint[0])
+        endpoint = gli_llm_config.fast_endpoint;
+    if (gli_llm_config.fast_api_key[0])
+        api_key = gli_llm_config.fast_api_key;
+    if (gli_llm_config.fast_model[0])
+        model = gli_llm_config.fast_model;
+
+    glk_llm_strbuf_t output;
+    gli_llm_strbuf_init(&output);
+    gli_llm_recent_output(&output);
+
+    glk_llm_body_t body;
+    gli_llm_body_init(&body);
+    BODY_LITERAL(&body, "{\"model\":\"");
+    gli_llm_body_json(&body, model[0] ? model : "gpt-3.5-turbo");
+    BODY_LITERAL(&body, "\",\"messages\":[{\"role\":\"system\",\"content\":\""
+        "You are helping a player of a parser-based text adventure. From the game "
+        "output below, predict the commands the player is most likely to enter next. "
+        "For each, give two or three short ways a player might phrase it in plain "
+        "English, each followed by => and the exact game command, e.g. "
+        "\\\"go to the bedroom => north\\\", \\\"grab the key => take key\\\". "
+        "Use only objects and exits mentioned in the output. "
+        "Answer as JSON: {\\\"phrases\\\":[\\\"phrasing => command\\\", ...]}\\n\\n"
+        "Game output:\\n");
+    gli_llm_body_json(&body, output.buf ? output.buf : "");
+    BODY_LITERAL(&body, "\"}],");
+    gli_llm_body_schema(&body, "phrases",
+        "{\"type\":\"array\",\"items\":{\"type\":\"string\"},\"maxItems\":32}");
+    gli_llm_body_options(&body);
+    BODY_LITERAL(&body, "\"max_tokens\":400,\"temperature\":0.3}");
+    gli_llm_strbuf_free(&output);
+
+    prefetch_job = gli_llm_job_start(gli_llm_send, endpoint, api_key,
+        gli_llm_config.timeout_ms, &body);
+    job_turn = gli_llm_context.turn;
+    if (prefetch_job)
+        prefetch_stats.requests++;
+}
+
+/* Called from gli_llm_exit(). */
+void gli_llm_prefetch_stop(void)
+{
+    if (prefetch_job) {
+        gli_llm_job_release(prefetch_job);
+        prefetch_job = NULL;
+    }
+    if (prefetch_stats.requests) {
+        gli_llm_log("prefetch: requests=%d lookups=%d hits=%d",
+            prefetch_stats.requests, prefetch_stats.lookups, prefetch_stats.hits);
+    }
+}
+
+#else /* WASM_BUILD */
+
+static void harvest(void)
+{
+}
+
+void gli_llm_prefetch_start(void)
+{
+}
+
+void gli_llm_prefetch_stop(void)
+{
+}
+
+#endif /* WASM_BUILD */
+
+/* If input is close to a prefetched phrasing for this turn, copy the
+   command to output and return 1. Never waits for the prefetch. */
+int gli_llm_prefetch_match(const char *input, char *output, size_t len)
+{
+    harvest();
+    if (!numphrases || phrase_turn != gli_llm_context.turn)
+        return 0;
+
+    char norm[128];
+    normalize(input, norm, sizeof(norm));
+    if (!norm[0])
+        return 0;
+    prefetch_stats.lookups++;
+
+    int limit = strlen(norm) / 8;
+    int best = -1, bestdist = limit + 1;
+    for (int ix = 0; ix < numphrases && bestdist > 0; ix++) {
+        int dist = edit_distance(norm, phrases[ix].phrase, limit);
+        if (dist < bestdist) {
+            bestdist = dist;
+            best = ix;
+        }
+    }
+    if (best < 0)
+        return 0;
+
+    strncpy(output, phrases[best].command, len - 1);
+    output[len - 1] = '\0';
+    prefetch_stats.hits++;
+    gli_llm_log("prefetch: \"%s\" -> \"%s\" (distance %d)", input, output, bestdist);
+    return 1;
+}
@@ -0,0 +1,377 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include "glk.h"
+#include "cheapglk.h"
+#include "glk_llm.h"
+
+/* Recall of earlier output. The prompt only carries the last few lines,
+   so the note read ten rooms ago, or what the old man said to do, is
+   gone by the time it matters. With recall=N, the output of every turn
+   is kept as a passage (headed by the command that produced it) in an
+   inverted index, and for each input the N passages that best match it
+   under BM25 are put into the prompt, in the {{recalled}} slot, as long
+   as they fit in recall_tokens. Passages still within the recent output
+   are left out; they are in the prompt already.
+
+   The index grows a turn at a time: when a turn ends, its passage is
+   split into terms and each term gets one posting (passage, count). A
+   search walks only the postings of the input's terms. Terms are
+   lower-case words of two letters or more, less a plural "s", and
+   without the commonest English words.
+*/
+
+#define RECALL_PASSAGE_MAX 1024
+#define RECALL_K1 (1.2)
+#define RECALL_B (0.75)
+
+typedef struct {
+    char *text;
+    int length;         /* in terms */
+    glui32 turn;
+} recall_passage_t;
+
+typedef struct {
+    int passage;
+    int count;
+} recall_posting_t;
+
+typedef struct {
+    char *word;
+    glk_llm_hash_t hash;
+    recall_posting_t *postings;
+    int numpostings;
+    int maxpostings;
+} recall_term_t;
+
+static recall_passage_t *passages = NULL;
+static int numpassages = 0;
+static int maxpassages = 0;
+static long totallength = 0;
+
+static recall_term_t *terms = NULL;
+static int numterms = 0;
+static int maxterms = 0;
+
+static int *term_slots = NULL;      /* term index, or -1 */
+static size_t numslots = 0;
+
+/* The turn being collected. */
+static glk_llm_strbuf_t open_text;
+static int open_lines = 0;
+
+static struct {
+    int searches;
+    int recalled;
+} recall_stats;
+
+static const char *stop_words[] = {
+    "the", "a", "an", "and", "or", "but", "of", "to", "in", "on", "at", "by",
+    "for", "with", "from", "into", "onto", "is", "are", "was", "were", "be",
+    "been", "it", "its", "this", "that", "these", "those", "you", "your",
+    "he", "she", "they", "them", "his", "her", "their", "there", "here",
+    "as", "so", "if", "then", "than", "can", "not", "no", "do", "does",
+    "have", "has", "had", "what", "which", "who", "me", "my", "i", "we",
+    "all", "some", "any", "up", "down", "out", "about", "will", "would",
+    NULL
+};
+
+static int is_stop_word(const char *word)
+{
+    for (int ix = 0; stop_words[ix]; ix++) {
+        if (strcmp(stop_words[ix], word) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+/* Split text into terms. Returns the number found. */
+static int split_terms(const char *text, char terms_out[][24], int max)
+{
+    int count = 0;
+    const char *p = text;
+
+    while (*p && count < max) {
+        while (*p && !isalnum((unsigned char)*p))
+            p++;
+        if (!*p)
+            break;
+        char word[24];
+        size_t len = 0;
+        while (*p && isalnum((unsigned char)*p)) {
+            if (len < sizeof(word) - 1)
+                word[len++] = tolower((unsigned char)*p);
+            p++;
+        }
+        word[len] = '\0';
+        if (len > 3 && word[len - 1] == 's' && word[len - 2] != 's')
+            word[--len] = '\0';
+        if (len < 2 || is_stop_word(word))
+            continue;
+        strcpy(terms_out[count++], word);
+    }
+    return count;
+}
+
+static int find_term(const char *word, glk_llm_hash_t hash, int create)
+{
+    if (!numslots) {
+        if (!create)
+            return -1;
+        term_slots = malloc(4096 * sizeof(int));
+        if (!term_slots)
+            return -1;
+        numslots = 4096;
+        for (size_t ix = 0; ix < numslots; ix++)
+            term_slots[ix] = -1;
+    }
+
+    size_t ix = hash & (numslots - 1);
+    for (; term_slots[ix] >= 0; ix = (ix + 1) & (numslots - 1)) {
+        recall_term_t *term = &terms[term_slots[ix]];
+        if (term->hash == hash && strcmp(term->word, word) == 0)
+            return term_slots[ix];
+    }
+    if (!create)
+        return -1;
+
+    if (numterms == maxterms) {
+        int newmax = maxterms ? maxterms * 2 : 1024;
+        recall_term_t *list = realloc(terms, newmax * sizeof(recall_term_t));
+        if (!list)
+            return -1;
+        terms = list;
+        maxterms = newmax;
+    }
+    recall_term_t *term = &terms[numterms];
+    memset(term, 0, sizeof(*term));
+    term->word = strdup(word);
+    if (!term->word)
+        return -1;
+    term->hash = hash;
+    term_slots[ix] = numterms++;
+
+    // Keep the table under 70% full
+    if ((size_t)numterms * 10 > numslots * 7) {
+        size_t newsize = numslots * 2;
+        int *table = malloc(newsize * sizeof(int));
+        if (table) {
+            for (size_t jx = 0; jx < newsize; jx++)
+                table[jx] = -1;
+            for (int id = 0; id < numterms; id++) {
+                size_t kx = terms[id].hash & (newsize - 1);
+                while (table[kx] >= 0)
+                    kx = (kx + 1) & (newsize - 1);
+                table[kx] = id;
+            }
+            free(term_slots);
+            term_slots = table;
+            numslots = newsize;
+        }
+    }
+    return numterms - 1;
+}
+
+static void add_posting(int id, int passage)
+{
+    recall_term_t *term = &terms[id];
+    if (term->numpostings && term->postings[term->numpostings - 1].passage == passage) {
+        term->postings[term->numpostings - 1].count++;
+        return;
+    }
+    if (term->numpostings == term->maxpostings) {
+        int newmax = term->maxpostings ? term->maxpostings * 2 : 4;
+        recall_posting_t *list = realloc(term->postings, newmax * sizeof(recall_posting_t));
+        if (!list)
+            return;
+        term->postings = list;
+        term->maxpostings = newmax;
+    }
+    term->postings[term->numpostings].passage = passage;
+    term->postings[term->numpostings].count = 1;
+    term->numpostings++;
+}
+
+/* A line of game output, for the passage of the current turn. Called
+   from gli_llm_add_context(). */
+void gli_llm_recall_add_output(const char *text)
+{
+    if (gli_llm_config.recall <= 0)
+        return;
+    if (!open_text.buf) {
+        gli_llm_strbuf_init(&open_text);
+        // Head the passage with the command that led to it
+        const char *command = gli_llm_sent_command();
+        if (gli_llm_context.turn > 0 && command[0]) {
+            gli_llm_strbuf_append_str(&open_text, "> ");
+            gli_llm_strbuf_append_str(&open_text, command);
+            gli_llm_strbuf_append_str(&open_text, "\n");
+        }
+    }
+    if (open_text.len + strlen(text) + 1 > RECALL_PASSAGE_MAX)
+        return;
+    gli_llm_strbuf_append_str(&open_text, text);
+    gli_llm_strbuf_append_str(&open_text, "\n");
+    open_lines++;
+}
+
+/* The turn is over: index its passage. Called from gli_llm_new_turn(). */
+void gli_llm_recall_end_turn(void)
+{
+    if (!open_text.buf)
+        return;
+    if (!open_lines) {
+        gli_llm_strbuf_free(&open_text);
+        return;
+    }
+
+    if (numpassages == maxpassages) {
+        int newmax = maxpassages ? maxpassages * 2 : 256;
+        recall_passage_t *list = realloc(passages, newmax * sizeof(recall_passage_t));
+        if (!list) {
+            gli_llm_strbuf_free(&open_text);
+            open_lines = 0;
+            return;
+        }
+        passages = list;
+        maxpassages = newmax;
+    }
+
+    int id = numpassages++;
+    recall_passage_t *passage = &passages[id];
+    passage->text = open_text.buf;      /* the buffer is handed over */
+    passage->turn = gli_llm_context.turn;
+    passage->length = 0;
+    gli_llm_strbuf_init(&open_text);
+    open_lines = 0;
+
+    char words[256][24];
+    int count = split_terms(passage->text, words, 256);
+    for (int ix = 0; ix < count; ix++) {
+        int term = find_term(words[ix], gli_llm_hash_str(words[ix], 0), TRUE);
+        if (term >= 0)
+            add_posting(term, id);
+    }
+    passage->length = count;
+    totallength += count;
+}
+
+/* Append to sb the earlier passages most relevant to input, oldest
+   first, within the token budget. Passages from since_turn on are left
+   out. */
+void gli_llm_recall(const char *input, glui32 since_turn, glk_llm_strbuf_t *sb)
+{
+    int wanted = gli_llm_config.recall;
+    if (wanted <= 0 || !numpassages)
+        return;
+    if (wanted > 16)
+        wanted = 16;
+
+    char words[32][24];
+    int count = split_terms(input, words, 32);
+    if (!count)
+        return;
+
+    double *scores = calloc(numpassages, sizeof(double));
+    if (!scores)
+        return;
+    recall_stats.searches++;
+
+    double avglength = (double)totallength / numpassages;
+    for (int ix = 0; ix < count; ix++) {
+        int dup = 0;
+        for (int jx = 0; jx < ix; jx++) {
+            if (strcmp(words[jx], words[ix]) == 0)
+                dup = 1;
+        }
+        int id = dup ? -1 : find_term(words[ix], gli_llm_hash_str(words[ix], 0), FALSE);
+        if (id < 0)
+            continue;
+
+        recall_term_t *term = &terms[id];
+        double df = term->numpostings;
+        double idf = log(1.0 + (numpassages - df + 0.5) / (df + 0.5));
+        for (int px = 0; px < term->numpostings; px++) {
+            recall_posting_t *post = &term->postings[px];
+            double tf = post->count;
+            double norm = 1.0 - RECALL_B + RECALL_B * passages[post->passage].length / avglength;
+            scores[post->passage] += idf * tf * (RECALL_K1 + 1.0) / (tf + RECALL_K1 * norm);
+        }
+    }
+
+    // The best few, then whatever of those fits the budget
+    int chosen[16];
+    int numchosen = 0;
+    for (int id = 0; id < numpassages; id++) {
+        if (scores[id] <= 0.0 || (int)(passages[id].turn - since_turn) >= 0)
+            continue;
+        int pos = numchosen;
+        while (pos > 0 && scores[chosen[pos - 1]] < scores[id])
+            pos--;
+        if (pos >= wanted)
+            continue;
+        int last = (numchosen < wanted) ? numchosen : wanted - 1;
+        for (int jx = last; jx > pos; jx--)
+            chosen[jx] = chosen[jx - 1];
+        chosen[pos] = id;
+        if (numchosen < wanted)
+            numchosen++;
+    }
+
+    int keep[16];
+    int numkeep = 0;
+    size_t budget = (gli_llm_config.recall_tokens > 0) ? (size_t)gli_llm_config.recall_tokens : 0;
+    size_t spent = 0;
+    for (int ix = 0; ix < numchosen; ix++) {
+        size_t cost = gli_llm_count_tokens_str(passages[chosen[ix]].text) + 1;
+        if (budget && spent + cost > budget)
+            continue;
+        spent += cost;
+        keep[numkeep++] = chosen[ix];
+    }
+    free(scores);
+
+    // Passage ids are in turn order
+    for (int ix = 1; ix < numkeep; ix++) {
+        int id = keep[ix], jx = ix;
+        for (; jx > 0 && keep[jx - 1] > id; jx--)
+            keep[jx] = keep[jx - 1];
+        keep[jx] = id;
+    }
+    for (int ix = 0; ix < numkeep; ix++) {
+        if (ix)
+            gli_llm_strbuf_append_str(sb, "\n");
+        gli_llm_strbuf_append_str(sb, passages[keep[ix]].text);
+    }
+    recall_stats.recalled += numkeep;
+}
+
+/* Called from gli_llm_exit(). */
+void gli_llm_recall_free(void)
+{
+    if (recall_stats.searches) {
+        gli_llm_log("recall: passages=%d terms=%d searches=%d recalled=%d",
+            numpassages, numterms, recall_stats.searches, recall_stats.recalled);
+    }
+    for (int ix = 0; ix < numpassages; ix++)
+        free(passages[ix].text);
+    free(passages);
+    passages = NULL;
+    numpassages = maxpassages = 0;
+    totallength = 0;
+    for (int ix = 0; ix < numterms; ix++) {
+        free(terms[ix].word);
+        free(terms[ix].postings);
+    }
+    free(terms);
+    terms = NULL;
+    numterms = maxterms = 0;
+    free(term_slots);
+    term_slots = NULL;
+    numslots = 0;
+    gli_llm_strbuf_free(&open_text);
+    open_lines = 0;
+    memset(&recall_stats, 0, sizeof(recall_stats));
+}
@@ -0,0 +1,368 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "glk.h"
+#include "cheapglk.h"
+#include "glk_llm.h"
+
+/* Pronoun resolution. "take it", "open them" and "examine her" are a
+   large share of inputs, and the model is only needed to put a noun in
+   place of the pronoun. With pronouns=1 we keep track of what the
+   pronouns could mean, and substitute locally when the answer is clear:
+
+   - the thing (or things) the last accepted command acted on;
+   - the things the game mentioned in its answer to it ("a brass lamp",
+     "the door"), found by looking for articles in the output;
+   - the last man and woman mentioned or acted on, recognised by a
+     short list of nouns ("man", "guard", "queen", ...).
+
+   "it" means the last thing acted on if the game's answer mentioned
+   nothing else, or the one thing the answer mentioned. "them" means
+   the things of a plural command, or the one list in the answer ("a
+   red key and a brass key"). When the candidates disagree
+   ("You open the box, revealing a pistol." -- the box, or the
+   pistol?), the input goes to the model as usual. "her" followed by a
+   noun is a possessive and is left to the model too.
+
+   Only short inputs starting with a standard verb are answered this
+   way, so "could you pick it up" still goes to the model.
+*/
+
+#define REF_MAX_MENTIONS 8
+#define REF_PHRASE 64
+
+static char acted[REF_PHRASE];          /* singular object of the last command */
+static char acted_plural[REF_PHRASE * 2];
+static char person_him[REF_PHRASE];
+static char person_her[REF_PHRASE];
+
+/* The objects mentioned in the game's last answer. Objects listed
+   together ("a red key and a brass key") share a group number. */
+static char mentions[REF_MAX_MENTIONS][REF_PHRASE];
+static int mention_groups[REF_MAX_MENTIONS];
+static int nummentions = 0;
+static int numgroups = 0;
+
+static const char *male_nouns[] = {
+    "man", "boy", "king", "prince", "lord", "gentleman", "sir", "father",
+    "brother", "husband", "son", "uncle", "monk", "priest", "wizard",
+    "waiter", "butler", "guard", "soldier", "knight", "mr", NULL
+};
+
+static const char *female_nouns[] = {
+    "woman", "girl", "queen", "princess", "lady", "madam", "mother",
+    "sister", "wife", "daughter", "aunt", "nun", "witch", "waitress",
+    "maid", "mrs", "ms", "miss", NULL
+};
+
+static const char *directions[] = {
+    "north", "south", "east", "west", "northeast", "northwest", "southeast",
+    "southwest", "up", "down", "inside", "outside", NULL
+};
+
+/* Words that end a noun phrase in the game's prose. */
+static const char *phrase_stops[] = {
+    "is", "are", "was", "were", "be", "been", "has", "have", "had", "lies",
+    "lie", "sits", "sit", "stands", "stand", "leads", "lead", "hangs",
+    "hang", "rests", "here", "there", "which", "that", "who", "whose",
+    "with", "and", "or", "but", "of", "in", "on", "to", "from", "into",
+    "onto", "under", "behind", "near", "by", "as", "at", "for", "you",
+    "it", NULL
+};
+
+/* Words that are not an object to refer back to. */
+static const char *not_objects[] = {
+    "it", "them", "him", "her", "me", "myself", "all", "everything", NULL
+};
+
+/* Prepositions that end the direct object of a command. */
+static const char *command_stops[] = {
+    "in", "on", "into", "onto", "to", "with", "from", "under", "behind",
+    "at", "about", "through", "over", "off", "up", "down", NULL
+};
+
+static int in_list(const char **list, const char *word)
+{
+    for (int ix = 0; list[ix]; ix++) {
+        if (strcmp(list[ix], word) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+static int is_article(const char *word)
+{
+    return (strcmp(word, "a") == 0 || strcmp(word, "an") == 0
+        || strcmp(word, "the") == 0 || strcmp(word, "some") == 0);
+}
+
+/* Split text into lower-case words. Punctuation between words is
+   returned as a word of its own (a phrase boundary). */
+static int split_tokens(const char *text, char tokens[][24], int max)
+{
+    int count = 0;
+    const char *p = text;
+
+    while (*p && count < max) {
+        if (*p == ' ' || *p == '\t' || *p == '"' || *p == '\'') {
+            p++;
+            continue;
+        }
+        if (!isalnum((unsigned char)*p)) {
+            tokens[count][0] = ',';
+            tokens[count][1] = '\0';
+            count++;
+            p++;
+            continue;
+        }
+        size_t len = 0;
+        while (*p && (isalnum((unsigned char)*p) || *p == '-')) {
+            if (len < sizeof(tokens[0]) - 1)
+                tokens[count][len++] = tolower((unsigned char)*p);
+            p++;
+        }
+        tokens[count][len] = '\0';
+        count++;
+    }
+    return count;
+}
+
+static void join_words(char *dest, size_t len, char tokens[][24], int from, int to)
+{
+    dest[0] = '\0';
+    for (int ix = from; ix < to; ix++) {
+        size_t used = strlen(dest);
+        snprintf(dest + used, len - used, "%s%s", used ? " " : "", tokens[ix]);
+    }
+}
+
+/* Note a phrase as a person, if its head noun says which ("the old
+   man", up to the noun). Returns 1 if it was. */
+static int note_person(char tokens[][24], int from, int to)
+{
+    for (int ix = from; ix < to; ix++) {
+        if (in_list(male_nouns, tokens[ix])) {
+            join_words(person_him, sizeof(person_him), tokens, from, ix + 1);
+            return 1;
+        }
+        if (in_list(female_nouns, tokens[ix])) {
+            join_words(person_her, sizeof(person_her), tokens, from, ix + 1);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Collect the noun phrases in a line of output: an article and up to
+   three words after it. */
+static void scan_line(const char *text)
+{
+    char tokens[64][24];
+    int count = split_tokens(text, tokens, 64);
+    int listed = 0;
+
+    for (int ix = 0; ix < count; ix++) {
+        if (!is_article(tokens[ix]))
+            continue;
+        int start = ix + 1, end = start;
+        while (end < count && end - start < 3 && tokens[end][0] != ','
+            && !is_article(tokens[end]) && !in_list(phrase_stops, tokens[end]))
+            end++;
+        if (end == start)
+            continue;
+
+        int group = listed ? numgroups : ++numgroups;
+        // ", a brass key" or "and a brass key" continues a list
+        int next = end;
+        while (next < count && (tokens[next][0] == ',' || strcmp(tokens[next], "and") == 0))
+            next++;
+        listed = (next > end && next < count && is_article(tokens[next]));
+        ix = end - 1;
+
+        if (note_person(tokens, start, end))
+            continue;
+        if (end - start == 1 && in_list(directions, tokens[start]))
+            continue;
+
+        char phrase[REF_PHRASE];
+        join_words(phrase, sizeof(phrase), tokens, start, end);
+        int dup = 0;
+        for (int jx = 0; jx < nummentions; jx++) {
+            if (strcmp(mentions[jx], phrase) == 0)
+                dup = 1;
+        }
+        if (!dup && nummentions < REF_MAX_MENTIONS) {
+            strcpy(mentions[nummentions], phrase);
+            mention_groups[nummentions] = group;
+            nummentions++;
+        }
+    }
+}
+
+/* Take the objects of an accepted command. */
+static void scan_command(const char *command)
+{
+    char tokens[32][24];
+    int count = split_tokens(command, tokens, 32);
+    if (count < 2 || !gli_llm_vocab_is_verb(tokens[0]))
+        return;
+    // "go north" acts on nothing
+    if (strcmp(tokens[0], "go") == 0 || strcmp(tokens[0], "walk") == 0
+        || strcmp(tokens[0], "run") == 0)
+        return;
+
+    char objects[4][REF_PHRASE];
+    int numobjects = 0;
+    int start = 1;
+    for (int ix = 1; ix <= count && numobjects < 4; ix++) {
+        int boundary = (ix == count || tokens[ix][0] == ',' || strcmp(tokens[ix], "and") == 0
+            || in_list(command_stops, tokens[ix]));
+        if (!boundary)
+            continue;
+        int from = start;
+        while (from < ix && (is_article(tokens[from]) || strcmp(tokens[from], "my") == 0))
+            from++;
+        if (from < ix) {
+            join_words(objects[numobjects], sizeof(objects[0]), tokens, from, ix);
+            if (note_person(tokens, from, ix))
+                return;
+            if (!in_list(not_objects, objects[numobjects]))
+                numobjects++;
+        }
+        start = ix + 1;
+        // Only the direct object
+        if (ix < count && in_list(command_stops, tokens[ix]))
+            break;
+    }
+
+    if (numobjects == 1) {
+        strcpy(acted, objects[0]);
+    }
+    else if (numobjects > 1) {
+        acted_plural[0] = '\0';
+        for (int ix = 0; ix < numobjects; ix++) {
+            size_t used = strlen(acted_plural);
+            snprintf(acted_plural + used, sizeof(acted_plural) - used, "%s%s",
+                ix ? " and " : "", objects[ix]);
+        }
+    }
+}
+
+/* Called when the game asks for a line: take in the last command and
+   the game's answer to it. */
+void gli_llm_ref_settle(int rejected)
+{
+    if (!gli_llm_config.pronouns)
+        return;
+
+    nummentions = numgroups = 0;
+    if (rejected)
+        return;
+
+    scan_command(gli_llm_sent_command());
+
+    // The lines of the turn that has just ended
+    glui32 last = gli_llm_context.turn - 1;
+    for (int n = gli_llm_context.count; n > 0; n--) {
+        int idx = (gli_llm_context.position - n + 2 * GLK_LLM_CONTEXT_LINES) % GLK_LLM_CONTEXT_LINES;
+        if (gli_llm_context.line_turns[idx] != last)
+            continue;
+        if (gli_llm_is_room_header(gli_llm_context.lines[idx]))
+            continue;
+        scan_line(gli_llm_context.lines[idx]);
+    }
+}
+
+static const char *resolve_it(void)
+{
+    if (nummentions == 0)
+        return acted[0] ? acted : NULL;
+    if (nummentions == 1 && (!acted[0] || strcmp(acted, mentions[0]) == 0))
+        return mentions[0];
+    return NULL;
+}
+
+/* The things of a plural command, or the one list the game gave. */
+static const char *resolve_them(char *buf, size_t len)
+{
+    if (nummentions == 0)
+        return acted_plural[0] ? acted_plural : NULL;
+
+    int found = 0;
+    for (int group = 1; group <= numgroups; group++) {
+        int members = 0;
+        for (int ix = 0; ix < nummentions; ix++) {
+            if (mention_groups[ix] == group)
+                members++;
+        }
+        if (members < 2)
+            continue;
+        if (found)
+            return NULL;
+        found = group;
+    }
+    if (!found)
+        return NULL;
+
+    buf[0] = '\0';
+    for (int ix = 0; ix < nummentions; ix++) {
+        if (mention_groups[ix] != found)
+            continue;
+        size_t used = strlen(buf);
+        snprintf(buf + used, len - used, "%s%s", used ? " and " : "", mentions[ix]);
+    }
+    return buf;
+}
+
+/* If input is a short command with pronouns in it, and each of them is
+   clear, write it out with the pronouns replaced. Returns the number
+   replaced. */
+int gli_llm_ref_resolve(const char *input, char *output, size_t len)
+{
+    if (!gli_llm_config.pronouns)
+        return 0;
+
+    char tokens[16][24];
+    int count = split_tokens(input, tokens, 16);
+    if (count < 2 || count > 6 || !gli_llm_vocab_is_verb(tokens[0]))
+        return 0;
+
+    char them[REF_PHRASE * 4];
+    int replaced = 0;
+    output[0] = '\0';
+    for (int ix = 0; ix < count; ix++) {
+        const char *word = tokens[ix];
+        if (word[0] == ',')
+            return 0;
+
+        const char *referent = NULL;
+        if (strcmp(word, "it") == 0) {
+            if (!(referent = resolve_it()))
+                return 0;
+        }
+        else if (strcmp(word, "them") == 0) {
+            if (!(referent = resolve_them(them, sizeof(them))))
+                return 0;
+        }
+        else if (strcmp(word, "him") == 0) {
+            if (!person_him[0])
+                return 0;
+            referent = person_him;
+        }
+        else if (strcmp(word, "her") == 0) {
+            // "her hat" is a possessive
+            if (ix + 1 < count && !in_list(command_stops, tokens[ix + 1]))
+                return 0;
+            if (!person_her[0])
+                return 0;
+            referent = person_her;
+        }
+
+        if (referent)
+            replaced++;
+        size_t used = strlen(output);
+        snprintf(output + used, len - used, "%s%s", used ? " " : "", referent ? referent : word);
+    }
+    return replaced;
+}
@@ -0,0 +1,396 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef WASM_BUILD
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "glk.h"
+#include "cheapglk.h"
+#include "gi_dispa.h"
+#include "glk_llm.h"
+
+/* Shared interpretation cache. Many interpreters on one host, playing
+   the same few games, all end up asking the model the same things.
+   With shared_cache= naming a POSIX shared memory object, interpretations
+   the game accepted are stored in a hash table in that object, and any
+   process on the host can answer the same input in the same place from
+   it without a request.
+
+   An entry is keyed by the game (gidispatch_get_game_id(), so the
+   interpreter must set a game ID hook; without one the cache is off),
+   the normalized input, and the room it was typed in. Two independent
+   64-bit hashes of the key are stored, not the key itself.
+
+   The table is a fixed array of 128-byte entries with linear probing
+   over a window of SHM_PROBE slots. Nothing is ever deleted, so a probe
+   can stop at the first empty slot. Each entry has a sequence counter:
+   a writer claims the entry by moving the counter from even to odd with
+   compare-and-swap, writes, and moves it on to the next even value.
+   Readers take no lock at all; they copy the entry and check the
+   counter was the same even value before and after (a seqlock), and
+   treat a torn read as a miss. When the window is full, an entry in it
+   is evicted by the clock rule: hits set an entry's reference bit, and
+   the sweep (starting from a shared hand) clears bits until it finds an
+   entry without one.
+
+   A cached command that the game then rejects is blanked, and counts as
+   a miss until someone stores a better one.
+*/
+
+#define SHM_MAGIC "GLKSHMC1"
+#define SHM_PROBE 16
+#define SHM_COMMAND 104
+
+typedef struct {
+    char magic[8];
+    glui32 state;           /* 2 once the creator has set it up */
+    glui32 capacity;        /* entries; a power of two */
+    glui32 hand;            /* clock hand */
+    glui32 reserved[11];
+} shm_header_t;
+
+typedef struct {
+    glui32 seq;             /* odd while being written */
+    glui32 referenced;      /* clock bit */
+    uint64_t key;           /* 0 for an empty slot */
+    uint64_t check;
+    char command[SHM_COMMAND];
+} shm_entry_t;
+
+#ifndef WASM_BUILD
+
+static shm_header_t *shm_header = NULL;
+static shm_entry_t *shm_entries = NULL;
+static size_t shm_len = 0;
+static glui32 shm_mask = 0;
+
+/* Key of the interpretation sent this turn, settled at the next prompt. */
+static uint64_t pending_key = 0;
+static uint64_t pending_check = 0;
+static char pending_command[SHM_COMMAND];
+static int pending = 0;
+static int pending_from_cache = 0;
+
+static struct {
+    int lookups;
+    int hits;
+    int stores;
+    int evictions;
+} shm_stats;
+
+/* Map a table that another process created, once it is ready; its
+   capacity is the creator's, whatever ours is set to. */
+static shm_header_t *shm_attach(int fd, size_t *lenp)
+{
+    // The creator may not have sized or set it up yet; it takes no time
+    struct stat st;
+    shm_header_t *header = MAP_FAILED;
+    for (int tries = 0; tries < 1000; tries++) {
+        if (fstat(fd, &st) < 0)
+            return NULL;
+        if ((size_t)st.st_size >= sizeof(shm_header_t)) {
+            if (header == MAP_FAILED)
+                header = mmap(NULL, sizeof(shm_header_t), PROT_READ, MAP_SHARED, fd, 0);
+            if (header == MAP_FAILED)
+                return NULL;
+            if (__atomic_load_n(&header->state, __ATOMIC_ACQUIRE) == 2)
+                break;
+        }
+        usleep(1000);
+    }
+    if (header == MAP_FAILED)
+        return NULL;
+
+    glui32 capacity = header->capacity;
+    int ready = (__atomic_load_n(&header->state, __ATOMIC_ACQUIRE) == 2
+        && memcmp(header->magic, SHM_MAGIC, 8) == 0);
+    munmap(header, sizeof(shm_header_t));
+    size_t len = sizeof(shm_header_t) + (size_t)capacity * sizeof(shm_entry_t);
+    if (!ready || capacity < SHM_PROBE || (capacity & (capacity - 1)) != 0
+        || len > (size_t)st.st_size)
+        return NULL;
+
+    header = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (header == MAP_FAILED)
+        return NULL;
+    *lenp = len;
+    return header;
+}
+
+static int shm_open_table(void)
+{
+    if (shm_header)
+        return 1;
+    if (!gli_llm_config.shared_cache[0])
+        return 0;
+
+    glui32 capacity = 1024;
+    while (capacity < (glui32)gli_llm_config.shared_cache_entries && capacity < (1u << 24))
+        capacity <<= 1;
+    size_t len = sizeof(shm_header_t) + (size_t)capacity * sizeof(shm_entry_t);
+
+    // Whoever creates the object sizes and sets it up; everyone else
+    // waits for that and uses its size
+    const char *name = gli_llm_config.shared_cache;
+    shm_header_t *header = NULL;
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd >= 0) {
+        void *map = MAP_FAILED;
+        if (ftruncate(fd, len) == 0)
+            map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED) {
+            shm_unlink(name);
+        }
+        else {
+            header = map;
+            memcpy(header->magic, SHM_MAGIC, 8);
+            header->capacity = capacity;
+            __atomic_store_n(&header->state, 2, __ATOMIC_RELEASE);
+        }
+    }
+    else if (errno == EEXIST) {
+        fd = shm_open(name, O_RDWR, 0600);
+        if (fd >= 0)
+            header = shm_attach(fd, &len);
+    }
+    if (fd >= 0)
+        close(fd);
+
+    if (!header) {
+        gli_llm_log("shared cache: unable to use %s", name);
+        gli_llm_config.shared_cache[0] = '\0';
+        return 0;
+    }
+
+    shm_header = header;
+    shm_entries = (shm_entry_t *)(header + 1);
+    shm_len = len;
+    shm_mask = header->capacity - 1;
+    return 1;
+}
+
+/* Hash (game, input, room). Returns 0 if there is no game ID. */
+static int make_key(const char *input, uint64_t *key, uint64_t *check)
+{
+    const char *game = gidispatch_get_game_id();
+    if (!game || !game[0])
+        return 0;
+
+    char norm[256], room[256];
+    gli_llm_normalize(input, norm, sizeof(norm), ".!?");
+    gli_llm_current_room(room, sizeof(room));
+    if (!norm[0])
+        return 0;
+
+    glk_llm_hash_t hash = gli_llm_hash(game, strlen(game) + 1, 0);
+    hash = gli_llm_hash(norm, strlen(norm) + 1, hash);
+    hash = gli_llm_hash(room, strlen(room) + 1, hash);
+    *key = hash ? hash : 1;
+
+    // The same, from a different start
+    hash = gli_llm_hash(room, strlen(room) + 1, 0x5bd1e9955bd1e995ULL);
+    hash = gli_llm_hash(norm, strlen(norm) + 1, hash);
+    *check = gli_llm_hash(game, strlen(game) + 1, hash);
+    return 1;
+}
+
+/* A consistent copy of an entry, or 0 if it was being written. */
+static int read_entry(shm_entry_t *entry, shm_entry_t *copy)
+{
+    for (int tries = 0; tries < 4; tries++) {
+        glui32 before = __atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE);
+        if (before & 1)
+            continue;
+        copy->key = __atomic_load_n(&entry->key, __ATOMIC_RELAXED);
+        copy->check = __atomic_load_n(&entry->check, __ATOMIC_RELAXED);
+        memcpy(copy->command, entry->command, SHM_COMMAND);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&entry->seq, __ATOMIC_RELAXED) == before) {
+            copy->command[SHM_COMMAND - 1] = '\0';
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Take the entry for writing. Fails if another writer has it. */
+static int claim_entry(shm_entry_t *entry, glui32 *seq)
+{
+    glui32 current = __atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE);
+    if (current & 1)
+        return 0;
+    if (!__atomic_compare_exchange_n(&entry->seq, &current, current + 1, FALSE,
+        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return 0;
+    *seq = current + 1;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    return 1;
+}
+
+static void write_entry(shm_entry_t *entry, glui32 seq, uint64_t key, uint64_t check, const char *command)
+{
+    char text[SHM_COMMAND];
+    memset(text, 0, sizeof(text));
+    strncpy(text, command, sizeof(text) - 1);
+    memcpy(entry->command, text, SHM_COMMAND);
+    __atomic_store_n(&entry->check, check, __ATOMIC_RELAXED);
+    __atomic_store_n(&entry->key, key, __ATOMIC_RELAXED);
+    __atomic_store_n(&entry->referenced, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&entry->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+/* If another session has had input answered here, copy the command to
+   output and return 1. */
+int gli_llm_shared_lookup(const char *input, char *output, size_t len)
+{
+    uint64_t key, check;
+    if (!shm_open_table() || !make_key(input, &key, &check))
+        return 0;
+    shm_stats.lookups++;
+
+    for (glui32 probe = 0; probe < SHM_PROBE; probe++) {
+        shm_entry_t *entry = &shm_entries[(key + probe) & shm_mask];
+        shm_entry_t copy;
+        if (!read_entry(entry, &copy))
+            continue;
+        if (copy.key == 0)
+            return 0;
+        if (copy.key != key || copy.check != check)
+            continue;
+        if (!copy.command[0])
+            return 0;
+
+        __atomic_store_n(&entry->referenced, 1, __ATOMIC_RELAXED);
+        strncpy(output, copy.command, len - 1);
+        output[len - 1] = '\0';
+        shm_stats.hits++;
+        pending_from_cache = 1;
+        gli_llm_log("shared cache: \"%s\" -> \"%s\"", input, output);
+        return 1;
+    }
+    return 0;
+}
+
+/* Store command for the key, or blank it (command ""), if it is there
+   or there is room. */
+static void store(uint64_t key, uint64_t check, const char *command)
+{
+    shm_entry_t *empty = NULL;
+    for (glui32 probe = 0; probe < SHM_PROBE; probe++) {
+        shm_entry_t *entry = &shm_entries[(key + probe) & shm_mask];
+        shm_entry_t copy;
+        if (!read_entry(entry, &copy))
+            continue;
+        if (copy.key == key && copy.check == check) {
+            glui32 seq;
+            if (strcmp(copy.command, command) != 0 && claim_entry(entry, &seq))
+                write_entry(entry, seq, key, check, command);
+            return;
+        }
+        if (copy.key == 0) {
+            empty = entry;
+            break;
+        }
+    }
+    if (!command[0])
+        return;
+
+    glui32 seq;
+    if (empty) {
+        // Someone may fill the same slot first; then we just lose this one
+        if (claim_entry(empty, &seq)) {
+            if (__atomic_load_n(&empty->key, __ATOMIC_RELAXED) == 0) {
+                write_entry(empty, seq, key, check, command);
+                shm_stats.stores++;
+            }
+            else {
+                __atomic_store_n(&empty->seq, seq + 1, __ATOMIC_RELEASE);
+            }
+        }
+        return;
+    }
+
+    // The window is full: clock sweep for a victim, twice round at most
+    glui32 start = __atomic_fetch_add(&shm_header->hand, 1, __ATOMIC_RELAXED);
+    for (glui32 step = 0; step < 2 * SHM_PROBE; step++) {
+        shm_entry_t *entry = &shm_entries[(key + (start + step) % SHM_PROBE) & shm_mask];
+        if (__atomic_exchange_n(&entry->referenced, 0, __ATOMIC_RELAXED))
+            continue;
+        if (claim_entry(entry, &seq)) {
+            write_entry(entry, seq, key, check, command);
+            shm_stats.stores++;
+            shm_stats.evictions++;
+            return;
+        }
+    }
+}
+
+/* Note the interpretation just sent for input. Called from
+   gli_llm_memory_propose(), while the player is still where they typed
+   it. */
+void gli_llm_shared_propose(const char *input, const char *command)
+{
+    int from_cache = pending_from_cache;
+    pending = 0;
+    pending_from_cache = 0;
+    if (!shm_open_table() || !make_key(input, &pending_key, &pending_check))
+        return;
+    char norm[256];
+    gli_llm_normalize(input, norm, sizeof(norm), ".!?");
+    if (!command[0] || strcmp(norm, command) == 0)
+        return;
+    strncpy(pending_command, command, sizeof(pending_command) - 1);
+    pending_command[sizeof(pending_command) - 1] = '\0';
+    pending = from_cache ? 2 : 1;
+}
+
+/* The game has answered it. An accepted interpretation is stored; a
+   rejected one from the cache is blanked. */
+void gli_llm_shared_settle(int rejected)
+{
+    pending_from_cache = 0;
+    if (!pending)
+        return;
+    if (!rejected)
+        store(pending_key, pending_check, pending_command);
+    else if (pending == 2)
+        store(pending_key, pending_check, "");
+    pending = 0;
+}
+
+/* Called from gli_llm_exit(). */
+void gli_llm_shared_close(void)
+{
+    if (!shm_header)
+        return;
+    gli_llm_log("shared cache: lookups=%d hits=%d stores=%d evictions=%d",
+        shm_stats.lookups, shm_stats.hits, shm_stats.stores, shm_stats.evictions);
+    munmap(shm_header, shm_len);
+    shm_header = NULL;
+    shm_entries = NULL;
+}
+
+#else /* WASM_BUILD */
+
+int gli_llm_shared_lookup(const char *input, char *output, size_t len)
+{
+    return 0;
+}
+
+void gli_llm_shared_propose(const char *input, const char *command)
+{
+}
+
+void gli_llm_shared_settle(int rejected)
+{
+}
+
+void gli_llm_shared_close(void)
+{
+}
+
+#endif /* WASM_BUILD */
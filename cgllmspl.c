@@ -0,0 +1,288 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "glk.h"
+#include "cheapglk.h"
+#include "glk_llm.h"
+
+/* Spelling correction against the game's vocabulary, by symmetric
+   deletes (as in SymSpell). Every dictionary word is indexed under each
+   string that can be made from it by deleting up to two letters. A
+   typed word is looked up the same way: any dictionary word that shares
+   a delete with it is within two edits, and only those few candidates
+   have their real distance computed. A lookup is a few dozen hash
+   probes, so the whole input is corrected before anything else happens
+   to it.
+
+   The dictionary is fed by cgllmvoc.c: the standard verbs and
+   directions, and every word of three letters or more the game prints.
+   Words are counted, and among equally close candidates the one the
+   game has used most wins. Words of up to four letters are corrected by
+   one edit at most; longer ones by two. Words the game has used, or
+   shorter than three letters, are left alone.
+
+   The index stores only hashes of the deletes, with the word they came
+   from; a hash collision just adds a candidate, which the distance
+   check then discards.
+*/
+
+#define SPELL_MAX_DISTANCE 2
+#define SPELL_MAX_CANDIDATES 64
+
+typedef struct {
+    char word[24];
+    int count;
+} spell_word_t;
+
+typedef struct {
+    glk_llm_hash_t hash;
+    int word;           /* -1 if the slot is empty */
+} spell_slot_t;
+
+static spell_word_t *words = NULL;
+static int numwords = 0;
+static int maxwords = 0;
+
+static spell_slot_t *slots = NULL;
+static size_t numslots = 0;
+static size_t usedslots = 0;
+
+static void slot_put(glk_llm_hash_t hash, int word)
+{
+    size_t ix = hash & (numslots - 1);
+    while (slots[ix].word >= 0) {
+        // The same delete can come from a word twice ("door" -> "dor")
+        if (slots[ix].hash == hash && slots[ix].word == word)
+            return;
+        ix = (ix + 1) & (numslots - 1);
+    }
+    slots[ix].hash = hash;
+    slots[ix].word = word;
+    usedslots++;
+}
+
+static int index_grow(void)
+{
+    size_t newsize = numslots ? numslots * 2 : 16384;
+    spell_slot_t *table = malloc(newsize * sizeof(spell_slot_t));
+    if (!table)
+        return 0;
+    for (size_t ix = 0; ix < newsize; ix++)
+        table[ix].word = -1;
+
+    spell_slot_t *old = slots;
+    size_t oldsize = numslots;
+    slots = table;
+    numslots = newsize;
+    usedslots = 0;
+    for (size_t ix = 0; ix < oldsize; ix++) {
+        if (old[ix].word >= 0)
+            slot_put(old[ix].hash, old[ix].word);
+    }
+    free(old);
+    return 1;
+}
+
+static void index_put(const char *text, size_t len, int word)
+{
+    if (usedslots + 1 > numslots * 7 / 10 && !index_grow())
+        return;
+    slot_put(gli_llm_hash(text, len, 0), word);
+}
+
+/* Index word under every string made by deleting up to depth letters. */
+static void index_deletes(const char *text, size_t len, int depth, int word)
+{
+    char shorter[24];
+    if (depth == 0 || len <= 1)
+        return;
+    for (size_t ix = 0; ix < len; ix++) {
+        memcpy(shorter, text, ix);
+        memcpy(shorter + ix, text + ix + 1, len - ix - 1);
+        index_put(shorter, len - 1, word);
+        index_deletes(shorter, len - 1, depth - 1, word);
+    }
+}
+
+/* Collect the words indexed under text and its deletes. */
+static void gather(const char *text, size_t len, int depth, int *cands, int *numcands)
+{
+    glk_llm_hash_t hash = gli_llm_hash(text, len, 0);
+    for (size_t ix = hash & (numslots - 1); slots[ix].word >= 0; ix = (ix + 1) & (numslots - 1)) {
+        if (slots[ix].hash != hash)
+            continue;
+        int word = slots[ix].word, seen = 0;
+        for (int jx = 0; jx < *numcands; jx++) {
+            if (cands[jx] == word)
+                seen = 1;
+        }
+        if (!seen && *numcands < SPELL_MAX_CANDIDATES)
+            cands[(*numcands)++] = word;
+    }
+
+    char shorter[24];
+    if (depth == 0 || len <= 1)
+        return;
+    for (size_t ix = 0; ix < len; ix++) {
+        memcpy(shorter, text, ix);
+        memcpy(shorter + ix, text + ix + 1, len - ix - 1);
+        gather(shorter, len - 1, depth - 1, cands, numcands);
+    }
+}
+
+/* Edit distance with adjacent transpositions (optimal string
+   alignment). */
+static int distance(const char *a, const char *b)
+{
+    int la = strlen(a), lb = strlen(b);
+    int rows[3][24];
+    int *prev2 = rows[0], *prev = rows[1], *cur = rows[2];
+
+    for (int j = 0; j <= lb; j++)
+        prev[j] = j;
+    for (int i = 1; i <= la; i++) {
+        cur[0] = i;
+        for (int j = 1; j <= lb; j++) {
+            int cost = prev[j - 1] + (a[i - 1] != b[j - 1]);
+            if (prev[j] + 1 < cost)
+                cost = prev[j] + 1;
+            if (cur[j - 1] + 1 < cost)
+                cost = cur[j - 1] + 1;
+            if (i > 1 && j > 1 && a[i - 1] == b[j - 2] && a[i - 2] == b[j - 1]
+                && prev2[j - 2] + 1 < cost)
+                cost = prev2[j - 2] + 1;
+            cur[j] = cost;
+        }
+        int *tmp = prev2;
+        prev2 = prev;
+        prev = cur;
+        cur = tmp;
+    }
+    return prev[lb];
+}
+
+static int find_word(const char *word, size_t len)
+{
+    if (!numslots)
+        return -1;
+    glk_llm_hash_t hash = gli_llm_hash(word, len, 0);
+    for (size_t ix = hash & (numslots - 1); slots[ix].word >= 0; ix = (ix + 1) & (numslots - 1)) {
+        if (slots[ix].hash == hash && strncmp(words[slots[ix].word].word, word, len) == 0
+            && words[slots[ix].word].word[len] == '\0')
+            return slots[ix].word;
+    }
+    return -1;
+}
+
+/* Add a (lower-case) word to the dictionary, or count it again. */
+void gli_llm_spell_add(const char *word)
+{
+    size_t len = strlen(word);
+    if (len < 3 || len >= sizeof(words[0].word))
+        return;
+
+    int id = find_word(word, len);
+    if (id >= 0) {
+        words[id].count++;
+        return;
+    }
+
+    if (numwords == maxwords) {
+        int newmax = maxwords ? maxwords * 2 : 256;
+        spell_word_t *list = realloc(words, newmax * sizeof(spell_word_t));
+        if (!list)
+            return;
+        words = list;
+        maxwords = newmax;
+    }
+    id = numwords++;
+    memcpy(words[id].word, word, len + 1);
+    words[id].count = 1;
+
+    index_put(word, len, id);
+    index_deletes(word, len, SPELL_MAX_DISTANCE, id);
+}
+
+/* The closest dictionary word to word, or NULL if it is in the
+   dictionary already or nothing is close enough. */
+static const char *correct_word(const char *word, size_t len)
+{
+    if (len < 3 || len >= sizeof(words[0].word) || !numslots)
+        return NULL;
+    if (find_word(word, len) >= 0)
+        return NULL;
+
+    int maxdist = (len <= 4) ? 1 : SPELL_MAX_DISTANCE;
+    int cands[SPELL_MAX_CANDIDATES];
+    int numcands = 0;
+    gather(word, len, maxdist, cands, &numcands);
+
+    char text[24];
+    memcpy(text, word, len);
+    text[len] = '\0';
+
+    int best = -1, bestdist = maxdist + 1;
+    for (int ix = 0; ix < numcands; ix++) {
+        int dist = distance(text, words[cands[ix]].word);
+        if (dist < bestdist || (dist == bestdist && best >= 0
+            && words[cands[ix]].count > words[best].count)) {
+            best = cands[ix];
+            bestdist = dist;
+        }
+    }
+    return (best >= 0) ? words[best].word : NULL;
+}
+
+/* Correct each word of input. Writes the result to output and returns
+   the number of words changed. */
+int gli_llm_spell_correct(const char *input, char *output, size_t len)
+{
+    size_t pos = 0;
+    int changed = 0;
+    const char *p = input;
+
+    while (*p && pos < len - 1) {
+        if (!isalpha((unsigned char)*p)) {
+            output[pos++] = *p++;
+            continue;
+        }
+
+        char word[24];
+        size_t wlen = 0;
+        const char *start = p;
+        int plain = 1;
+        while (*p && (isalnum((unsigned char)*p) || ((unsigned char)*p & 0x80))) {
+            if (!isalpha((unsigned char)*p))
+                plain = 0;
+            if (wlen < sizeof(word))
+                word[wlen] = tolower((unsigned char)*p);
+            wlen++;
+            p++;
+        }
+
+        const char *fixed = (plain && wlen < sizeof(word)) ? correct_word(word, wlen) : NULL;
+        if (fixed) {
+            changed++;
+            start = fixed;
+            wlen = strlen(fixed);
+        }
+        if (wlen > len - 1 - pos)
+            wlen = len - 1 - pos;
+        memcpy(output + pos, start, wlen);
+        pos += wlen;
+    }
+    output[pos] = '\0';
+    return changed;
+}
+
+/* Called from gli_llm_exit(). */
+void gli_llm_spell_free(void)
+{
+    free(words);
+    words = NULL;
+    numwords = maxwords = 0;
+    free(slots);
+    slots = NULL;
+    numslots = usedslots = 0;
+}
@@ -0,0 +1,383 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#ifndef WASM_BUILD
+#include <pthread.h>
+#endif
+#include "glk.h"
+#include "cheapglk.h"
+#include "glk_llm.h"
+
+/* Local token counting, so prompts can be sized in tokens (which is
+   what costs money and prefill time) rather than bytes.
+
+   With tokenizer= in the config naming a BPE rank file, in the tiktoken
+   format used for cl100k_base, o200k_base and friends (one line per
+   token: base64 bytes, space, rank), text is counted exactly the way a
+   byte-level BPE tokenizer would split it: first into word-like chunks,
+   then each chunk is merged pairwise, lowest rank first. Rank order is
+   merge order, so the rank file serves as both vocabulary and merge
+   list.
+
+   The chunking rules are a hand-written approximation of the cl100k
+   split pattern (contractions, letter runs with one leading space or
+   punctuation mark, up to three digits, punctuation runs, whitespace),
+   close enough that counts rarely differ by more than a token or two.
+
+   Without a rank file, the same chunks are estimated from their shape.
+   Non-ASCII text is counted per character, since it typically costs
+   several times more tokens per byte than English.
+
+   Requests made from background threads count their tokens too (for
+   usage accounting), so counting and freeing the tables are done under
+   a lock.
+*/
+
+typedef struct {
+    glui32 offset;      /* into token_pool */
+    glui32 len;
+    glui32 rank;        /* 0 marks an empty slot; stored as rank+1 */
+} tok_entry_t;
+
+static unsigned char *token_pool = NULL;
+static tok_entry_t *token_table = NULL;
+static glui32 table_mask = 0;
+static glui32 num_tokens = 0;
+
+#define TOK_CACHE_SIZE (4096)
+#define TOK_MAX_CHUNK (256)
+
+typedef struct {
+    glk_llm_hash_t hash;
+    glui32 count;
+} tok_cache_t;
+
+static tok_cache_t *chunk_cache = NULL;
+
+#ifndef WASM_BUILD
+static pthread_mutex_t tok_lock = PTHREAD_MUTEX_INITIALIZER;
+#define TOK_LOCK() pthread_mutex_lock(&tok_lock)
+#define TOK_UNLOCK() pthread_mutex_unlock(&tok_lock)
+#else
+#define TOK_LOCK()
+#define TOK_UNLOCK()
+#endif
+
+static const signed char base64_values[256] = {
+    ['A'] = 1, ['B'] = 2, ['C'] = 3, ['D'] = 4, ['E'] = 5, ['F'] = 6, ['G'] = 7, ['H'] = 8,
+    ['I'] = 9, ['J'] = 10, ['K'] = 11, ['L'] = 12, ['M'] = 13, ['N'] = 14, ['O'] = 15, ['P'] = 16,
+    ['Q'] = 17, ['R'] = 18, ['S'] = 19, ['T'] = 20, ['U'] = 21, ['V'] = 22, ['W'] = 23, ['X'] = 24,
+    ['Y'] = 25, ['Z'] = 26, ['a'] = 27, ['b'] = 28, ['c'] = 29, ['d'] = 30, ['e'] = 31, ['f'] = 32,
+    ['g'] = 33, ['h'] = 34, ['i'] = 35, ['j'] = 36, ['k'] = 37, ['l'] = 38, ['m'] = 39, ['n'] = 40,
+    ['o'] = 41, ['p'] = 42, ['q'] = 43, ['r'] = 44, ['s'] = 45, ['t'] = 46, ['u'] = 47, ['v'] = 48,
+    ['w'] = 49, ['x'] = 50, ['y'] = 51, ['z'] = 52, ['0'] = 53, ['1'] = 54, ['2'] = 55, ['3'] = 56,
+    ['4'] = 57, ['5'] = 58, ['6'] = 59, ['7'] = 60, ['8'] = 61, ['9'] = 62, ['+'] = 63, ['/'] = 64,
+};
+
+/* Decode base64 (values above are offset by one, so 0 means invalid).
+   Returns the decoded length, or -1. */
+static int base64_decode(const char *src, size_t len, unsigned char *dest, size_t destlen)
+{
+    glui32 acc = 0;
+    int bits = 0;
+    size_t pos = 0;
+
+    for (size_t ix = 0; ix < len && src[ix] != '='; ix++) {
+        int val = base64_values[(unsigned char)src[ix]];
+        if (!val)
+            return -1;
+        acc = (acc << 6) | (val - 1);
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            if (pos >= destlen)
+                return -1;
+            dest[pos++] = (acc >> bits) & 0xFF;
+        }
+    }
+    return pos;
+}
+
+static glui32 table_slot(const unsigned char *bytes, size_t len)
+{
+    return (glui32)gli_llm_hash(bytes, len, 0) & table_mask;
+}
+
+/* The rank of this byte string, or -1 if it isn't a token. */
+static long token_rank(const unsigned char *bytes, size_t len)
+{
+    glui32 slot = table_slot(bytes, len);
+    while (token_table[slot].rank) {
+        tok_entry_t *ent = &token_table[slot];
+        if (ent->len == len && memcmp(token_pool + ent->offset, bytes, len) == 0)
+            return ent->rank - 1;
+        slot = (slot + 1) & table_mask;
+    }
+    return -1;
+}
+
+void gli_llm_tokenizer_free(void)
+{
+    TOK_LOCK();
+    free(token_pool);
+    free(token_table);
+    free(chunk_cache);
+    token_pool = NULL;
+    token_table = NULL;
+    chunk_cache = NULL;
+    table_mask = 0;
+    num_tokens = 0;
+    TOK_UNLOCK();
+}
+
+/* Load a tiktoken-format rank file. Returns 0 (leaving the estimator in
+   use) if it can't be read. */
+int gli_llm_tokenizer_load(const char *filename)
+{
+    gli_llm_tokenizer_free();
+    if (!filename || !filename[0])
+        return 0;
+
+    FILE *f = fopen(filename, "r");
+    if (!f)
+        return 0;
+
+    // First pass: count lines to size the table
+    glui32 lines = 0;
+    size_t poolsize = 0;
+    char line[1024];
+    while (fgets(line, sizeof(line), f)) {
+        lines++;
+        poolsize += strlen(line);
+    }
+    if (!lines) {
+        fclose(f);
+        return 0;
+    }
+
+    glui32 size = 1024;
+    while (size < lines * 2)
+        size <<= 1;
+    token_pool = malloc(poolsize);
+    token_table = calloc(size, sizeof(tok_entry_t));
+    chunk_cache = calloc(TOK_CACHE_SIZE, sizeof(tok_cache_t));
+    if (!token_pool || !token_table || !chunk_cache) {
+        fclose(f);
+        gli_llm_tokenizer_free();
+        return 0;
+    }
+    table_mask = size - 1;
+
+    rewind(f);
+    size_t used = 0;
+    while (fgets(line, sizeof(line), f)) {
+        char *sp = strchr(line, ' ');
+        if (!sp)
+            continue;
+        int len = base64_decode(line, sp - line, token_pool + used, poolsize - used);
+        if (len <= 0)
+            continue;
+        long rank = strtol(sp + 1, NULL, 10);
+
+        glui32 slot = table_slot(token_pool + used, len);
+        while (token_table[slot].rank)
+            slot = (slot + 1) & table_mask;
+        token_table[slot].offset = used;
+        token_table[slot].len = len;
+        token_table[slot].rank = rank + 1;
+        used += len;
+        num_tokens++;
+    }
+    fclose(f);
+
+    if (!num_tokens) {
+        gli_llm_tokenizer_free();
+        return 0;
+    }
+    return 1;
+}
+
+/* Merge the chunk pairwise, lowest rank first, and count the result. */
+static glui32 bpe_count(const unsigned char *chunk, size_t len)
+{
+    // Token boundaries; parts[i]..parts[i+1] is one token
+    size_t parts[TOK_MAX_CHUNK + 1];
+    size_t numparts = len + 1;
+    for (size_t ix = 0; ix <= len; ix++)
+        parts[ix] = ix;
+
+    while (numparts > 2) {
+        long best = -1;
+        size_t bestix = 0;
+        for (size_t ix = 0; ix + 2 < numparts; ix++) {
+            long rank = token_rank(chunk + parts[ix], parts[ix+2] - parts[ix]);
+            if (rank >= 0 && (best < 0 || rank < best)) {
+                best = rank;
+                bestix = ix;
+            }
+        }
+        if (best < 0)
+            break;
+        memmove(&parts[bestix+1], &parts[bestix+2], (numparts - bestix - 2) * sizeof(size_t));
+        numparts--;
+    }
+    return numparts - 1;
+}
+
+static int is_letter(unsigned char ch)
+{
+    return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || ch >= 0x80;
+}
+
+static int is_digit(unsigned char ch)
+{
+    return (ch >= '0' && ch <= '9');
+}
+
+static int is_space(unsigned char ch)
+{
+    return (ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r' || ch == '\f' || ch == '\v');
+}
+
+/* Length of the chunk at the start of text (len > 0). */
+static size_t next_chunk(const unsigned char *text, size_t len)
+{
+    size_t pos = 0;
+    unsigned char ch = text[0];
+
+    // Contractions
+    if (ch == '\'' && len >= 2) {
+        static const char *suffixes[] = { "ll", "ve", "re", "s", "t", "m", "d", NULL };
+        for (int ix = 0; suffixes[ix]; ix++) {
+            size_t slen = strlen(suffixes[ix]);
+            if (len > slen && strncasecmp((const char *)text + 1, suffixes[ix], slen) == 0)
+                return slen + 1;
+        }
+    }
+
+    // Letters, with one leading non-letter (usually a space)
+    if (is_letter(ch) || (len >= 2 && !is_digit(ch) && ch != '\n' && ch != '\r' && is_letter(text[1]))) {
+        pos = 1;
+        while (pos < len && is_letter(text[pos]))
+            pos++;
+        return pos;
+    }
+
+    if (is_digit(ch)) {
+        while (pos < len && pos < 3 && is_digit(text[pos]))
+            pos++;
+        return pos;
+    }
+
+    // Punctuation, with an optional leading space and trailing newlines
+    if (!is_space(ch) || (ch == ' ' && len >= 2 && !is_space(text[1]))) {
+        pos = (ch == ' ') ? 1 : 0;
+        while (pos < len && !is_space(text[pos]) && !is_letter(text[pos]) && !is_digit(text[pos]))
+            pos++;
+        while (pos < len && (text[pos] == '\n' || text[pos] == '\r'))
+            pos++;
+        return pos ? pos : 1;
+    }
+
+    // Whitespace: up to the last newline if there is one; otherwise
+    // leave the last space to lead the next word
+    size_t lastnl = 0;
+    while (pos < len && is_space(text[pos])) {
+        if (text[pos] == '\n' || text[pos] == '\r')
+            lastnl = pos + 1;
+        pos++;
+    }
+    if (lastnl)
+        return lastnl;
+    if (pos > 1 && pos < len)
+        pos--;
+    return pos;
+}
+
+/* Guess a chunk's token count from its shape. */
+static glui32 estimate_chunk(const unsigned char *chunk, size_t len)
+{
+    glui32 ascii = 0, wide = 0, narrow = 0;
+    for (size_t ix = 0; ix < len; ix++) {
+        unsigned char ch = chunk[ix];
+        if (ch < 0x80)
+            ascii++;
+        else if (ch >= 0xF0)
+            wide += 2;      /* emoji and the like */
+        else if (ch >= 0xE0)
+            wide++;         /* CJK and most other scripts */
+        else if (ch >= 0xC0)
+            narrow++;       /* accented Latin, Greek, Cyrillic */
+    }
+
+    glui32 count = wide + (narrow + 1) / 2;
+    if (ascii) {
+        if (is_letter(chunk[len-1]) || is_letter(chunk[0]))
+            count += (ascii + 5) / 6;
+        else if (is_digit(chunk[0]))
+            count += 1;
+        else if (is_space(chunk[0]) && ascii == len)
+            count += 1;
+        else
+            count += (ascii + 1) / 2;
+    }
+    return count ? count : 1;
+}
+
+static glui32 count_chunk(const unsigned char *chunk, size_t len)
+{
+    if (!num_tokens)
+        return estimate_chunk(chunk, len);
+
+    glk_llm_hash_t hash = gli_llm_hash(chunk, len, len);
+    tok_cache_t *cached = &chunk_cache[hash & (TOK_CACHE_SIZE - 1)];
+    if (cached->hash == hash)
+        return cached->count;
+
+    glui32 count;
+    if (token_rank(chunk, len) >= 0)
+        count = 1;
+    else
+        count = bpe_count(chunk, len);
+
+    cached->hash = hash;
+    cached->count = count;
+    return count;
+}
+
+/* Count the tokens in len bytes of text. */
+size_t gli_llm_count_tokens(const char *text, size_t len)
+{
+    const unsigned char *p = (const unsigned char *)text;
+    size_t total = 0;
+
+    TOK_LOCK();
+    while (len > 0) {
+        size_t chunk = next_chunk(p, len);
+        if (chunk > TOK_MAX_CHUNK)
+            chunk = TOK_MAX_CHUNK;
+        total += count_chunk(p, chunk);
+        p += chunk;
+        len -= chunk;
+    }
+    TOK_UNLOCK();
+    return total;
+}
+
+size_t gli_llm_count_tokens_str(const char *text)
+{
+    return text ? gli_llm_count_tokens(text, strlen(text)) : 0;
+}
+
+/* Count the tokens in a request body, piece by piece. */
+size_t gli_llm_body_tokens(const glk_llm_body_t *body)
+{
+    size_t total = 0;
+    for (int ix = 0; ix < body->numpieces; ix++) {
+        const glk_llm_piece_t *piece = &body->pieces[ix];
+        const char *text = piece->text ? piece->text : body->dyn.buf + piece->offset;
+        total += gli_llm_count_tokens(text, piece->len);
+    }
+    return total;
+}
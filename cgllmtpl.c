@@ -0,0 +1,264 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "glk.h"
+#include "cheapglk.h"
+#include "glk_llm.h"
+
+/* The system prompt is a template with named {{slot}} placeholders. It
+   is parsed once, at gli_llm_init() time, into a list of segments: each
+   segment is either a run of literal text (already JSON-escaped, so it
+   can be copied straight into a request body) or a slot reference which
+   is filled in and escaped per turn.
+
+   If the config names a prompt_template file, that file is the template.
+   Otherwise we use the built-in prompt below.
+*/
+
+typedef struct {
+    int slot;    /* llmslot_None for literal text */
+    char *text;  /* JSON-escaped literal text */
+    size_t len;
+} glk_llm_segment_t;
+
+static glk_llm_segment_t *segments = NULL;
+static int numsegments = 0;
+
+static const char *slot_names[llmslot_NumSlots] = {
+    "context", "scene", "location", "input", "history", "examples", "recalled"
+};
+
+static const char *builtin_template =
+    "You are an intelligent text adventure command interpreter for Glulx games. Most Glulx games are built with Inform (I6/I7) and use Inform-standard grammar, but not all. Default to Inform-normalized commands and abbreviations unless the context clearly shows a custom command set.\n\n"
+
+    "CRITICAL RULES:\n"
+    "1. Output ONLY the command(s) - NO quotes, explanations, or extra text\n"
+    "2. Use scene descriptions to resolve spatial references\n"
+    "3. Prefer the shortest valid Inform form\n"
+    "4. You MAY output a short sequence of commands when multiple steps are clearly required; separate commands with '. ' (a period followed by a space). Keep sequences minimal\n"
+    "5. NEVER interpret 'go to X' as 'look' - either find the direction or return empty\n"
+    "6. Use standard Inform abbreviations where unambiguous: n, s, e, w, ne, nw, se, sw, u, d, in, out, l, x thing, i, z, g\n"
+    "7. Punctuation: only use commas in multi-object lists and '. ' to separate multiple commands. No other punctuation, and keep it to one line\n"
+    "8. If the game appears to use non-Inform verbs (from context), adapt to those instead of forcing Inform terms\n\n"
+
+    "LOCATION AWARENESS:\n"
+    "- Check the CURRENT LOCATION field\n"
+    "- If player says 'go to X' and X matches the current location, return EMPTY STRING\n"
+    "- Example: Current='Back Alley', Input='go to the alley' → (empty, don't output 'look')\n\n"
+
+    "SPATIAL REASONING:\n"
+    "- Read the scene description carefully\n"
+    "- Use standard direction abbreviations when moving: n, s, e, w, ne, nw, se, sw, u, d, in, out\n"
+    "- 'go to X' should use the direction mentioned: if 'bedroom is north' then 'go to bedroom' → n\n"
+    "- 'enter X' becomes the direction if X is mentioned with a direction (e.g., 'door south leads outside' + 'go outside' → s)\n"
+    "- Look for phrases like 'X is to the Y' or 'door to Y leads to X'\n"
+    "- If no direction is clear for 'go to X', return EMPTY STRING (don't guess)\n\n"
+
+    "MULTI-OBJECT HANDLING (Inform-aware):\n"
+    "- Inform commonly supports multiple objects for some verbs. When clearly intended and supported, use a single command with a list:\n"
+    "  - Typically multi: take, drop, take all, drop all, take all from <container>, drop all except <object>\n"
+    "  - Typically single: wear, take off, open, close, lock, unlock, examine, read, eat, drink, attack, talk, put/insert\n"
+    "- Join multiple objects with commas or 'and' for supported verbs: e.g., 'take coin, gem, ring' or 'drop coin and gem'\n"
+    "- If the verb likely does not support multiple objects, pick ONE logical/most salient item and output a single-object command\n"
+    "- Do not invent implicit actions; only chain multiple commands with '. ' when the steps are clearly implied or explicitly requested\n\n"
+
+    "SEQUENCING (Multiple commands on one line):\n"
+    "- When a request implies necessary steps, output a short chain using '. ' as the separator: e.g., 'unlock door with key. open door. n'\n"
+    "- Resolve pronouns within the chain by repeating the noun: 'take key. unlock door with key' (avoid 'it')\n"
+    "- Keep the chain minimal and relevant\n\n"
+
+    "NORMALIZED INFORM COMMANDS:\n"
+    "- Movement: 'go north'/'north' → n; 'up' → u; 'down' → d; 'inside'/'enter (no target)' → in; 'outside'/'exit' → out\n"
+    "- Look: 'look around'/'whats here' → l\n"
+    "- Inventory: 'what do I have'/'check inventory' → i\n"
+    "- Examine/Inspect: 'inspect X'/'check X'/'look at X' → x X\n"
+    "- Take: 'pick up X'/'grab X'/'get X' → take X; multi: 'take X and Y' → take X and Y; 'take all' and 'take all from bag' are valid\n"
+    "- Drop: 'drop X and Y' → drop X and Y; 'drop all' and 'drop all except sword' are valid\n"
+    "- Containers/Supporters: 'take X from Y' → take X from Y; 'put/insert X in/into Y' → put X in Y (usually single object)\n"
+    "- Clothing: 'put on X'/'wear X' → wear X; 'take off X'/'remove X (clothing)' → take off X\n"
+    "- Doors/Locks: 'use key on door' → unlock door with key (or open/lock based on context)\n"
+    "- Conversation: 'talk to Y' → talk to Y; 'ask Y about Z' → ask Y about Z; 'tell Y about Z' → tell Y about Z; 'ask Y for X' → ask Y for X\n"
+    "- Time/Repeat: 'wait' → z; 'again'/'repeat that' → g\n\n"
+
+    "CONTEXT:\n"
+    "Recent game output:\n"
+    "{{context}}\n"
+    "CURRENT LOCATION: {{location}}\n\n"
+    "SCENE DESCRIPTION:\n"
+    "{{scene}}\n\n"
+    "{{recalled}}"
+
+    "EXAMPLES:\n"
+    "Current='Living Room', Scene='bedroom is north' + Input='go to bedroom' → n\n"
+    "Current='Back Alley', Scene='...' + Input='go to the alley' → (empty)\n"
+    "Current='Street', Scene='alley runs north' + Input='go to alley' → n\n"
+    "Scene='door south leads outside' + Input='go outside' → s\n"
+    "Scene='has coat, boots, scarf' + Input='wear winter clothes' → wear coat\n"
+    "Input='put on coat and boots' → wear coat\n"
+    "Input='read the letter' → read letter\n"
+    "Input='whats around' → l\n"
+    "Input='what do i have' → i\n"
+    "Input='take sword and shield' → take sword and shield\n"
+    "Input='take coin, gem, and ring' → take coin, gem, ring\n"
+    "Input='take all from bag' → take all from bag\n"
+    "Input='drop everything except sword' → drop all except sword\n"
+    "Input='open the red door and go north' → open red door. n\n"
+    "Input='unlock the iron door with the brass key, then enter' → unlock iron door with brass key. in\n"
+    "Input='take the key and unlock the blue door with it' → take key. unlock blue door with key\n"
+    "Input='go somewhere unclear' → (empty, don't guess)\n"
+    "{{examples}}";
+
+static int add_segment(int slot, const char *text, size_t len)
+{
+    glk_llm_segment_t *newsegs = realloc(segments, (numsegments + 1) * sizeof(glk_llm_segment_t));
+    if (!newsegs) return 0;
+    segments = newsegs;
+
+    glk_llm_segment_t *seg = &segments[numsegments];
+    seg->slot = slot;
+    seg->text = NULL;
+    seg->len = 0;
+
+    if (slot == llmslot_None) {
+        // Escape the literal run once, here, rather than every turn
+        glk_llm_strbuf_t raw, escaped;
+        gli_llm_strbuf_init(&raw);
+        gli_llm_strbuf_init(&escaped);
+        if (!gli_llm_strbuf_append(&raw, text, len)
+            || !gli_llm_strbuf_append_json(&escaped, raw.buf)) {
+            gli_llm_strbuf_free(&raw);
+            gli_llm_strbuf_free(&escaped);
+            return 0;
+        }
+        gli_llm_strbuf_free(&raw);
+        seg->text = escaped.buf;
+        seg->len = escaped.len;
+    }
+
+    numsegments++;
+    return 1;
+}
+
+static int find_slot(const char *name, size_t len)
+{
+    // Allow whitespace inside the braces: {{ context }}
+    while (len && (*name == ' ' || *name == '\t')) {
+        name++;
+        len--;
+    }
+    while (len && (name[len-1] == ' ' || name[len-1] == '\t'))
+        len--;
+
+    for (int ix = 0; ix < llmslot_NumSlots; ix++) {
+        if (strlen(slot_names[ix]) == len && strncmp(slot_names[ix], name, len) == 0)
+            return ix;
+    }
+    return llmslot_None;
+}
+
+static int parse_template(const char *text)
+{
+    const char *literal = text;
+    const char *p = text;
+
+    while ((p = strstr(p, "{{")) != NULL) {
+        const char *close = strstr(p + 2, "}}");
+        if (!close) break;
+
+        int slot = find_slot(p + 2, close - (p + 2));
+        if (slot == llmslot_None) {
+            // Unknown slot names are left in place as literal text
+            p += 2;
+            continue;
+        }
+
+        if (p > literal && !add_segment(llmslot_None, literal, p - literal))
+            return 0;
+        if (!add_segment(slot, NULL, 0))
+            return 0;
+
+        p = close + 2;
+        literal = p;
+    }
+
+    if (*literal && !add_segment(llmslot_None, literal, strlen(literal)))
+        return 0;
+
+    return 1;
+}
+
+static char *read_template_file(const char *filename)
+{
+    FILE *f = fopen(filename, "rb");
+    if (!f) return NULL;
+
+    glk_llm_strbuf_t sb;
+    gli_llm_strbuf_init(&sb);
+
+    char chunk[1024];
+    size_t count;
+    while ((count = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+        if (!gli_llm_strbuf_append(&sb, chunk, count)) {
+            gli_llm_strbuf_free(&sb);
+            fclose(f);
+            return NULL;
+        }
+    }
+
+    fclose(f);
+    return sb.buf;
+}
+
+/* Load and compile the prompt template. With no filename, or if the
+   file can't be read, the built-in prompt is used. Returns 1 if the
+   named file was loaded. */
+int gli_llm_template_load(const char *filename)
+{
+    int loaded = 0;
+
+    gli_llm_template_free();
+
+    if (filename && filename[0]) {
+        char *text = read_template_file(filename);
+        if (text) {
+            loaded = parse_template(text);
+            free(text);
+            if (!loaded)
+                gli_llm_template_free();
+        }
+    }
+
+    if (!loaded)
+        parse_template(builtin_template);
+
+    return loaded;
+}
+
+void gli_llm_template_free(void)
+{
+    for (int ix = 0; ix < numsegments; ix++)
+        free(segments[ix].text);
+    free(segments);
+    segments = NULL;
+    numsegments = 0;
+}
+
+/* Append the rendered (JSON-escaped) system prompt to body. The literal
+   segments are referenced, not copied, so the template must not be
+   reloaded while the body is alive. slots is an array of
+   llmslot_NumSlots raw strings; NULL entries render as empty. */
+int gli_llm_template_render(glk_llm_body_t *body, const char **slots)
+{
+    if (!numsegments)
+        gli_llm_template_load(NULL);
+
+    for (int ix = 0; ix < numsegments; ix++) {
+        glk_llm_segment_t *seg = &segments[ix];
+        if (seg->slot == llmslot_None)
+            gli_llm_body_static(body, seg->text, seg->len);
+        else if (slots[seg->slot])
+            gli_llm_body_json(body, slots[seg->slot]);
+    }
+
+    return !body->failed;
+}
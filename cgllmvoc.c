@@ -0,0 +1,360 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "glk.h"
+#include "cheapglk.h"
+#include "glk_llm.h"
+
+/* Game vocabulary. The game tells us, as it goes, which words it knows:
+   the names of things turn up in its output, and commands it accepts
+   are made of words it understood. It also tells us what it doesn't
+   know: "I don't know the word "xyzzy".", "That's not a verb I
+   recognise.", and "You can't see any such thing." (that word means
+   nothing here, at least until the player moves on).
+
+   With vocabulary=1 this is collected in a word table and used two
+   ways. Input that is already a plain command (a standard verb, or a
+   direction, followed only by words the game has used) goes to the game
+   as typed, without asking the model. And a command from the model that
+   uses a word the game has never shown, or has said it doesn't know, is
+   thrown out before it costs a game turn; the model is asked once more,
+   told which words to avoid.
+
+   Neither is done until the game has printed a few dozen distinct
+   words, so an empty table early on doesn't reject everything.
+
+   spelling=1 collects the same words (and passes them on to the
+   spelling index, cgllmspl.c), so that a corrected input which turns
+   out to be a plain command can skip the model too.
+*/
+
+#define GLK_LLM_VOCAB_SIZE 4096
+#define GLK_LLM_VOCAB_MIN 24
+
+#define vocab_Verb (0x01)       /* standard verb */
+#define vocab_Direction (0x02)
+#define vocab_Function (0x04)   /* article, preposition, pronoun */
+#define vocab_Seen (0x08)       /* in the game's output */
+#define vocab_Accepted (0x10)   /* in a command the game took */
+#define vocab_Unknown (0x20)    /* the game said it doesn't know it */
+#define vocab_Absent (0x40)     /* "can't see any such thing", this room */
+#define vocab_NotVerb (0x80)    /* "not a verb I recognise" */
+
+typedef struct {
+    char word[24];
+    unsigned char flags;
+} vocab_entry_t;
+
+static vocab_entry_t table[GLK_LLM_VOCAB_SIZE];
+static int numwords = 0;
+static int numseen = 0;
+static int initialized = 0;
+
+static const char *standard_verbs[] = {
+    "look", "l", "examine", "x", "read", "search", "take", "get", "pick",
+    "drop", "put", "insert", "open", "close", "shut", "unlock", "lock",
+    "push", "pull", "move", "turn", "switch", "wear", "remove", "eat",
+    "drink", "give", "show", "ask", "tell", "talk", "answer", "attack",
+    "hit", "break", "climb", "enter", "exit", "leave", "go", "walk", "run",
+    "inventory", "i", "inv", "wait", "z", "again", "g", "listen", "smell",
+    "touch", "feel", "taste", "jump", "sleep", "wake", "throw", "fill",
+    "empty", "light", "tie", "cut", "dig", "burn", "sit", "stand", "lie",
+    "kiss", "buy", "pray", "think", "say", "shout", "yes", "no", "quit",
+    "save", "restore", "restart", "undo", "score", "verbose", "brief",
+    "help", "hint", NULL
+};
+
+static const char *directions[] = {
+    "n", "s", "e", "w", "ne", "nw", "se", "sw", "u", "d", "north", "south",
+    "east", "west", "northeast", "northwest", "southeast", "southwest",
+    "up", "down", "in", "out", NULL
+};
+
+static const char *function_words[] = {
+    "the", "a", "an", "my", "your", "this", "that", "these", "those", "it",
+    "them", "him", "her", "all", "everything", "some", "to", "at", "on",
+    "in", "into", "onto", "off", "out", "of", "from", "with", "under",
+    "behind", "over", "through", "across", "about", "up", "down", "and",
+    "then", "except", "but", "inside", "for", "using", NULL
+};
+
+static vocab_entry_t *lookup(const char *word, size_t len, int create)
+{
+    if (len == 0 || len >= sizeof(table[0].word))
+        return NULL;
+
+    glk_llm_hash_t hash = gli_llm_hash(word, len, 0);
+    for (int probe = 0; probe < GLK_LLM_VOCAB_SIZE; probe++) {
+        vocab_entry_t *entry = &table[(hash + probe) & (GLK_LLM_VOCAB_SIZE - 1)];
+        if (!entry->word[0]) {
+            // Keep a quarter free so probes stay short
+            if (!create || numwords >= GLK_LLM_VOCAB_SIZE * 3 / 4)
+                return NULL;
+            memcpy(entry->word, word, len);
+            entry->word[len] = '\0';
+            numwords++;
+            return entry;
+        }
+        if (strncmp(entry->word, word, len) == 0 && entry->word[len] == '\0')
+            return entry;
+    }
+    return NULL;
+}
+
+static void mark_list(const char **words, unsigned char flag)
+{
+    for (int ix = 0; words[ix]; ix++) {
+        vocab_entry_t *entry = lookup(words[ix], strlen(words[ix]), TRUE);
+        if (entry)
+            entry->flags |= flag;
+        if (gli_llm_config.spelling)
+            gli_llm_spell_add(words[ix]);
+    }
+}
+
+static void vocab_init(void)
+{
+    if (initialized)
+        return;
+    initialized = 1;
+    mark_list(standard_verbs, vocab_Verb);
+    mark_list(directions, vocab_Direction);
+    mark_list(function_words, vocab_Function);
+}
+
+/* Split text into lower-case words. Returns the number found; a word
+   with non-ASCII letters in it is returned empty. */
+static int split_words(const char *text, char words[][24], int max)
+{
+    int count = 0;
+    const char *p = text;
+
+    while (*p && count < max) {
+        while (*p && !isalnum((unsigned char)*p) && !((unsigned char)*p & 0x80))
+            p++;
+        if (!*p)
+            break;
+        size_t len = 0;
+        int ascii = 1;
+        while (*p && (isalnum((unsigned char)*p) || ((unsigned char)*p & 0x80))) {
+            if ((unsigned char)*p & 0x80)
+                ascii = 0;
+            if (len < sizeof(words[0]) - 1)
+                words[count][len] = tolower((unsigned char)*p);
+            len++;
+            p++;
+        }
+        if (!ascii || len >= sizeof(words[0]))
+            len = 0;
+        words[count][len] = '\0';
+        count++;
+    }
+    return count;
+}
+
+static int is_number(const char *word)
+{
+    for (; *word; word++) {
+        if (!isdigit((unsigned char)*word))
+            return 0;
+    }
+    return 1;
+}
+
+static void mark_words(const char *text, unsigned char flag, int skip_first)
+{
+    char words[32][24];
+    int count = split_words(text, words, 32);
+    for (int ix = skip_first ? 1 : 0; ix < count; ix++) {
+        vocab_entry_t *entry = lookup(words[ix], strlen(words[ix]), TRUE);
+        if (!entry)
+            continue;
+        // Nouns only, for what the game couldn't see
+        if (flag == vocab_Absent && (entry->flags & (vocab_Function | vocab_Direction)))
+            continue;
+        if (flag == vocab_Seen && !(entry->flags & vocab_Seen))
+            numseen++;
+        entry->flags |= flag;
+        if (flag == vocab_Seen && gli_llm_config.spelling && !is_number(words[ix]))
+            gli_llm_spell_add(words[ix]);
+    }
+}
+
+/* Is anything using the word table? */
+static int collecting(void)
+{
+    return (gli_llm_config.vocabulary || gli_llm_config.spelling || gli_llm_config.phrasebook[0]);
+}
+
+/* Learn from a line of game output. Called from gli_llm_add_context(). */
+void gli_llm_vocab_add_output(const char *text)
+{
+    if (!collecting())
+        return;
+    vocab_init();
+
+    if (gli_llm_is_room_header(text)) {
+        // Things that weren't here may be in the new room
+        for (int ix = 0; ix < GLK_LLM_VOCAB_SIZE; ix++)
+            table[ix].flags &= ~vocab_Absent;
+    }
+
+    // I don't know the word "xyzzy". / The word "xyzzy" is not necessary...
+    const char *quote = gli_llm_find_nocase(text, "word \"");
+    if (!quote)
+        quote = gli_llm_find_nocase(text, "word '");
+    if (quote) {
+        const char *start = quote + 6;
+        const char *end = strchr(start, quote[5]);
+        if (end) {
+            char word[24];
+            size_t len = end - start;
+            if (len < sizeof(word)) {
+                for (size_t ix = 0; ix < len; ix++)
+                    word[ix] = tolower((unsigned char)start[ix]);
+                vocab_entry_t *entry = lookup(word, len, TRUE);
+                if (entry)
+                    entry->flags |= vocab_Unknown;
+            }
+        }
+        return;
+    }
+
+    if (gli_llm_find_nocase(text, "not a verb I recogni")) {
+        char words[1][24];
+        if (split_words(gli_llm_sent_command(), words, 1) == 1) {
+            vocab_entry_t *entry = lookup(words[0], strlen(words[0]), TRUE);
+            if (entry)
+                entry->flags |= vocab_NotVerb;
+        }
+        return;
+    }
+
+    if (gli_llm_find_nocase(text, "can't see any such thing")) {
+        mark_words(gli_llm_sent_command(), vocab_Absent, TRUE);
+        return;
+    }
+
+    if (gli_llm_is_parser_error(text))
+        return;
+    mark_words(text, vocab_Seen, FALSE);
+}
+
+/* The game has asked for input again; if it took the last command, its
+   words are good. */
+void gli_llm_vocab_settle(int rejected)
+{
+    if (!collecting() || rejected)
+        return;
+    vocab_init();
+    mark_words(gli_llm_sent_command(), vocab_Accepted, FALSE);
+}
+
+/* Is word one of the standard verbs? (Whatever the configuration.) */
+int gli_llm_vocab_is_verb(const char *word)
+{
+    vocab_init();
+    vocab_entry_t *entry = lookup(word, strlen(word), FALSE);
+    return (entry && (entry->flags & vocab_Verb) && !(entry->flags & vocab_NotVerb));
+}
+
+static int enforcing(void)
+{
+    return ((gli_llm_config.vocabulary || gli_llm_config.spelling) && numseen >= GLK_LLM_VOCAB_MIN);
+}
+
+/* Is input already a command the game should understand: a standard
+   verb (or a direction) and then only words the game has used? "go"
+   and the like must be followed by a direction. */
+int gli_llm_vocab_command(const char *input)
+{
+    if (!enforcing())
+        return 0;
+    return gli_llm_vocab_plain(input);
+}
+
+/* The same test, however few words the game has shown so far (for
+   input that has been rewritten, where a false no only means asking
+   the model). */
+int gli_llm_vocab_plain(const char *input)
+{
+    vocab_init();
+    for (const char *p = input; *p; p++) {
+        if (!isalnum((unsigned char)*p) && *p != ' ' && *p != '-' && *p != '\'')
+            return 0;
+    }
+
+    char words[16][24];
+    int count = split_words(input, words, 16);
+    if (count == 0 || count == 16)
+        return 0;
+
+    vocab_entry_t *verb = lookup(words[0], strlen(words[0]), FALSE);
+    if (!verb || (verb->flags & (vocab_NotVerb | vocab_Unknown)))
+        return 0;
+    if (verb->flags & vocab_Direction)
+        return (count == 1);
+    if (!(verb->flags & vocab_Verb))
+        return 0;
+
+    int moving = (strcmp(words[0], "go") == 0 || strcmp(words[0], "walk") == 0
+        || strcmp(words[0], "run") == 0);
+    int directions_seen = 0, nouns = 0;
+
+    for (int ix = 1; ix < count; ix++) {
+        vocab_entry_t *entry = lookup(words[ix], strlen(words[ix]), FALSE);
+        if (!entry)
+            return 0;
+        if (entry->flags & (vocab_Unknown | vocab_Absent))
+            return 0;
+        if (entry->flags & vocab_Direction)
+            directions_seen++;
+        else if (entry->flags & vocab_Function)
+            continue;
+        else if (entry->flags & (vocab_Seen | vocab_Accepted))
+            nouns++;
+        else
+            return 0;
+    }
+
+    if (moving)
+        return (directions_seen == 1 && nouns == 0);
+    return 1;
+}
+
+/* Does a command from the model use only words the game might know?
+   If not, returns 0 and appends the offending words to unknown. */
+int gli_llm_vocab_check(const char *command, char *unknown, size_t len)
+{
+    if (!gli_llm_config.vocabulary || !enforcing())
+        return 1;
+
+    char words[16][24];
+    int count = split_words(command, words, 16);
+    int ok = 1;
+
+    for (int ix = 0; ix < count; ix++) {
+        if (!words[ix][0] || is_number(words[ix]))
+            continue;
+        vocab_entry_t *entry = lookup(words[ix], strlen(words[ix]), FALSE);
+        int bad;
+        if (ix == 0)
+            bad = (entry && (entry->flags & (vocab_Unknown | vocab_NotVerb)));
+        else if (!entry)
+            bad = 1;
+        else if (entry->flags & (vocab_Unknown | vocab_Absent))
+            bad = 1;
+        else
+            bad = !(entry->flags & (vocab_Function | vocab_Direction | vocab_Verb
+                | vocab_Seen | vocab_Accepted));
+        if (!bad)
+            continue;
+
+        ok = 0;
+        size_t used = strlen(unknown);
+        if (used + strlen(words[ix]) + 3 < len)
+            snprintf(unknown + used, len - used, "%s%s", used ? ", " : "", words[ix]);
+    }
+    return ok;
+}
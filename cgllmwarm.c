@@ -0,0 +1,210 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef WASM_BUILD
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/time.h>
+#endif
+#include "glk.h"
+#include "cheapglk.h"
+#include "glk_llm.h"
+
+/* Keeping a local model loaded. Ollama-style servers load a model on
+   the first request and unload it after a few idle minutes, and a load
+   takes seconds, so the player would wait on the first command and
+   again after every long read.
+
+   keep_alive= is passed on every request, so the server keeps the model
+   for that long after it. warmup=1 sends a minimal request to each
+   configured model when the library starts, in the background, so the
+   load is under way while the game prints its banner. heartbeat_s=N
+   repeats that request every N seconds while the game is waiting for a
+   line of input, so the model stays resident however long the player
+   takes.
+
+   Warm-ups and heartbeats go straight to HTTP, bypassing the cassette,
+   and their answers are ignored, apart from their token usage, which
+   counts against the session's budget like any other. Once the budget
+   is spent, they stop.
+*/
+
+/* Add "keep_alive":... (with a trailing comma) if configured. Plain
+   numbers are seconds and go out as JSON numbers; anything else ("30m")
+   as a string. */
+void gli_llm_body_options(glk_llm_body_t *body)
+{
+    const char *keep = gli_llm_config.keep_alive;
+    if (!keep[0])
+        return;
+
+    const char *p = keep;
+    if (*p == '-')
+        p++;
+    int numeric = (*p != '\0');
+    for (; *p; p++) {
+        if (*p < '0' || *p > '9')
+            numeric = 0;
+    }
+
+    BODY_LITERAL(body, "\"keep_alive\":");
+    if (numeric) {
+        gli_llm_body_str(body, keep);
+    } else {
+        BODY_LITERAL(body, "\"");
+        gli_llm_body_json(body, keep);
+        BODY_LITERAL(body, "\"");
+    }
+    BODY_LITERAL(body, ",");
+}
+
+#ifndef WASM_BUILD
+
+static void build_warmup(glk_llm_body_t *body, const char *model)
+{
+    gli_llm_body_init(body);
+    BODY_LITERAL(body, "{\"model\":\"");
+    gli_llm_body_json(body, model);
+    BODY_LITERAL(body, "\",\"messages\":[{\"role\":\"user\",\"content\":\"\"}],");
+    gli_llm_body_options(body);
+    BODY_LITERAL(body, "\"max_tokens\":1}");
+}
+
+/* The job's sender: post, and count what it cost. */
+static int warm_post(const char *url, const char *api_key, int timeout_ms,
+    glk_llm_body_t *body, glk_llm_strbuf_t *response, int *status)
+{
+    int code = 0;
+    int ok = gli_llm_post(url, api_key, timeout_ms, body, response, &code);
+    if (ok && code == 200 && response->buf)
+        gli_llm_usage_record(body, response->buf);
+    if (status)
+        *status = code;
+    return ok;
+}
+
+/* Send a warm-up to one model, in the background, and forget it. */
+static void warm_model(const char *endpoint, const char *api_key, const char *model)
+{
+    if (!endpoint[0] || !gli_llm_budget_left())
+        return;
+
+    glk_llm_body_t body;
+    build_warmup(&body, model[0] ? model : "gpt-3.5-turbo");
+    glk_llm_job_t *job = gli_llm_job_start(warm_post, endpoint, api_key, 0, &body);
+    gli_llm_job_release(job);
+}
+
+static void warm_models(void)
+{
+    if (gli_llm_config.cassette_mode == llmcassette_Replay)
+        return;
+
+    warm_model(gli_llm_config.api_endpoint, gli_llm_config.api_key, gli_llm_config.model);
+
+    if (gli_llm_config.fast_model[0] || gli_llm_config.fast_endpoint[0]) {
+        warm_model(
+            gli_llm_config.fast_endpoint[0] ? gli_llm_config.fast_endpoint : gli_llm_config.api_endpoint,
+            gli_llm_config.fast_api_key[0] ? gli_llm_config.fast_api_key : gli_llm_config.api_key,
+            gli_llm_config.fast_model[0] ? gli_llm_config.fast_model : gli_llm_config.model);
+    }
+}
+
+static pthread_mutex_t heartbeat_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t heartbeat_cond = PTHREAD_COND_INITIALIZER;
+static int heartbeat_running = 0;
+static int heartbeat_stop = 0;
+static int input_pending = 0;
+
+/* Sends a heartbeat whenever input has been pending for a whole
+   interval. Input arriving restarts the interval; real requests keep
+   the model loaded in between. */
+static void *heartbeat_thread(void *rock)
+{
+    pthread_mutex_lock(&heartbeat_lock);
+    while (!heartbeat_stop) {
+        while (!heartbeat_stop && !input_pending)
+            pthread_cond_wait(&heartbeat_cond, &heartbeat_lock);
+        if (heartbeat_stop)
+            break;
+
+        struct timeval now;
+        struct timespec until;
+        gettimeofday(&now, NULL);
+        until.tv_sec = now.tv_sec + gli_llm_config.heartbeat_s;
+        until.tv_nsec = now.tv_usec * 1000;
+
+        int timedout = 0;
+        while (!heartbeat_stop && input_pending && !timedout)
+            timedout = (pthread_cond_timedwait(&heartbeat_cond, &heartbeat_lock, &until) == ETIMEDOUT);
+        if (!timedout || heartbeat_stop)
+            continue;
+
+        pthread_mutex_unlock(&heartbeat_lock);
+        warm_models();
+        pthread_mutex_lock(&heartbeat_lock);
+    }
+    heartbeat_running = 0;
+    pthread_mutex_unlock(&heartbeat_lock);
+    return NULL;
+}
+
+/* Called from gli_llm_init(). */
+void gli_llm_warmup_start(void)
+{
+    if (!gli_llm_config.enabled || gli_llm_config.cassette_mode == llmcassette_Replay)
+        return;
+
+    if (gli_llm_config.warmup)
+        warm_models();
+
+    if (gli_llm_config.heartbeat_s > 0 && !heartbeat_running) {
+        pthread_t thread;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        heartbeat_stop = 0;
+        if (pthread_create(&thread, &attr, heartbeat_thread, NULL) == 0)
+            heartbeat_running = 1;
+        pthread_attr_destroy(&attr);
+    }
+}
+
+/* Called from gli_llm_exit(). */
+void gli_llm_warmup_stop(void)
+{
+    pthread_mutex_lock(&heartbeat_lock);
+    heartbeat_stop = 1;
+    pthread_cond_broadcast(&heartbeat_cond);
+    pthread_mutex_unlock(&heartbeat_lock);
+}
+
+/* glk_select() calls this around reading a line: heartbeats only go
+   out while the player is reading or typing. */
+void gli_llm_input_pending(int pending)
+{
+    if (!heartbeat_running)
+        return;
+
+    pthread_mutex_lock(&heartbeat_lock);
+    input_pending = pending;
+    pthread_cond_broadcast(&heartbeat_cond);
+    pthread_mutex_unlock(&heartbeat_lock);
+}
+
+#else /* WASM_BUILD */
+
+void gli_llm_warmup_start(void)
+{
+}
+
+void gli_llm_warmup_stop(void)
+{
+}
+
+void gli_llm_input_pending(int pending)
+{
+}
+
+#endif /* WASM_BUILD */
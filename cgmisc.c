@@ -98,6 +98,7 @@ void glk_exit()
 {
     if (gli_debugger)
         gidebug_announce_cycle(gidebug_cycle_End);
+    gli_llm_exit();
     exit(0);
 }
 
@@ -223,6 +224,17 @@ void glk_select(event_t *event)
         char buf[256];
         int val;
         glui32 ix;
+        int queued = FALSE;
+        int raw = FALSE;
+
+        if (gli_llm_config.enabled) {
+            /* Decide from the prompt before anything else is printed */
+            raw = gli_llm_is_raw_prompt(gli_llm_pending_output(), win->linebuflen);
+            gli_llm_new_turn();
+            gli_llm_prepare_input();
+            if (!raw)
+                gli_llm_prefetch_start();
+        }
 
         while (1) {
             /* If debug mode is on, it may capture input, in which case
@@ -239,6 +251,7 @@ void glk_select(event_t *event)
 
                 val = strlen(buf);
                 printf("[Auto: %s]\n", buf);
+                queued = TRUE;
                 break;
             }
 
@@ -249,7 +262,9 @@ void glk_select(event_t *event)
             }
             res = buf;
 #else
-            res = fgets(buf, 255, stdin);
+            gli_llm_input_pending(TRUE);
+            res = gli_llm_read_line(buf, 255, !raw);
+            gli_llm_input_pending(FALSE);
             if (!res) {
                 printf("\n<end of input>\n");
                 glk_exit();
@@ -274,8 +289,9 @@ void glk_select(event_t *event)
         if (val && (buf[val-1] == '\n' || buf[val-1] == '\r'))
             val--;
 
-        /* LLM processing */
-        if (gli_llm_config.enabled && val > 0) {
+        /* LLM processing. Queued commands have already been through
+           the model. */
+        if (gli_llm_config.enabled && val > 0 && !queued) {
             char original_input[256];
             char interpreted_input[256];
 
@@ -283,8 +299,9 @@ void glk_select(event_t *event)
             original_input[val] = '\0';
 
             /* Players can skip LLm interpretation by wrapping their
-               input with [] */
-            int skip_llm = 0;
+               input with []. Answers to free-text prompts (names,
+               passwords) skip it automatically. */
+            int skip_llm = raw;
 
             if (original_input[0] == '[' && val > 1 && original_input[val-1] == ']') {
                 skip_llm = 1;
@@ -297,6 +314,10 @@ void glk_select(event_t *event)
                 buf[val] = '\0';
             }
 
+            gli_llm_context.num_alternates = 0;
+            gli_llm_context.next_alternate = 0;
+            gli_llm_context.tier = llmtier_None;
+
             strncpy(gli_llm_context.last_user_input, original_input, sizeof(gli_llm_context.last_user_input) - 1);
             gli_llm_context.last_user_input[sizeof(gli_llm_context.last_user_input) - 1] = '\0';
 
@@ -307,8 +328,14 @@ void glk_select(event_t *event)
                 strncpy(buf, interpreted_input, 255);
                 buf[255] = '\0';
                 val = strlen(buf);
+                gli_llm_add_history(original_input, interpreted_input);
+                gli_llm_memory_propose(original_input, interpreted_input);
+            }
+            else {
+                gli_llm_add_history(original_input, NULL);
             }
         }
+        gli_llm_context.parser_error = 0;
 
         if (!gli_utf8input) {
             if (val > win->linebuflen)
@@ -9,6 +9,72 @@
 static char gli_llm_output_buffer[512];
 static int gli_llm_output_buffer_pos = 0;
 
+/* The output line in progress, i.e. whatever the game printed after the
+   last newline. When a line request starts, this is the prompt. */
+const char *gli_llm_pending_output(void)
+{
+    gli_llm_output_buffer[gli_llm_output_buffer_pos] = '\0';
+    return gli_llm_output_buffer;
+}
+
+/* End the output line in progress, as if a newline had been printed.
+   Called when a line request starts, so the prompt isn't glued to the
+   front of the next turn's output. A bare ">" prompt is dropped. */
+void gli_llm_flush_output(void)
+{
+    int len = gli_llm_output_buffer_pos;
+    while (len > 0 && (gli_llm_output_buffer[len-1] == ' '
+        || gli_llm_output_buffer[len-1] == '\t' || gli_llm_output_buffer[len-1] == '>'))
+        len--;
+    gli_llm_output_buffer[len] = '\0';
+    if (len > 0)
+        gli_llm_add_context(gli_llm_output_buffer);
+    gli_llm_output_buffer_pos = 0;
+}
+
+/* Track window output for LLM context, a line at a time. Characters
+   are Latin-1 or Unicode code points; they are kept as UTF-8. */
+static void gli_llm_capture_char(glui32 ch)
+{
+    if (!gli_llm_config.enabled)
+        return;
+
+    int room = sizeof(gli_llm_output_buffer) - 1 - gli_llm_output_buffer_pos;
+    if (ch == '\t' || (ch >= 32 && ch < 0x80)) {
+        if (room >= 1)
+            gli_llm_output_buffer[gli_llm_output_buffer_pos++] = ch;
+    }
+    else if (ch >= 0xA0 && ch < 0x800) {
+        if (room >= 2) {
+            gli_llm_output_buffer[gli_llm_output_buffer_pos++] = 0xC0 | (ch >> 6);
+            gli_llm_output_buffer[gli_llm_output_buffer_pos++] = 0x80 | (ch & 0x3F);
+        }
+    }
+    else if (ch >= 0x800 && ch < 0x10000) {
+        if (room >= 3) {
+            gli_llm_output_buffer[gli_llm_output_buffer_pos++] = 0xE0 | (ch >> 12);
+            gli_llm_output_buffer[gli_llm_output_buffer_pos++] = 0x80 | ((ch >> 6) & 0x3F);
+            gli_llm_output_buffer[gli_llm_output_buffer_pos++] = 0x80 | (ch & 0x3F);
+        }
+    }
+    else if (ch >= 0x10000 && ch < 0x110000) {
+        if (room >= 4) {
+            gli_llm_output_buffer[gli_llm_output_buffer_pos++] = 0xF0 | (ch >> 18);
+            gli_llm_output_buffer[gli_llm_output_buffer_pos++] = 0x80 | ((ch >> 12) & 0x3F);
+            gli_llm_output_buffer[gli_llm_output_buffer_pos++] = 0x80 | ((ch >> 6) & 0x3F);
+            gli_llm_output_buffer[gli_llm_output_buffer_pos++] = 0x80 | (ch & 0x3F);
+        }
+    }
+
+    if (ch == '\n' || gli_llm_output_buffer_pos >= (int)sizeof(gli_llm_output_buffer) - 4) {
+        if (gli_llm_output_buffer_pos > 0) {
+            gli_llm_output_buffer[gli_llm_output_buffer_pos] = '\0';
+            gli_llm_add_context(gli_llm_output_buffer);
+            gli_llm_output_buffer_pos = 0;
+        }
+    }
+}
+
 /* This implements pretty much what any Glk implementation needs for 
     stream stuff. Memory streams, file streams (using stdio functions), 
     and window streams (which just print to stdout.) A fancier 
@@ -679,20 +745,7 @@ static void gli_put_char(stream_t *str, unsigned char ch)
                 gli_put_char(str->win->echostr, ch);
 
             /* Track output for LLM context */
-            if (gli_llm_config.enabled) {
-                if (ch >= 32 || ch == '\t') {
-                    if (gli_llm_output_buffer_pos < sizeof(gli_llm_output_buffer) - 1) {
-                        gli_llm_output_buffer[gli_llm_output_buffer_pos++] = ch;
-                    }
-                }
-                if (ch == '\n' || gli_llm_output_buffer_pos >= sizeof(gli_llm_output_buffer) - 1) {
-                    if (gli_llm_output_buffer_pos > 0) {
-                        gli_llm_output_buffer[gli_llm_output_buffer_pos] = '\0';
-                        gli_llm_add_context(gli_llm_output_buffer);
-                        gli_llm_output_buffer_pos = 0;
-                    }
-                }
-            }
+            gli_llm_capture_char(ch);
             break;
         case strtype_File:
             gli_stream_ensure_op(str, filemode_Write);
@@ -765,6 +818,7 @@ static void gli_put_char_uni(stream_t *str, glui32 ch)
                 gli_putchar_utf8(ch, stdout);
             if (str->win->echostr)
                 gli_put_char_uni(str->win->echostr, ch);
+            gli_llm_capture_char(ch);
             break;
         case strtype_File:
             gli_stream_ensure_op(str, filemode_Write);
@@ -868,6 +922,8 @@ static void gli_put_buffer(stream_t *str, char *buf, glui32 len)
             }
             if (str->win->echostr)
                 gli_put_buffer(str->win->echostr, buf, len);
+            for (lx=0; lx<len; lx++)
+                gli_llm_capture_char(((unsigned char *)buf)[lx]);
             break;
         case strtype_File:
             gli_stream_ensure_op(str, filemode_Write);
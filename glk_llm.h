@@ -1,10 +1,42 @@
 #ifndef GLK_LLM_H
 #define GLK_LLM_H
 
+#include <stddef.h>
+#include <stdint.h>
 #include "glk.h"
 
 #define GLK_LLM_BUFFER_SIZE 4096
-#define GLK_LLM_CONTEXT_LINES 20
+#define GLK_LLM_CONTEXT_LINES 64
+#define GLK_LLM_HISTORY_LINES 8
+#define GLK_LLM_MAX_PATTERNS 16
+#define GLK_LLM_MAX_CANDIDATES 5
+#define GLK_LLM_MEMORY_MAX 64
+
+/* Growable string buffer used to assemble prompts and responses
+   (cgllmnet.c). */
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t size;
+} glk_llm_strbuf_t;
+
+/* A request body, kept as a list of pieces so that long-lived text (the
+   compiled prompt) can be sent without copying. A piece with a NULL
+   text pointer lives in dyn at the given offset. */
+typedef struct {
+    const char *text;
+    size_t offset;
+    size_t len;
+} glk_llm_piece_t;
+
+typedef struct {
+    glk_llm_piece_t *pieces;
+    int numpieces;
+    int maxpieces;
+    glk_llm_strbuf_t dyn;
+    size_t len;
+    int failed;
+} glk_llm_body_t;
 
 typedef struct {
     int enabled;
@@ -12,31 +44,312 @@ typedef struct {
     char api_key[256];
     char model[128];
     int context_lines;
+    int context_mode;
+    int context_turns;
+    int context_tokens;
+    char tokenizer[512];
     int timeout_ms;
+    char fast_endpoint[512];
+    char fast_api_key[256];
+    char fast_model[128];
+    int fast_timeout_ms;
+    char keep_alive[32];
+    int warmup;
+    int heartbeat_s;
+    int line_editor;
+    int speculate_ms;
+    int prefetch;
+    int vocabulary;
+    int spelling;
+    int pronouns;
+    int disambiguation;
+    char phrasebook[512];
+    int recall;
+    int recall_tokens;
+    char shared_cache[256];
+    int shared_cache_entries;
+    char broker_socket[256];
+    int conversation;
+    int conversation_budget;
+    char log_file[512];
     int echo_interpretation;
+    char prompt_template[512];
+    int help;
+    int help_wait_ms;
+    char parser_errors[GLK_LLM_MAX_PATTERNS][128];
+    int num_parser_errors;
+    char prices[GLK_LLM_MAX_PATTERNS][128];
+    int num_prices;
+    int budget_tokens;
+    double budget_usd;
+    int usage_summary;
+    int candidates;
+    int memory_size;
+    int memory_examples;
+    int raw_detect;
+    int raw_linebuf_max;
+    char raw_patterns[GLK_LLM_MAX_PATTERNS][128];
+    int num_raw_patterns;
+    char interpret_patterns[GLK_LLM_MAX_PATTERNS][128];
+    int num_interpret_patterns;
+    char cassette[512];
+    int cassette_mode;
+    int cassette_timing;
 } glk_llm_config_t;
 
+/* How much recent output goes into the prompt: the last context_lines
+   lines, the last context_turns turns, or everything since the last
+   room header. */
+#define llmcontext_Lines (0)
+#define llmcontext_Turns (1)
+#define llmcontext_Room (2)
+
+/* Which model an interpretation came from. With fast_model or
+   fast_endpoint set, the fast tier is asked first and the main model
+   (api_endpoint/model) only when that fails. Local answers (no request
+   at all) are escalated like the fast tier's. */
+#define llmtier_None (0)
+#define llmtier_Fast (1)
+#define llmtier_Main (2)
+#define llmtier_Local (3)
+
+#define llmcassette_Off (0)
+#define llmcassette_Record (1)
+#define llmcassette_Replay (2)
+
 #define GLK_LLM_MAX_QUEUED_COMMANDS 10
 
 typedef struct {
     char lines[GLK_LLM_CONTEXT_LINES][256];
+    glui32 line_turns[GLK_LLM_CONTEXT_LINES];
     int count;
     int position;
+    glui32 turn;
     char last_user_input[256];
+    char last_command[256];
     char command_queue[GLK_LLM_MAX_QUEUED_COMMANDS][256];
     int queue_head;
     int queue_tail;
     int queue_count;
+    char history[GLK_LLM_HISTORY_LINES][512];
+    int history_count;
+    int history_position;
+    int parser_error;
+    char alternates[GLK_LLM_MAX_CANDIDATES][256];
+    int num_alternates;
+    int next_alternate;
+    int tier;
 } glk_llm_context_t;
 
 extern glk_llm_config_t gli_llm_config;
 extern glk_llm_context_t gli_llm_context;
 
 void gli_llm_init(void);
+void gli_llm_exit(void);
 void gli_llm_load_config(const char *config_file);
 void gli_llm_add_context(const char *text);
+void gli_llm_new_turn(void);
+void gli_llm_add_history(const char *input, const char *command);
 int gli_llm_process_input(const char *input, char *output, glui32 maxlen);
+int gli_llm_post(const char *url, const char *api_key, int timeout_ms,
+    glk_llm_body_t *body, glk_llm_strbuf_t *response, int *status);
+int gli_llm_send(const char *url, const char *api_key, int timeout_ms,
+    glk_llm_body_t *body, glk_llm_strbuf_t *response, int *status);
+int gli_llm_backend_ready(void);
+int gli_llm_queue_command(const char *command);
+int gli_llm_retry_candidate(void);
+int gli_llm_escalate(void);
+void gli_llm_log(const char *fmt, ...);
+void gli_llm_prepare_input(void);
 void gli_llm_check_and_suggest(void);
 int gli_llm_generate_help(const char *user_input, char *output, size_t max_len);
+const char *gli_llm_find_nocase(const char *haystack, const char *needle);
+int gli_llm_is_parser_error(const char *text);
+int gli_llm_is_room_header(const char *text);
+const char *gli_llm_sent_command(void);
+void gli_llm_current_room(char *buf, size_t len);
+int gli_llm_is_raw_prompt(const char *prompt, glui32 linebuflen);
+const char *gli_llm_pending_output(void);
+void gli_llm_flush_output(void);
+void gli_llm_recent_output(glk_llm_strbuf_t *sb);
+glui32 gli_llm_recent_turn(void);
+
+void gli_llm_strbuf_init(glk_llm_strbuf_t *sb);
+void gli_llm_strbuf_free(glk_llm_strbuf_t *sb);
+int gli_llm_strbuf_append(glk_llm_strbuf_t *sb, const char *text, size_t len);
+int gli_llm_strbuf_append_str(glk_llm_strbuf_t *sb, const char *text);
+int gli_llm_strbuf_append_json(glk_llm_strbuf_t *sb, const char *text);
+
+void gli_llm_body_init(glk_llm_body_t *body);
+void gli_llm_body_free(glk_llm_body_t *body);
+void gli_llm_body_static(glk_llm_body_t *body, const char *text, size_t len);
+/* Append a string literal as a static (uncopied) body piece. */
+#define BODY_LITERAL(body, lit) gli_llm_body_static((body), (lit), sizeof(lit) - 1)
+void gli_llm_body_copy(glk_llm_body_t *body, const char *text, size_t len);
+void gli_llm_body_str(glk_llm_body_t *body, const char *text);
+void gli_llm_body_json(glk_llm_body_t *body, const char *text);
+void gli_llm_body_schema(glk_llm_body_t *body, const char *name, const char *property);
+char *gli_llm_body_flatten(const glk_llm_body_t *body);
+
+int gli_llm_http_post(const char *url, const char *api_key, int timeout_ms,
+    glk_llm_body_t *body, glk_llm_strbuf_t *response, int *status);
+
+/* Connections kept open between requests (not available in the WASM
+   build). */
+typedef struct glk_llm_conn_struct glk_llm_conn_t;
+
+glk_llm_conn_t *gli_llm_conn_new(void);
+void gli_llm_conn_free(glk_llm_conn_t *conn);
+int gli_llm_conn_post(glk_llm_conn_t *conn, const char *url, const char *api_key, int timeout_ms,
+    glk_llm_body_t *body, glk_llm_strbuf_t *response, int *status);
+int gli_llm_conn_requests(glk_llm_conn_t *conn);
+
+/* The framed protocol between cheapglk and the glkllmbroker daemon, over
+   a Unix socket. A request is five 32-bit big-endian words (the magic
+   number, the timeout in ms, and the lengths of the URL, API key and
+   body) followed by those three strings, unterminated. The reply is four
+   words (magic, 1 for success or 0, HTTP status, body length) and then
+   the response body. A connection may carry several requests in turn. */
+#define GLK_LLM_BROKER_MAGIC (0x474c4b42)   /* "GLKB" */
+#define GLK_LLM_BROKER_MAX (16 * 1024 * 1024)
+
+int gli_llm_broker_post(const char *sockpath, const char *url, const char *api_key, int timeout_ms,
+    glk_llm_body_t *body, glk_llm_strbuf_t *response, int *status);
+
+char *gli_llm_json_string(const char *json, const char *key);
+int gli_llm_json_string_array(const char *json, const char *key, char *out, size_t outlen, int max);
+int gli_llm_json_number(const char *json, const char *key, double *result);
+
+typedef uint64_t glk_llm_hash_t;
+
+glk_llm_hash_t gli_llm_hash(const void *data, size_t len, glk_llm_hash_t seed);
+glk_llm_hash_t gli_llm_hash_str(const char *text, glk_llm_hash_t seed);
+glk_llm_hash_t gli_llm_body_hash(const glk_llm_body_t *body);
+double gli_llm_now_ms(void);
+
+/* Anything that can carry a request: gli_llm_http_post() itself, or
+   gli_llm_send(), which adds the cassette and other layers on top. */
+typedef int (*glk_llm_sender_t)(const char *url, const char *api_key, int timeout_ms,
+    glk_llm_body_t *body, glk_llm_strbuf_t *response, int *status);
+
+/* Background requests (not available in the WASM build). */
+typedef struct glk_llm_job_struct glk_llm_job_t;
+
+glk_llm_job_t *gli_llm_job_start(glk_llm_sender_t sender,
+    const char *url, const char *api_key, int timeout_ms, glk_llm_body_t *body);
+int gli_llm_job_done(glk_llm_job_t *job);
+int gli_llm_job_wait(glk_llm_job_t *job, int timeout_ms);
+int gli_llm_job_result(glk_llm_job_t *job, glk_llm_strbuf_t *response, int *status);
+void gli_llm_job_release(glk_llm_job_t *job);
+
+/* Prompt template slots (cgllmtpl.c). A template is plain text with
+   {{name}} placeholders; it is split and JSON-escaped once at startup,
+   so each turn only escapes the slot values. */
+#define llmslot_None (-1)
+#define llmslot_Context (0)
+#define llmslot_Scene (1)
+#define llmslot_Location (2)
+#define llmslot_Input (3)
+#define llmslot_History (4)
+#define llmslot_Examples (5)
+#define llmslot_Recalled (6)
+#define llmslot_NumSlots (7)
+
+int gli_llm_template_load(const char *filename);
+void gli_llm_template_free(void);
+int gli_llm_template_render(glk_llm_body_t *body, const char **slots);
+
+/* Record/replay of LLM exchanges (cgllmcas.c). */
+int gli_llm_cassette_open(const char *filename, int mode);
+void gli_llm_cassette_close(void);
+int gli_llm_cassette_replay(glk_llm_body_t *body, glk_llm_strbuf_t *response, int *status);
+void gli_llm_cassette_record(glk_llm_body_t *body, glk_llm_strbuf_t *response, int status, double elapsed_ms);
+
+/* Model warm-up, keep_alive and heartbeats (cgllmwarm.c). */
+void gli_llm_body_options(glk_llm_body_t *body);
+void gli_llm_warmup_start(void);
+void gli_llm_warmup_stop(void);
+void gli_llm_input_pending(int pending);
+
+/* Terminal line editor with speculative interpretation (cgllmedit.c,
+   cgllm.c). */
+char *gli_llm_read_line(char *buf, int len, int speculate);
+void gli_llm_speculate(const char *input);
+void gli_llm_speculate_cancel(void);
+int gli_llm_speculating(const char *input);
+
+/* Predicted next commands, matched locally (cgllmpre.c). */
+void gli_llm_prefetch_start(void);
+void gli_llm_prefetch_stop(void);
+int gli_llm_prefetch_match(const char *input, char *output, size_t len);
+
+/* Vocabulary harvested from the game's output (cgllmvoc.c). */
+void gli_llm_vocab_add_output(const char *text);
+void gli_llm_vocab_settle(int rejected);
+int gli_llm_vocab_command(const char *input);
+int gli_llm_vocab_check(const char *command, char *unknown, size_t len);
+int gli_llm_vocab_plain(const char *input);
+int gli_llm_vocab_is_verb(const char *word);
+
+/* Spelling correction against the game's words (cgllmspl.c). */
+void gli_llm_spell_add(const char *word);
+int gli_llm_spell_correct(const char *input, char *output, size_t len);
+void gli_llm_spell_free(void);
+
+/* Pronouns resolved locally (cgllmref.c). */
+void gli_llm_ref_settle(int rejected);
+int gli_llm_ref_resolve(const char *input, char *output, size_t len);
+
+/* Answers to "Which do you mean...?" (cgllmdis.c). */
+void gli_llm_disambig_settle(void);
+int gli_llm_disambig_answer(const char *input, char *output, size_t len);
+void gli_llm_disambig_stats(void);
+
+/* Phrasebook translation of other languages (cgllmphr.c). */
+int gli_llm_phrasebook_load(const char *filename);
+void gli_llm_phrasebook_free(void);
+int gli_llm_phrasebook_translate(const char *input, char *output, size_t len);
+
+/* Recall of earlier output by BM25 (cgllmrec.c). */
+void gli_llm_recall_add_output(const char *text);
+void gli_llm_recall_end_turn(void);
+void gli_llm_recall(const char *input, glui32 since_turn, glk_llm_strbuf_t *sb);
+void gli_llm_recall_free(void);
+
+/* Interpretation cache shared between processes (cgllmshm.c). */
+int gli_llm_shared_lookup(const char *input, char *output, size_t len);
+void gli_llm_shared_propose(const char *input, const char *command);
+void gli_llm_shared_settle(int rejected);
+void gli_llm_shared_close(void);
+
+/* Local token counting (cgllmtok.c). */
+int gli_llm_tokenizer_load(const char *filename);
+void gli_llm_tokenizer_free(void);
+size_t gli_llm_count_tokens(const char *text, size_t len);
+size_t gli_llm_count_tokens_str(const char *text);
+size_t gli_llm_body_tokens(const glk_llm_body_t *body);
+
+/* Conversation mode for prefix-caching servers (cgllmconv.c). */
+int gli_llm_conversation_started(void);
+void gli_llm_conversation_start(const glk_llm_body_t *system);
+void gli_llm_conversation_reset(void);
+void gli_llm_conversation_messages(glk_llm_body_t *body, const char *input);
+int gli_llm_conversation_response(const char *response);
+int gli_llm_conversation_refused(void);
+void gli_llm_conversation_commit(const char *command);
+
+/* Session memory of accepted interpretations (cgllmmem.c). */
+void gli_llm_memory_propose(const char *input, const char *command);
+void gli_llm_memory_settle(int rejected);
+void gli_llm_memory_examples(const char *input, glk_llm_strbuf_t *sb);
+int gli_llm_memory_lookup(const char *input, char *output, size_t len);
+void gli_llm_normalize(const char *src, char *dest, size_t len, const char *strip);
+
+/* Token and cost accounting, and budgets (cgllmacct.c). */
+void gli_llm_usage_record(const glk_llm_body_t *body, const char *response);
+int gli_llm_budget_allows(void);
+int gli_llm_budget_left(void);
+int gli_llm_budget_exhausted(void);
+void gli_llm_usage_summary(void);
 
 #endif /* GLK_LLM_H */
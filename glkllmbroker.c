@@ -0,0 +1,900 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include "glk.h"
+#include "glk_llm.h"
+
+/* glkllmbroker: one process per host that makes the LLM requests of
+   every cheapglk session on it (broker_socket= in glk_llm.conf).
+
+   Sessions connect over a Unix socket and send requests in the framed
+   protocol described in glk_llm.h. For each endpoint, the broker keeps
+   a small pool of connections that stay open between requests, so a
+   thousand sessions share a handful of TLS connections instead of
+   opening one per request. Requests beyond the pool wait for a free
+   connection.
+
+   Identical requests (same endpoint, key and body) that arrive while
+   one is already in flight are coalesced: they wait for that one's
+   answer rather than going upstream themselves. Successful answers are
+   also cached for a while, in a direct-mapped table keyed by a hash of
+   the request. An optional token bucket limits the rate of upstream
+   requests per endpoint; a request that would exceed it waits (up to
+   its own timeout).
+
+   The chat completions API has no way to put several different prompts
+   in one call, so "batching" here means coalescing duplicates and
+   running the rest in parallel over the pool.
+
+   Sessions keep their connection open between requests. The main
+   thread watches the idle ones and reads each request as it arrives,
+   without blocking, into a buffer of the session's own. Only a complete
+   request goes to one of a fixed pool of worker threads, which serves
+   it and hands the connection back; so a busy host costs file
+   descriptors, not threads, and a session that sends slowly holds up
+   nobody else. One that takes too long over a request is dropped.
+
+   Statistics are written to the log when the broker is stopped with
+   SIGINT or SIGTERM.
+*/
+
+#define BROKER_MAX_ENDPOINTS (16)
+#define BROKER_MAX_CONNS (64)
+#define BROKER_MAX_WORKERS (256)
+
+/* How long a session may take to send the rest of a request once it
+   has started, and to take its reply, before it is dropped. */
+#define BROKER_FRAME_TIMEOUT_S (5)
+#define BROKER_REPLY_TIMEOUT_S (30)
+
+#define BROKER_HEADER_LEN (20)
+
+typedef struct {
+    char url[512];
+    glk_llm_conn_t *conns[BROKER_MAX_CONNS];
+    int busy[BROKER_MAX_CONNS];
+    double tokens;          /* rate limit bucket */
+    double refilled;        /* when tokens was last topped up */
+} broker_endpoint_t;
+
+/* A request on its way upstream, and the sessions waiting on it. */
+typedef struct inflight_struct {
+    glk_llm_hash_t key;
+    int refs;
+    int done;
+    int ok;
+    int status;
+    glk_llm_strbuf_t response;
+    struct inflight_struct *next;
+} inflight_t;
+
+typedef struct {
+    glk_llm_hash_t key;
+    double stamp;
+    int status;
+    char *body;
+    size_t len;
+} cache_entry_t;
+
+static struct {
+    char socket[108];
+    int connections;
+    double rate;
+    double burst;
+    int cache_entries;
+    int cache_ttl_s;
+    int workers;
+    int max_sessions;
+    char log_file[512];
+} broker_config;
+
+static pthread_mutex_t broker_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t broker_cond = PTHREAD_COND_INITIALIZER;
+
+static broker_endpoint_t endpoints[BROKER_MAX_ENDPOINTS];
+static int numendpoints = 0;
+static inflight_t *inflight = NULL;
+static cache_entry_t *cache = NULL;
+
+static FILE *log_stream = NULL;
+static volatile sig_atomic_t stopping = 0;
+
+static struct {
+    long requests;
+    long cached;
+    long coalesced;
+    long upstream;
+    long failed;
+    long reused;
+    long pool_waits;
+    long rate_waits;
+    int sessions;
+    int peak_sessions;
+    long refused;
+    long slow;
+} broker_stats;
+
+/* A connected session, and the request it is part way through sending.
+   Only the main thread touches it while it is idle; only a worker while
+   its request is being served. */
+typedef struct {
+    int sock;
+    int idle;
+    unsigned char header[BROKER_HEADER_LEN];
+    size_t got;             /* bytes of the request so far */
+    char *frame;            /* URL, key and body, once the header is in */
+    size_t framelen;
+    double started;         /* when the first byte came */
+} session_t;
+
+/* Sessions with a request waiting, for the workers, and sessions the
+   workers are done with, for the main thread. Each is a ring of
+   max_sessions entries, since a session is only ever in one place. */
+typedef struct {
+    session_t *session;
+    int keep;
+} session_return_t;
+
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static session_t **ready_sessions = NULL;
+static int ready_head = 0, ready_count = 0;
+static session_return_t *returned = NULL;
+static int returned_count = 0;
+static int wake_pipe[2] = { -1, -1 };
+
+static void broker_log(const char *fmt, ...)
+{
+    char stamp[32];
+    time_t now = time(NULL);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", localtime(&now));
+
+    FILE *out = log_stream ? log_stream : stderr;
+    va_list args;
+    va_start(args, fmt);
+    flockfile(out);
+    fprintf(out, "[%s] ", stamp);
+    vfprintf(out, fmt, args);
+    fprintf(out, "\n");
+    fflush(out);
+    funlockfile(out);
+    va_end(args);
+}
+
+static void put_word(unsigned char *p, glui32 val)
+{
+    p[0] = (val >> 24) & 0xFF;
+    p[1] = (val >> 16) & 0xFF;
+    p[2] = (val >> 8) & 0xFF;
+    p[3] = val & 0xFF;
+}
+
+static glui32 get_word(const unsigned char *p)
+{
+    return ((glui32)p[0] << 24) | ((glui32)p[1] << 16) | ((glui32)p[2] << 8) | p[3];
+}
+
+static int write_all(int sock, const void *buf, size_t len)
+{
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t sent = write(sock, p, len);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+            return 0;
+        p += sent;
+        len -= sent;
+    }
+    return 1;
+}
+
+/* Wait on broker_cond (holding broker_lock) for a tenth of a second at
+   most, so that deadlines get checked. */
+static void wait_a_little(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += 100000000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&broker_cond, &broker_lock, &ts);
+}
+
+static int past(double deadline)
+{
+    return (deadline > 0 && gli_llm_now_ms() >= deadline);
+}
+
+/* Cache: direct-mapped, so a collision just replaces the older answer. */
+
+static cache_entry_t *cache_slot(glk_llm_hash_t key)
+{
+    if (!cache)
+        return NULL;
+    return &cache[key % broker_config.cache_entries];
+}
+
+static int cache_lookup(glk_llm_hash_t key, glk_llm_strbuf_t *response, int *status)
+{
+    int found = 0;
+    pthread_mutex_lock(&broker_lock);
+    cache_entry_t *ent = cache_slot(key);
+    if (ent && ent->body && ent->key == key
+        && gli_llm_now_ms() - ent->stamp < broker_config.cache_ttl_s * 1000.0) {
+        gli_llm_strbuf_append(response, ent->body, ent->len);
+        *status = ent->status;
+        found = 1;
+    }
+    pthread_mutex_unlock(&broker_lock);
+    return found;
+}
+
+static void cache_store(glk_llm_hash_t key, const glk_llm_strbuf_t *response, int status)
+{
+    char *copy = malloc(response->len + 1);
+    if (!copy)
+        return;
+    memcpy(copy, response->buf ? response->buf : "", response->len);
+
+    pthread_mutex_lock(&broker_lock);
+    cache_entry_t *ent = cache_slot(key);
+    if (ent) {
+        free(ent->body);
+        ent->key = key;
+        ent->stamp = gli_llm_now_ms();
+        ent->status = status;
+        ent->body = copy;
+        ent->len = response->len;
+        copy = NULL;
+    }
+    pthread_mutex_unlock(&broker_lock);
+    free(copy);
+}
+
+/* Endpoints, their connection pools, and their rate limits. All of
+   these are called with broker_lock held. */
+
+static broker_endpoint_t *find_endpoint(const char *url)
+{
+    for (int ix = 0; ix < numendpoints; ix++) {
+        if (strcmp(endpoints[ix].url, url) == 0)
+            return &endpoints[ix];
+    }
+    if (numendpoints == BROKER_MAX_ENDPOINTS || strlen(url) >= sizeof(endpoints[0].url))
+        return NULL;
+
+    broker_endpoint_t *ep = &endpoints[numendpoints++];
+    memset(ep, 0, sizeof(*ep));
+    strcpy(ep->url, url);
+    ep->tokens = broker_config.burst;
+    ep->refilled = gli_llm_now_ms();
+    broker_log("endpoint %s", url);
+    return ep;
+}
+
+/* A free connection slot, or -1 if all are busy. Open ones first. */
+static int take_conn(broker_endpoint_t *ep)
+{
+    int slot = -1;
+    for (int ix = 0; ix < broker_config.connections; ix++) {
+        if (ep->busy[ix])
+            continue;
+        if (ep->conns[ix] && gli_llm_conn_requests(ep->conns[ix]) > 0) {
+            slot = ix;
+            break;
+        }
+        if (slot < 0)
+            slot = ix;
+    }
+    if (slot >= 0) {
+        if (!ep->conns[slot])
+            ep->conns[slot] = gli_llm_conn_new();
+        if (!ep->conns[slot])
+            return -1;
+        ep->busy[slot] = 1;
+    }
+    return slot;
+}
+
+static int take_token(broker_endpoint_t *ep)
+{
+    if (broker_config.rate <= 0)
+        return 1;
+    double now = gli_llm_now_ms();
+    ep->tokens += (now - ep->refilled) * broker_config.rate / 1000.0;
+    if (ep->tokens > broker_config.burst)
+        ep->tokens = broker_config.burst;
+    ep->refilled = now;
+    if (ep->tokens < 1.0)
+        return 0;
+    ep->tokens -= 1.0;
+    return 1;
+}
+
+/* Make the request upstream, over a pooled connection. Fills in the
+   inflight entry's result. */
+static void forward(inflight_t *req, const char *url, const char *api_key, int timeout_ms,
+    const char *body, size_t len)
+{
+    double deadline = (timeout_ms > 0) ? gli_llm_now_ms() + timeout_ms : 0;
+    int waited_pool = 0, waited_rate = 0;
+
+    pthread_mutex_lock(&broker_lock);
+    broker_endpoint_t *ep = find_endpoint(url);
+    int slot = -1;
+    while (ep && !past(deadline) && !stopping) {
+        if (!take_token(ep)) {
+            waited_rate = 1;
+            wait_a_little();
+            continue;
+        }
+        slot = take_conn(ep);
+        if (slot >= 0)
+            break;
+        // No token spent after all
+        if (broker_config.rate > 0)
+            ep->tokens += 1.0;
+        waited_pool = 1;
+        wait_a_little();
+    }
+    broker_stats.pool_waits += waited_pool;
+    broker_stats.rate_waits += waited_rate;
+    glk_llm_conn_t *conn = (slot >= 0) ? ep->conns[slot] : NULL;
+    if (conn && gli_llm_conn_requests(conn) > 0)
+        broker_stats.reused++;
+    pthread_mutex_unlock(&broker_lock);
+
+    int ok = 0, status = 0;
+    if (conn) {
+        glk_llm_body_t reqbody;
+        gli_llm_body_init(&reqbody);
+        gli_llm_body_static(&reqbody, body, len);
+        int left = (deadline > 0) ? (int)(deadline - gli_llm_now_ms()) : 0;
+        if (deadline <= 0 || left > 0)
+            ok = gli_llm_conn_post(conn, url, api_key, left, &reqbody, &req->response, &status);
+        gli_llm_body_free(&reqbody);
+    }
+
+    pthread_mutex_lock(&broker_lock);
+    if (conn)
+        ep->busy[slot] = 0;
+    broker_stats.upstream++;
+    if (!ok)
+        broker_stats.failed++;
+    req->ok = ok;
+    req->status = status;
+    req->done = 1;
+    pthread_cond_broadcast(&broker_cond);
+    pthread_mutex_unlock(&broker_lock);
+}
+
+static void release(inflight_t *req)
+{
+    // Called with broker_lock held
+    if (--req->refs > 0)
+        return;
+    for (inflight_t **link = &inflight; *link; link = &(*link)->next) {
+        if (*link == req) {
+            *link = req->next;
+            break;
+        }
+    }
+    gli_llm_strbuf_free(&req->response);
+    free(req);
+}
+
+/* Answer one request: from the cache, from an identical request already
+   in flight, or upstream. */
+static void handle(const char *url, const char *api_key, int timeout_ms,
+    const char *body, size_t len, glk_llm_strbuf_t *response, int *ok, int *status)
+{
+    glk_llm_hash_t key = gli_llm_hash(url, strlen(url) + 1, 0);
+    key = gli_llm_hash(api_key, strlen(api_key) + 1, key);
+    key = gli_llm_hash(body, len, key);
+
+    __atomic_fetch_add(&broker_stats.requests, 1, __ATOMIC_RELAXED);
+    if (cache_lookup(key, response, status)) {
+        __atomic_fetch_add(&broker_stats.cached, 1, __ATOMIC_RELAXED);
+        *ok = 1;
+        return;
+    }
+
+    pthread_mutex_lock(&broker_lock);
+    inflight_t *req = inflight;
+    while (req && (req->key != key || req->done))
+        req = req->next;
+
+    if (req) {
+        // Someone asked exactly this a moment ago; wait for their answer
+        broker_stats.coalesced++;
+        req->refs++;
+        double deadline = (timeout_ms > 0) ? gli_llm_now_ms() + timeout_ms : 0;
+        while (!req->done && !past(deadline) && !stopping)
+            wait_a_little();
+        *ok = req->done && req->ok;
+        *status = req->status;
+        if (*ok)
+            gli_llm_strbuf_append(response, req->response.buf, req->response.len);
+        release(req);
+        pthread_mutex_unlock(&broker_lock);
+        return;
+    }
+
+    req = calloc(1, sizeof(inflight_t));
+    if (!req) {
+        pthread_mutex_unlock(&broker_lock);
+        *ok = 0;
+        return;
+    }
+    req->key = key;
+    req->refs = 1;
+    gli_llm_strbuf_init(&req->response);
+    req->next = inflight;
+    inflight = req;
+    pthread_mutex_unlock(&broker_lock);
+
+    forward(req, url, api_key, timeout_ms, body, len);
+
+    *ok = req->ok;
+    *status = req->status;
+    if (req->ok) {
+        gli_llm_strbuf_append(response, req->response.buf, req->response.len);
+        if (req->status == 200)
+            cache_store(key, &req->response, req->status);
+    }
+
+    pthread_mutex_lock(&broker_lock);
+    release(req);
+    pthread_mutex_unlock(&broker_lock);
+}
+
+/* Read whatever has arrived of a session's request, without blocking.
+   Returns 1 once the request is complete, 0 if there is more to come,
+   or -1 if the session should be dropped (it hung up, or sent
+   nonsense). */
+static int read_request(session_t *sess)
+{
+    for (;;) {
+        unsigned char *dest;
+        size_t want;
+        if (sess->got < BROKER_HEADER_LEN) {
+            dest = sess->header + sess->got;
+            want = BROKER_HEADER_LEN - sess->got;
+        }
+        else {
+            size_t have = sess->got - BROKER_HEADER_LEN;
+            if (have == sess->framelen)
+                return 1;
+            dest = (unsigned char *)sess->frame + have;
+            want = sess->framelen - have;
+        }
+
+        ssize_t got = recv(sess->sock, dest, want, MSG_DONTWAIT);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return 0;
+        if (got <= 0)
+            return -1;
+        if (!sess->got)
+            sess->started = gli_llm_now_ms();
+        sess->got += got;
+
+        if (sess->got == BROKER_HEADER_LEN) {
+            glui32 urllen = get_word(sess->header + 8);
+            glui32 keylen = get_word(sess->header + 12);
+            glui32 bodylen = get_word(sess->header + 16);
+            if (get_word(sess->header) != GLK_LLM_BROKER_MAGIC || urllen == 0 || urllen >= 512
+                || keylen >= 256 || bodylen > GLK_LLM_BROKER_MAX) {
+                broker_log("bad request frame; dropping the session");
+                return -1;
+            }
+            sess->framelen = (size_t)urllen + keylen + bodylen;
+            sess->frame = malloc(sess->framelen + 1);
+            if (!sess->frame)
+                return -1;
+        }
+    }
+}
+
+/* Ready the session for its next request. */
+static void session_reset(session_t *sess)
+{
+    free(sess->frame);
+    sess->frame = NULL;
+    sess->framelen = 0;
+    sess->got = 0;
+}
+
+/* Serve a session's complete request, and send the reply. Returns 0 if
+   the session should be dropped (the reply couldn't be sent). */
+static int serve_request(session_t *sess)
+{
+    glui32 timeout_ms = get_word(sess->header + 4);
+    glui32 urllen = get_word(sess->header + 8);
+    glui32 keylen = get_word(sess->header + 12);
+    glui32 bodylen = get_word(sess->header + 16);
+
+    char url[512], api_key[256];
+    memcpy(url, sess->frame, urllen);
+    url[urllen] = '\0';
+    memcpy(api_key, sess->frame + urllen, keylen);
+    api_key[keylen] = '\0';
+    const char *body = sess->frame + urllen + keylen;
+
+    glk_llm_strbuf_t response;
+    gli_llm_strbuf_init(&response);
+    int ok = 0, status = 0;
+    handle(url, api_key, (int)timeout_ms, body, bodylen, &response, &ok, &status);
+
+    unsigned char reply[16];
+    put_word(reply, GLK_LLM_BROKER_MAGIC);
+    put_word(reply + 4, ok);
+    put_word(reply + 8, status);
+    put_word(reply + 12, ok ? response.len : 0);
+    int sent = write_all(sess->sock, reply, sizeof(reply))
+        && (!ok || write_all(sess->sock, response.buf ? response.buf : "", response.len));
+    gli_llm_strbuf_free(&response);
+    return sent;
+}
+
+/* A worker: take a session with a request waiting, serve it, and give
+   the session back to the main thread. */
+static void *worker(void *rock)
+{
+    for (;;) {
+        pthread_mutex_lock(&queue_lock);
+        while (!ready_count)
+            pthread_cond_wait(&queue_cond, &queue_lock);
+        session_t *sess = ready_sessions[ready_head];
+        ready_head = (ready_head + 1) % broker_config.max_sessions;
+        ready_count--;
+        pthread_mutex_unlock(&queue_lock);
+
+        int keep = serve_request(sess);
+
+        pthread_mutex_lock(&queue_lock);
+        returned[returned_count].session = sess;
+        returned[returned_count].keep = keep;
+        returned_count++;
+        pthread_mutex_unlock(&queue_lock);
+        if (write(wake_pipe[1], "", 1) < 0) {
+            // Full already, so the main thread will wake anyway
+        }
+    }
+    return NULL;
+}
+
+static void session_count(int delta)
+{
+    pthread_mutex_lock(&broker_lock);
+    broker_stats.sessions += delta;
+    if (broker_stats.sessions > broker_stats.peak_sessions)
+        broker_stats.peak_sessions = broker_stats.sessions;
+    pthread_mutex_unlock(&broker_lock);
+}
+
+/* Close the session in slot ix of sessions, moving the last one into
+   its place. */
+static void drop_session(session_t **sessions, int *numsessions, int ix)
+{
+    session_t *sess = sessions[ix];
+    close(sess->sock);
+    free(sess->frame);
+    free(sess);
+    (*numsessions)--;
+    sessions[ix] = sessions[*numsessions];
+    session_count(-1);
+}
+
+/* The main loop: accept sessions, read requests from the idle ones, and
+   pass each complete request to the workers. */
+static void serve(int listener)
+{
+    int max = broker_config.max_sessions;
+    session_t **sessions = malloc(max * sizeof(session_t *));
+    int *polled = malloc(max * sizeof(int));
+    struct pollfd *pfds = malloc((max + 2) * sizeof(struct pollfd));
+    if (!sessions || !polled || !pfds) {
+        broker_log("out of memory");
+        return;
+    }
+    int numsessions = 0;
+
+    while (!stopping) {
+        pfds[0].fd = listener;
+        pfds[0].events = POLLIN;
+        pfds[1].fd = wake_pipe[0];
+        pfds[1].events = POLLIN;
+        int numpfds = 2;
+        for (int ix = 0; ix < numsessions; ix++) {
+            if (!sessions[ix]->idle)
+                continue;
+            polled[numpfds - 2] = ix;
+            pfds[numpfds].fd = sessions[ix]->sock;
+            pfds[numpfds].events = POLLIN;
+            numpfds++;
+        }
+        int ready = poll(pfds, numpfds, 1000);
+
+        // Read what has come in. Go backwards, since dropping a session
+        // moves the last one into its slot
+        for (int px = numpfds - 1; ready > 0 && px >= 2; px--) {
+            if (!pfds[px].revents)
+                continue;
+            int ix = polled[px - 2];
+            session_t *sess = sessions[ix];
+            int done = read_request(sess);
+            if (done < 0) {
+                drop_session(sessions, &numsessions, ix);
+                continue;
+            }
+            if (!done)
+                continue;
+            sess->idle = 0;
+            pthread_mutex_lock(&queue_lock);
+            ready_sessions[(ready_head + ready_count) % max] = sess;
+            ready_count++;
+            pthread_cond_signal(&queue_cond);
+            pthread_mutex_unlock(&queue_lock);
+        }
+
+        // Sessions that started a request and have stalled part way
+        double now = gli_llm_now_ms();
+        for (int ix = numsessions - 1; ix >= 0; ix--) {
+            session_t *sess = sessions[ix];
+            if (!sess->idle || !sess->got
+                || now - sess->started < BROKER_FRAME_TIMEOUT_S * 1000.0)
+                continue;
+            pthread_mutex_lock(&broker_lock);
+            if (!broker_stats.slow++)
+                broker_log("a session took over %ds to send a request; dropping it", BROKER_FRAME_TIMEOUT_S);
+            pthread_mutex_unlock(&broker_lock);
+            drop_session(sessions, &numsessions, ix);
+        }
+        if (ready <= 0)
+            continue;
+
+        // Sessions the workers have finished with
+        if (pfds[1].revents) {
+            char drain[64];
+            while (read(wake_pipe[0], drain, sizeof(drain)) > 0)
+                ;
+            pthread_mutex_lock(&queue_lock);
+            for (int rx = 0; rx < returned_count; rx++) {
+                int ix = 0;
+                while (ix < numsessions && sessions[ix] != returned[rx].session)
+                    ix++;
+                if (ix == numsessions)
+                    continue;
+                if (returned[rx].keep) {
+                    session_reset(sessions[ix]);
+                    sessions[ix]->idle = 1;
+                    continue;
+                }
+                drop_session(sessions, &numsessions, ix);
+            }
+            returned_count = 0;
+            pthread_mutex_unlock(&queue_lock);
+        }
+
+        if (pfds[0].revents & POLLIN) {
+            int sock = accept(listener, NULL, NULL);
+            if (sock < 0)
+                continue;
+            session_t *sess = (numsessions < max) ? calloc(1, sizeof(session_t)) : NULL;
+            if (!sess) {
+                pthread_mutex_lock(&broker_lock);
+                if (!broker_stats.refused++)
+                    broker_log("%d sessions already; refusing more (see -m)", max);
+                pthread_mutex_unlock(&broker_lock);
+                close(sock);
+                continue;
+            }
+            struct timeval tv;
+            tv.tv_sec = BROKER_REPLY_TIMEOUT_S;
+            tv.tv_usec = 0;
+            setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+            sess->sock = sock;
+            sess->idle = 1;
+            sessions[numsessions++] = sess;
+            session_count(1);
+        }
+    }
+
+    free(sessions);
+    free(polled);
+    free(pfds);
+}
+
+static int listen_unix(const char *path)
+{
+    struct sockaddr_un addr;
+    size_t len = strlen(path);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (len == 0 || len >= sizeof(addr.sun_path))
+        return -1;
+
+    socklen_t addrlen;
+    if (path[0] == '@') {
+        // Abstract namespace, as in the client
+        memcpy(addr.sun_path + 1, path + 1, len - 1);
+        addrlen = offsetof(struct sockaddr_un, sun_path) + len;
+    } else {
+        memcpy(addr.sun_path, path, len);
+        addrlen = sizeof(addr);
+        unlink(path);
+    }
+
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0)
+        return -1;
+    if (bind(sock, (struct sockaddr *)&addr, addrlen) < 0 || listen(sock, 128) < 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+static void on_signal(int sig)
+{
+    stopping = 1;
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+        "usage: glkllmbroker [options]\n"
+        "  -s path   socket to listen on (default /tmp/glkllmbroker.sock; @name for abstract)\n"
+        "  -c n      connections per endpoint (default 8)\n"
+        "  -r n      upstream requests per second per endpoint (default 0, no limit)\n"
+        "  -b n      burst allowed above that rate (default: the rate)\n"
+        "  -n n      cached answers (default 1024; 0 for no cache)\n"
+        "  -t s      how long an answer stays cached, in seconds (default 600)\n"
+        "  -w n      worker threads serving requests (default 32)\n"
+        "  -m n      most sessions connected at once (default 1024)\n"
+        "  -l file   log to file instead of stderr\n");
+}
+
+int main(int argc, char *argv[])
+{
+    strcpy(broker_config.socket, "/tmp/glkllmbroker.sock");
+    broker_config.connections = 8;
+    broker_config.cache_entries = 1024;
+    broker_config.cache_ttl_s = 600;
+    broker_config.workers = 32;
+    broker_config.max_sessions = 1024;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:c:r:b:n:t:w:m:l:h")) != -1) {
+        switch (opt) {
+        case 's':
+            strncpy(broker_config.socket, optarg, sizeof(broker_config.socket) - 1);
+            break;
+        case 'c':
+            broker_config.connections = atoi(optarg);
+            break;
+        case 'r':
+            broker_config.rate = atof(optarg);
+            break;
+        case 'b':
+            broker_config.burst = atof(optarg);
+            break;
+        case 'n':
+            broker_config.cache_entries = atoi(optarg);
+            break;
+        case 't':
+            broker_config.cache_ttl_s = atoi(optarg);
+            break;
+        case 'w':
+            broker_config.workers = atoi(optarg);
+            break;
+        case 'm':
+            broker_config.max_sessions = atoi(optarg);
+            break;
+        case 'l':
+            strncpy(broker_config.log_file, optarg, sizeof(broker_config.log_file) - 1);
+            break;
+        default:
+            usage();
+            return (opt == 'h') ? 0 : 2;
+        }
+    }
+
+    if (broker_config.connections < 1)
+        broker_config.connections = 1;
+    if (broker_config.connections > BROKER_MAX_CONNS)
+        broker_config.connections = BROKER_MAX_CONNS;
+    if (broker_config.workers < 1)
+        broker_config.workers = 1;
+    if (broker_config.workers > BROKER_MAX_WORKERS)
+        broker_config.workers = BROKER_MAX_WORKERS;
+    if (broker_config.max_sessions < 1)
+        broker_config.max_sessions = 1;
+    if (broker_config.burst < 1.0)
+        broker_config.burst = (broker_config.rate > 1.0) ? broker_config.rate : 1.0;
+    if (broker_config.cache_entries > 0) {
+        cache = calloc(broker_config.cache_entries, sizeof(cache_entry_t));
+        if (!cache)
+            broker_config.cache_entries = 0;
+    }
+    if (broker_config.log_file[0]) {
+        log_stream = fopen(broker_config.log_file, "a");
+        if (!log_stream) {
+            fprintf(stderr, "glkllmbroker: cannot open %s\n", broker_config.log_file);
+            return 1;
+        }
+    }
+
+    int listener = listen_unix(broker_config.socket);
+    if (listener < 0) {
+        fprintf(stderr, "glkllmbroker: cannot listen on %s: %s\n", broker_config.socket, strerror(errno));
+        return 1;
+    }
+
+    ready_sessions = malloc(broker_config.max_sessions * sizeof(session_t *));
+    returned = malloc(broker_config.max_sessions * sizeof(session_return_t));
+    if (!ready_sessions || !returned || pipe(wake_pipe) < 0) {
+        fprintf(stderr, "glkllmbroker: cannot set up: %s\n", strerror(errno));
+        return 1;
+    }
+    fcntl(wake_pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(wake_pipe[1], F_SETFL, O_NONBLOCK);
+    for (int ix = 0; ix < broker_config.workers; ix++) {
+        pthread_t thread;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        int err = pthread_create(&thread, &attr, worker, NULL);
+        pthread_attr_destroy(&attr);
+        if (err) {
+            fprintf(stderr, "glkllmbroker: cannot start workers: %s\n", strerror(err));
+            return 1;
+        }
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    broker_log("listening on %s: connections=%d rate=%g burst=%g cache=%d ttl=%ds workers=%d sessions=%d",
+        broker_config.socket, broker_config.connections, broker_config.rate,
+        broker_config.burst, broker_config.cache_entries, broker_config.cache_ttl_s,
+        broker_config.workers, broker_config.max_sessions);
+
+    serve(listener);
+
+    close(listener);
+    if (broker_config.socket[0] != '@')
+        unlink(broker_config.socket);
+
+    pthread_mutex_lock(&broker_lock);
+    broker_log("stopping: requests=%ld cached=%ld coalesced=%ld upstream=%ld failed=%ld "
+        "reused_connections=%ld pool_waits=%ld rate_waits=%ld peak_sessions=%d refused=%ld slow=%ld",
+        broker_stats.requests, broker_stats.cached, broker_stats.coalesced,
+        broker_stats.upstream, broker_stats.failed, broker_stats.reused,
+        broker_stats.pool_waits, broker_stats.rate_waits, broker_stats.peak_sessions,
+        broker_stats.refused, broker_stats.slow);
+    pthread_mutex_unlock(&broker_lock);
+    return 0;
+}
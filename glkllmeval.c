@@ -0,0 +1,570 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "glk.h"
+#include "glkstart.h"
+#include "cheapglk.h"
+#include "glk_llm.h"
+
+/* glkllmeval: measure how well, and how fast, a configuration
+   interprets player input.
+
+   A corpus is a text file of items separated by blank lines:
+
+     # comments start with #
+     context: West of House
+     context: You are standing in an open field west of a white house.
+     > open mailbox
+     context: Opening the small mailbox reveals a leaflet.
+     input: grab the paper
+     expect: take leaflet | get leaflet
+     expect: take paper
+
+   "context:" lines are game output, oldest first; a "> command" line
+   ends a turn, as if the player had typed that command. "input:" is
+   what the player types, and "expect:" lists the acceptable commands
+   (separated by "|", and the line may be repeated). Commands are
+   compared ignoring case, spacing and a final full stop.
+
+   Each item goes through the same path as real input: its context is
+   captured as game output, a new turn starts, and gli_llm_process_input()
+   interprets the input with the prompt template, tiers, local paths and
+   backend (HTTP, broker, or a cassette in replay mode) of the current
+   configuration. Items run in their own processes, forked from the same
+   starting state, so one item's interpretation can't teach the next.
+
+   The report gives exact-match accuracy, the rate of inputs for which
+   nothing was produced, which tier answered, and latency percentiles.
+   With -a and -b, two configuration files are run over the same corpus
+   and reported side by side, followed by the items they disagree on.
+*/
+
+#define EVAL_MAX_EXPECT (8)
+
+#define evaloutcome_Correct (0)
+#define evaloutcome_Wrong (1)
+
+typedef struct {
+    int line;
+    char **context;
+    int numcontext;
+    char input[256];
+    char expect[EVAL_MAX_EXPECT][256];
+    int numexpect;
+} eval_item_t;
+
+typedef struct {
+    int outcome;
+    int tier;
+    double ms;
+    char output[256];
+} eval_result_t;
+
+typedef struct {
+    char label[256];
+    char model[128];
+    char fast_model[128];
+    eval_result_t *results;
+    int numresults;
+} eval_run_t;
+
+static char *corpus_path = NULL;
+static char *config_a = NULL;
+static char *config_b = NULL;
+static int results_fd = -1;
+static char *self_path = NULL;
+
+static eval_item_t *items = NULL;
+static int numitems = 0;
+
+glkunix_argumentlist_t glkunix_arguments[] = {
+    { "-corpus", glkunix_arg_ValueFollows, "corpus of inputs and acceptable commands" },
+    { "-a", glkunix_arg_ValueFollows, "configuration file to evaluate" },
+    { "-b", glkunix_arg_ValueFollows, "second configuration, to compare with -a" },
+    { "-results", glkunix_arg_NumberValue, "(internal) write raw results to this descriptor" },
+    { NULL, glkunix_arg_End, NULL }
+};
+
+int glkunix_startup_code(glkunix_startup_t *data)
+{
+    self_path = data->argv[0];
+    for (int ix = 1; ix < data->argc; ix++) {
+        const char *arg = data->argv[ix];
+        const char *val = (ix + 1 < data->argc) ? data->argv[ix + 1] : NULL;
+        if (strcmp(arg, "-corpus") == 0 && val) {
+            corpus_path = data->argv[++ix];
+        } else if (strcmp(arg, "-a") == 0 && val) {
+            config_a = data->argv[++ix];
+        } else if (strcmp(arg, "-b") == 0 && val) {
+            config_b = data->argv[++ix];
+        } else if (strcmp(arg, "-results") == 0 && val) {
+            results_fd = atoi(data->argv[++ix]);
+        }
+    }
+    if (!corpus_path) {
+        fprintf(stderr, "usage: %s -corpus FILE [-a CONFIG [-b CONFIG]]\n", data->argv[0]);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/* Lower case, single spaces, no final full stop. */
+static void normalize(const char *src, char *dest, size_t len)
+{
+    size_t pos = 0;
+    int space = 0;
+
+    while (*src && isspace((unsigned char)*src))
+        src++;
+    for (; *src && pos < len - 1; src++) {
+        if (isspace((unsigned char)*src)) {
+            space = 1;
+            continue;
+        }
+        if (space && pos < len - 2)
+            dest[pos++] = ' ';
+        space = 0;
+        dest[pos++] = tolower((unsigned char)*src);
+    }
+    while (pos && dest[pos - 1] == '.')
+        pos--;
+    dest[pos] = '\0';
+}
+
+static char *trim(char *text)
+{
+    while (isspace((unsigned char)*text))
+        text++;
+    size_t len = strlen(text);
+    while (len && isspace((unsigned char)text[len - 1]))
+        text[--len] = '\0';
+    return text;
+}
+
+static eval_item_t *new_item(int line)
+{
+    eval_item_t *list = realloc(items, (numitems + 1) * sizeof(eval_item_t));
+    if (!list)
+        return NULL;
+    items = list;
+    eval_item_t *item = &items[numitems++];
+    memset(item, 0, sizeof(*item));
+    item->line = line;
+    return item;
+}
+
+static void add_context(eval_item_t *item, const char *text)
+{
+    char **list = realloc(item->context, (item->numcontext + 1) * sizeof(char *));
+    if (!list)
+        return;
+    item->context = list;
+    item->context[item->numcontext] = strdup(text);
+    if (item->context[item->numcontext])
+        item->numcontext++;
+}
+
+static int load_corpus(const char *filename)
+{
+    FILE *f = fopen(filename, "r");
+    if (!f) {
+        fprintf(stderr, "glkllmeval: cannot open %s: %s\n", filename, strerror(errno));
+        return 0;
+    }
+
+    char buf[1024];
+    int lineno = 0;
+    eval_item_t *item = NULL;
+    while (fgets(buf, sizeof(buf), f)) {
+        lineno++;
+        char *line = trim(buf);
+        if (line[0] == '#')
+            continue;
+        if (!line[0]) {
+            item = NULL;
+            continue;
+        }
+        if (!item && !(item = new_item(lineno)))
+            break;
+
+        if (line[0] == '>') {
+            add_context(item, line);
+        } else if (strncmp(line, "context:", 8) == 0) {
+            // Keep the game's own spacing, less the one after the colon
+            const char *text = buf + (line - buf) + 8;
+            add_context(item, (*text == ' ') ? text + 1 : text);
+        } else if (strncmp(line, "input:", 6) == 0) {
+            strncpy(item->input, trim(line + 6), sizeof(item->input) - 1);
+        } else if (strncmp(line, "expect:", 7) == 0) {
+            char *alt = strtok(line + 7, "|");
+            for (; alt && item->numexpect < EVAL_MAX_EXPECT; alt = strtok(NULL, "|"))
+                normalize(alt, item->expect[item->numexpect++], sizeof(item->expect[0]));
+        } else {
+            fprintf(stderr, "glkllmeval: %s:%d: not understood: %s\n", filename, lineno, line);
+        }
+    }
+    fclose(f);
+
+    // Drop items with nothing to ask or nothing to check against
+    int kept = 0;
+    for (int ix = 0; ix < numitems; ix++) {
+        if (items[ix].input[0] && items[ix].numexpect)
+            items[kept++] = items[ix];
+        else
+            fprintf(stderr, "glkllmeval: %s:%d: item needs input: and expect:\n", filename, items[ix].line);
+    }
+    numitems = kept;
+    return 1;
+}
+
+/* Replay an item's context and interpret its input. Runs in a child
+   process; the result goes back as one line on fd. */
+static void run_item(eval_item_t *item, int fd)
+{
+    for (int ix = 0; ix < item->numcontext; ix++) {
+        const char *text = item->context[ix];
+        if (text[0] == '>') {
+            text = trim((char *)text + 1);
+            gli_llm_new_turn();
+            gli_llm_prepare_input();
+            gli_llm_context.parser_error = 0;
+            strncpy(gli_llm_context.last_user_input, text, sizeof(gli_llm_context.last_user_input) - 1);
+            gli_llm_add_history(text, NULL);
+        } else {
+            gli_llm_add_context(text);
+        }
+    }
+    gli_llm_new_turn();
+    gli_llm_prepare_input();
+    gli_llm_context.parser_error = 0;
+
+    gli_llm_context.num_alternates = 0;
+    gli_llm_context.next_alternate = 0;
+    gli_llm_context.tier = llmtier_None;
+    strncpy(gli_llm_context.last_user_input, item->input, sizeof(gli_llm_context.last_user_input) - 1);
+
+    char output[256];
+    double start = gli_llm_now_ms();
+    if (!gli_llm_process_input(item->input, output, sizeof(output))) {
+        strncpy(output, item->input, sizeof(output) - 1);
+        output[sizeof(output) - 1] = '\0';
+    }
+    double elapsed = gli_llm_now_ms() - start;
+
+    char norm[256];
+    normalize(output, norm, sizeof(norm));
+    int outcome = evaloutcome_Wrong;
+    for (int ix = 0; ix < item->numexpect; ix++) {
+        if (strcmp(norm, item->expect[ix]) == 0)
+            outcome = evaloutcome_Correct;
+    }
+
+    char line[400];
+    int len = snprintf(line, sizeof(line), "R\t%d\t%d\t%.1f\t%s\n",
+        outcome, gli_llm_context.tier, elapsed, norm);
+    if (len > (int)sizeof(line) - 1)
+        len = sizeof(line) - 1;
+    if (write(fd, line, len) < 0)
+        _exit(1);
+}
+
+/* Run every item under the configuration this process was started
+   with, writing raw result lines to fd. */
+static void run_corpus(int fd)
+{
+    char header[300];
+    int len = snprintf(header, sizeof(header), "M\t%s\t%s\n",
+        gli_llm_config.model, gli_llm_config.fast_model);
+    if (write(fd, header, len) < 0)
+        return;
+
+    for (int ix = 0; ix < numitems; ix++) {
+        int pipefd[2];
+        if (pipe(pipefd) < 0)
+            return;
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(pipefd[0]);
+            run_item(&items[ix], pipefd[1]);
+            _exit(0);
+        }
+        close(pipefd[1]);
+
+        char line[400];
+        ssize_t got = 0, total = 0;
+        while (pid > 0 && total < (ssize_t)sizeof(line) - 1
+            && (got = read(pipefd[0], line + total, sizeof(line) - 1 - total)) > 0)
+            total += got;
+        close(pipefd[0]);
+        if (pid > 0)
+            waitpid(pid, NULL, 0);
+
+        // A crashed item still gets a line, so the runs stay aligned
+        if (total <= 0 || line[total - 1] != '\n')
+            total = snprintf(line, sizeof(line), "R\t%d\t%d\t0.0\t\n", evaloutcome_Wrong, llmtier_None);
+        if (write(fd, line, total) < 0)
+            return;
+    }
+}
+
+static int read_run(FILE *in, eval_run_t *run)
+{
+    char line[512];
+    run->results = calloc(numitems ? numitems : 1, sizeof(eval_result_t));
+    if (!run->results)
+        return 0;
+
+    while (fgets(line, sizeof(line), in)) {
+        line[strcspn(line, "\n")] = '\0';
+        char *fields[5];
+        int count = 0;
+        char *p = line;
+        while (count < 5) {
+            fields[count++] = p;
+            p = strchr(p, '\t');
+            if (!p)
+                break;
+            *p++ = '\0';
+        }
+        if (fields[0][0] == 'M' && count >= 3) {
+            strncpy(run->model, fields[1], sizeof(run->model) - 1);
+            strncpy(run->fast_model, fields[2], sizeof(run->fast_model) - 1);
+        } else if (fields[0][0] == 'R' && count == 5 && run->numresults < numitems) {
+            eval_result_t *res = &run->results[run->numresults++];
+            res->outcome = atoi(fields[1]);
+            res->tier = atoi(fields[2]);
+            res->ms = atof(fields[3]);
+            strncpy(res->output, fields[4], sizeof(res->output) - 1);
+        }
+    }
+    return (run->numresults == numitems);
+}
+
+/* Run the corpus under a configuration file, in a fresh copy of this
+   program (the configuration is read at startup). */
+static int run_config(const char *config, eval_run_t *run)
+{
+    snprintf(run->label, sizeof(run->label), "%s", config);
+
+    int pipefd[2];
+    if (pipe(pipefd) < 0)
+        return 0;
+    pid_t pid = fork();
+    if (pid < 0)
+        return 0;
+    if (pid == 0) {
+        close(pipefd[0]);
+        char fdarg[16];
+        snprintf(fdarg, sizeof(fdarg), "%d", pipefd[1]);
+        setenv("GLK_LLM_CONFIG", config, 1);
+        execl(self_path, self_path, "-q", "-corpus", corpus_path, "-results", fdarg, (char *)NULL);
+        _exit(127);
+    }
+    close(pipefd[1]);
+
+    FILE *in = fdopen(pipefd[0], "r");
+    int ok = in && read_run(in, run);
+    if (in)
+        fclose(in);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if (!ok)
+        fprintf(stderr, "glkllmeval: the run with %s did not finish\n", config);
+    return ok;
+}
+
+/* Run the corpus in this process's own configuration. */
+static int run_here(eval_run_t *run)
+{
+    const char *config = getenv("GLK_LLM_CONFIG");
+    snprintf(run->label, sizeof(run->label), "%s", config ? config : "(default)");
+
+    // Through a temporary file, since we would be both ends of a pipe
+    FILE *tmp = tmpfile();
+    if (!tmp)
+        return 0;
+    run_corpus(fileno(tmp));
+    rewind(tmp);
+    int ok = read_run(tmp, run);
+    fclose(tmp);
+    return ok;
+}
+
+typedef struct {
+    int correct;
+    int empty;
+    int tiers[4];
+    double mean, p50, p90, p99, max;
+} eval_summary_t;
+
+static int compare_ms(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* The nearest-rank percentile of a sorted list. */
+static double percentile(const double *sorted, int count, double pct)
+{
+    if (!count)
+        return 0;
+    int rank = (int)(pct / 100.0 * count + 0.999999);
+    if (rank < 1)
+        rank = 1;
+    if (rank > count)
+        rank = count;
+    return sorted[rank - 1];
+}
+
+static void summarize(const eval_run_t *run, eval_summary_t *sum)
+{
+    memset(sum, 0, sizeof(*sum));
+    double *ms = malloc((run->numresults ? run->numresults : 1) * sizeof(double));
+    if (!ms)
+        return;
+    double total = 0;
+    for (int ix = 0; ix < run->numresults; ix++) {
+        const eval_result_t *res = &run->results[ix];
+        if (res->outcome == evaloutcome_Correct)
+            sum->correct++;
+        if (res->tier == llmtier_None)
+            sum->empty++;
+        if (res->tier >= 0 && res->tier < 4)
+            sum->tiers[res->tier]++;
+        ms[ix] = res->ms;
+        total += res->ms;
+    }
+    qsort(ms, run->numresults, sizeof(double), compare_ms);
+    if (run->numresults) {
+        sum->mean = total / run->numresults;
+        sum->p50 = percentile(ms, run->numresults, 50);
+        sum->p90 = percentile(ms, run->numresults, 90);
+        sum->p99 = percentile(ms, run->numresults, 99);
+        sum->max = ms[run->numresults - 1];
+    }
+    free(ms);
+}
+
+static double pct(int part, int whole)
+{
+    return whole ? 100.0 * part / whole : 0.0;
+}
+
+static const char *outcome_name(const eval_result_t *res)
+{
+    if (res->outcome == evaloutcome_Correct)
+        return "ok";
+    return (res->tier == llmtier_None) ? "empty" : "wrong";
+}
+
+/* The report: one column per run, then the items that went wrong (one
+   run) or that the runs disagree on (two). */
+static void report(eval_run_t *runs, int numruns)
+{
+    eval_summary_t sums[2];
+    char cell[300];
+    for (int ix = 0; ix < numruns; ix++)
+        summarize(&runs[ix], &sums[ix]);
+
+    printf("corpus: %s (%d items)\n\n", corpus_path, numitems);
+
+    if (numruns > 1)
+        printf("%-16s %-24s %-24s\n", "", "A", "B");
+    printf("%-16s", "config");
+    for (int ix = 0; ix < numruns; ix++)
+        printf(" %-24.24s", runs[ix].label);
+    printf("\n%-16s", "model");
+    for (int ix = 0; ix < numruns; ix++) {
+        if (runs[ix].fast_model[0])
+            snprintf(cell, sizeof(cell), "%s / %s", runs[ix].fast_model, runs[ix].model);
+        else
+            snprintf(cell, sizeof(cell), "%s", runs[ix].model);
+        printf(" %-24.24s", cell);
+    }
+    printf("\n%-16s", "accuracy");
+    for (int ix = 0; ix < numruns; ix++) {
+        snprintf(cell, sizeof(cell), "%.1f%% (%d)", pct(sums[ix].correct, numitems), sums[ix].correct);
+        printf(" %-24s", cell);
+    }
+    printf("\n%-16s", "empty");
+    for (int ix = 0; ix < numruns; ix++) {
+        snprintf(cell, sizeof(cell), "%.1f%% (%d)", pct(sums[ix].empty, numitems), sums[ix].empty);
+        printf(" %-24s", cell);
+    }
+    printf("\n%-16s", "local/fast/main");
+    for (int ix = 0; ix < numruns; ix++) {
+        snprintf(cell, sizeof(cell), "%d/%d/%d", sums[ix].tiers[llmtier_Local],
+            sums[ix].tiers[llmtier_Fast], sums[ix].tiers[llmtier_Main]);
+        printf(" %-24s", cell);
+    }
+
+    const char *names[] = { "mean ms", "p50 ms", "p90 ms", "p99 ms", "max ms" };
+    for (int row = 0; row < 5; row++) {
+        printf("\n%-16s", names[row]);
+        for (int ix = 0; ix < numruns; ix++) {
+            double vals[] = { sums[ix].mean, sums[ix].p50, sums[ix].p90, sums[ix].p99, sums[ix].max };
+            snprintf(cell, sizeof(cell), "%.0f", vals[row]);
+            printf(" %-24s", cell);
+        }
+    }
+    printf("\n");
+
+    int shown = 0;
+    for (int it = 0; it < numitems; it++) {
+        const eval_result_t *a = &runs[0].results[it];
+        const eval_result_t *b = (numruns > 1) ? &runs[1].results[it] : NULL;
+        if (b ? (a->outcome == b->outcome && strcmp(a->output, b->output) == 0)
+            : (a->outcome == evaloutcome_Correct))
+            continue;
+        if (!shown++)
+            printf("\n%s:\n", b ? "differences" : "misses");
+        printf("  line %d: \"%s\" (expect \"%s\")\n", items[it].line, items[it].input, items[it].expect[0]);
+        printf("    %s\"%s\" %s\n", b ? "A: " : "", a->output, outcome_name(a));
+        if (b)
+            printf("    B: \"%s\" %s\n", b->output, outcome_name(b));
+    }
+}
+
+void glk_main(void)
+{
+    if (!load_corpus(corpus_path))
+        return;
+    if (!numitems) {
+        fprintf(stderr, "glkllmeval: no items in %s\n", corpus_path);
+        return;
+    }
+
+    // A copy started by run_config(): just the raw results
+    if (results_fd >= 0) {
+        if (!gli_llm_config.enabled) {
+            fprintf(stderr, "glkllmeval: %s does not enable interpretation\n",
+                getenv("GLK_LLM_CONFIG") ? getenv("GLK_LLM_CONFIG") : "the configuration");
+            return;
+        }
+        run_corpus(results_fd);
+        close(results_fd);
+        return;
+    }
+
+    eval_run_t runs[2];
+    memset(runs, 0, sizeof(runs));
+    int numruns = 0;
+    if (config_a) {
+        if (!run_config(config_a, &runs[numruns++]))
+            return;
+        if (config_b && !run_config(config_b, &runs[numruns++]))
+            return;
+    } else {
+        if (!gli_llm_config.enabled) {
+            fprintf(stderr, "glkllmeval: interpretation is not enabled (set GLK_LLM_CONFIG, or use -a)\n");
+            return;
+        }
+        if (!run_here(&runs[numruns++]))
+            return;
+    }
+    report(runs, numruns);
+}